@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "msgpack.h"
+
+#define bench_log printf
+#define BENCH_PRINT(format, ...) bench_log(format "\n", __VA_ARGS__)
+
+/* Every loop runs this many times, the fastest run is reported. */
+#ifndef BENCH_REPEAT
+#define BENCH_REPEAT 5
+#endif
+
+/* Results are stored here so the compiler can not drop the measured work. */
+extern volatile uint64_t bench_sink;
+
+/* Only the benches whose name contains it run, NULL for all. */
+extern const char *bench_filter;
+
+/**
+ * Growable buffers and arenas of the benches take memory from it, so the
+ * allocations of a loop are reported with its time.
+ */
+extern const msgpack_allocator_t bench_allocator;
+extern uint64_t bench_alloc_count;
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline void bench_report(const char *name, uint64_t ops, uint64_t bytes,
+        uint64_t ns, uint64_t allocs) {
+  double ns_op = ops ? (double)ns / (double)ops : 0.0;
+  double mb_s = ns ? (double)bytes * 1000.0 / (double)ns : 0.0;
+  double allocs_op = ops ? (double)allocs / (double)ops : 0.0;
+  BENCH_PRINT("%-40s %12.2f ns/op %10.2f MB/s %8.2f allocs/op",
+      name, ns_op, mb_s, allocs_op);
+}
+
+/**
+ * Run body iters times and report the time per run, bytes is the size of
+ * the data one run processes. The loop is repeated BENCH_REPEAT times and
+ * the fastest repeat is kept, allocations are averaged over all of them.
+ */
+#define BENCH_LOOP(name, iters, bytes, body) \
+  do { \
+    uint64_t _n; \
+    uint64_t _r; \
+    uint64_t _start; \
+    uint64_t _ns; \
+    uint64_t _best = UINT64_MAX; \
+    uint64_t _allocs = bench_alloc_count; \
+    for (_r = 0; _r < BENCH_REPEAT; ++_r) { \
+      _start = bench_now_ns(); \
+      for (_n = 0; _n < (uint64_t)(iters); ++_n) { \
+        body; \
+      } \
+      _ns = bench_now_ns() - _start; \
+      if (_ns < _best) { \
+        _best = _ns; \
+      } \
+    } \
+    bench_report(name, (iters), (uint64_t)(iters) * (bytes), _best, \
+        (bench_alloc_count - _allocs) / BENCH_REPEAT); \
+  } while (0)
+
+#define BENCH(bench_suite, bench_case) \
+  void bench_##bench_suite##_##bench_case(void)
+
+#define DECLARE_BENCH(bench_suite, bench_case) \
+  void bench_##bench_suite##_##bench_case(void)
+
+#define RUN_BENCH(bench_suite, bench_case) \
+  do { \
+    if (!bench_filter || \
+        strstr(#bench_suite "_" #bench_case, bench_filter)) { \
+      BENCH_PRINT("[BENCH] <<%s>>", "bench_" #bench_suite "_" #bench_case); \
+      bench_##bench_suite##_##bench_case(); \
+    } \
+  } while (0)
+
+#endif
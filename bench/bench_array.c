@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_ELEMS 4096
+#define BENCH_ITERS 2000
+
+static double bench_doubles[BENCH_ELEMS];
+static int32_t bench_ints[BENCH_ELEMS];
+static uint8_t bench_out[BENCH_ELEMS * 9 + 8];
+
+/* Telemetry like values: doubles, and small ints with a few wide ones. */
+static void bench_fill_arrays(void) {
+  int i;
+
+  for (i = 0; i < BENCH_ELEMS; ++i) {
+    bench_doubles[i] = i * 0.125 - 3.0;
+    bench_ints[i] = i % 64 == 63 ? i * 1000 : i % 100 - 20;
+  }
+}
+
+BENCH(array, write_double_loop) {
+  msgpack_buffer_t mbuf;
+  int i;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_double_loop", BENCH_ITERS, BENCH_ELEMS * 8, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_arr(&mbuf, BENCH_ELEMS);
+    for (i = 0; i < BENCH_ELEMS; ++i) {
+      msgpack_write_double(&mbuf, bench_doubles[i]);
+    }
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, write_double_array) {
+  msgpack_buffer_t mbuf;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_double_array", BENCH_ITERS, BENCH_ELEMS * 8, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_double_array(&mbuf, bench_doubles, BENCH_ELEMS);
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, write_s32_loop) {
+  msgpack_buffer_t mbuf;
+  int i;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_s32_loop", BENCH_ITERS, BENCH_ELEMS * 4, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_arr(&mbuf, BENCH_ELEMS);
+    for (i = 0; i < BENCH_ELEMS; ++i) {
+      msgpack_write_s32(&mbuf, bench_ints[i]);
+    }
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, write_s32_array) {
+  msgpack_buffer_t mbuf;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_s32_array", BENCH_ITERS, BENCH_ELEMS * 4, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_s32_array(&mbuf, bench_ints, BENCH_ELEMS);
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, write_integer_loop) {
+  msgpack_buffer_t mbuf;
+  int i;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_integer_loop", BENCH_ITERS, BENCH_ELEMS * 4, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_arr(&mbuf, BENCH_ELEMS);
+    for (i = 0; i < BENCH_ELEMS; ++i) {
+      msgpack_write_integer(&mbuf, (int64_t)bench_ints[i]);
+    }
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, write_s32_compact) {
+  msgpack_buffer_t mbuf;
+
+  bench_fill_arrays();
+  BENCH_LOOP("array_write_s32_compact", BENCH_ITERS, BENCH_ELEMS * 4, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    msgpack_write_s32_array_compact(&mbuf, bench_ints, BENCH_ELEMS);
+    bench_sink += mbuf.len;
+  });
+}
+
+BENCH(array, read_integer_loop) {
+  msgpack_buffer_t mbuf;
+  msgpack_unpacker_t up;
+  static int64_t out[BENCH_ELEMS];
+  uint32_t n;
+  uint32_t len;
+  uint32_t i;
+  uint8_t type;
+
+  bench_fill_arrays();
+  init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+  msgpack_write_s32_array_compact(&mbuf, bench_ints, BENCH_ELEMS);
+  BENCH_LOOP("array_read_integer_loop", BENCH_ITERS, BENCH_ELEMS * 8, {
+    init_msgpack_unpacker(&up, mbuf.buf, mbuf.len, 0);
+    type = MSGPACK_TYPE_ARRAY;
+    msgpack_unpack(&up, NULL, &n, &type);
+    for (i = 0; i < n; ++i) {
+      out[i] = 0;
+      len = sizeof(out[i]);
+      type = MSGPACK_TYPE_INTEGER;
+      msgpack_unpack(&up, &out[i], &len, &type);
+    }
+    bench_sink += (uint64_t)out[n - 1];
+  });
+}
+
+BENCH(array, read_int64_array) {
+  msgpack_buffer_t mbuf;
+  msgpack_unpacker_t up;
+  static int64_t out[BENCH_ELEMS];
+  uint32_t n;
+
+  bench_fill_arrays();
+  init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+  msgpack_write_s32_array_compact(&mbuf, bench_ints, BENCH_ELEMS);
+  BENCH_LOOP("array_read_int64_array", BENCH_ITERS, BENCH_ELEMS * 8, {
+    init_msgpack_unpacker(&up, mbuf.buf, mbuf.len, 0);
+    n = BENCH_ELEMS;
+    msgpack_unpack_int64_array(&up, out, &n);
+    bench_sink += (uint64_t)out[n - 1];
+  });
+}
+
+BENCH(array, read_double_array) {
+  msgpack_buffer_t mbuf;
+  msgpack_unpacker_t up;
+  static double out[BENCH_ELEMS];
+  uint32_t n;
+
+  bench_fill_arrays();
+  init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+  msgpack_write_double_array(&mbuf, bench_doubles, BENCH_ELEMS);
+  BENCH_LOOP("array_read_double_array", BENCH_ITERS, BENCH_ELEMS * 8, {
+    init_msgpack_unpacker(&up, mbuf.buf, mbuf.len, 0);
+    n = BENCH_ELEMS;
+    msgpack_unpack_double_array(&up, out, &n);
+    bench_sink += (uint64_t)out[n - 1];
+  });
+}
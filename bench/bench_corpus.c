@@ -0,0 +1,275 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_MAPS 1024
+#define BENCH_ARRAYS 64
+#define BENCH_ARRAY_LEN 256
+#define BENCH_BLOBS 16
+#define BENCH_BLOB_SIZE (64 * 1024)
+#define BENCH_DEEP_MSGS 64
+#define BENCH_DEPTH 24
+
+static uint8_t bench_corpus[BENCH_BLOBS * (BENCH_BLOB_SIZE + 8)];
+static size_t bench_corpus_len;
+static uint8_t bench_blob[BENCH_BLOB_SIZE];
+static uint8_t bench_scratch[BENCH_BLOB_SIZE];
+static uint64_t bench_arena_mem[512];
+
+/* Read every value of the corpus with msgpack_unpack(). */
+static void bench_unpack_all(void) {
+  msgpack_unpacker_t unpacker;
+  uint32_t len;
+  uint8_t type;
+
+  init_msgpack_unpacker(&unpacker, bench_corpus, bench_corpus_len, 0);
+  while (unpacker.pos < bench_corpus_len) {
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(bench_scratch);
+    if (!msgpack_unpack(&unpacker, bench_scratch, &len, &type)) {
+      break;
+    }
+    bench_sink += len;
+  }
+}
+
+static void bench_skip_all(void) {
+  msgpack_unpacker_t unpacker;
+
+  init_msgpack_unpacker(&unpacker, bench_corpus, bench_corpus_len, 0);
+  while (unpacker.pos < bench_corpus_len && msgpack_skip(&unpacker)) {
+  }
+  bench_sink += unpacker.pos;
+}
+
+static void bench_validate_all(void) {
+  msgpack_unpacker_t unpacker;
+  msgpack_limits_t limits;
+
+  init_msgpack_limits(&limits);
+  init_msgpack_unpacker(&unpacker, bench_corpus, bench_corpus_len, 0);
+  while (unpacker.pos < bench_corpus_len &&
+      msgpack_validate(&unpacker, &limits)) {
+  }
+  bench_sink += unpacker.pos;
+}
+
+/* Parse every message into a tree, the arena is reused for each one. */
+static void bench_parse_all(msgpack_arena_t *arena) {
+  msgpack_unpacker_t unpacker;
+  msgpack_node_t *root;
+
+  init_msgpack_unpacker(&unpacker, bench_corpus, bench_corpus_len, 0);
+  while (unpacker.pos < bench_corpus_len) {
+    if (!msgpack_parse(&unpacker, arena, &root)) {
+      break;
+    }
+    bench_sink += root->len;
+    msgpack_arena_release(arena);
+  }
+}
+
+static void bench_write_map(msgpack_buffer_t *mbuf, int i) {
+  msgpack_write_map(mbuf, 6);
+  msgpack_write_str(mbuf, "id", 2);
+  msgpack_write_integer(mbuf, (int64_t)i * 7919);
+  msgpack_write_str(mbuf, "name", 4);
+  msgpack_write_str(mbuf, "sensor-0042", 11);
+  msgpack_write_str(mbuf, "ok", 2);
+  msgpack_write_bool(mbuf, (i & 1) != 0);
+  msgpack_write_str(mbuf, "value", 5);
+  msgpack_write_double(mbuf, i * 0.25);
+  msgpack_write_str(mbuf, "unit", 4);
+  msgpack_write_str(mbuf, "C", 1);
+  msgpack_write_str(mbuf, "seq", 3);
+  msgpack_write_integer(mbuf, (int64_t)(i & 0xff));
+}
+
+BENCH(corpus, small_maps) {
+  msgpack_buffer_t mbuf;
+  msgpack_arena_t arena;
+  int i;
+
+  init_msgpack_buffer(&mbuf, bench_corpus, sizeof(bench_corpus));
+  for (i = 0; i < BENCH_MAPS; ++i) {
+    bench_write_map(&mbuf, i);
+  }
+  bench_corpus_len = mbuf.len;
+
+  BENCH_LOOP("small maps write x1024", 200, bench_corpus_len,
+    mbuf.len = 0;
+    for (i = 0; i < BENCH_MAPS; ++i) {
+      bench_write_map(&mbuf, i);
+    }
+    bench_sink += mbuf.len);
+  BENCH_LOOP("small maps write growable x1024", 200, bench_corpus_len,
+    init_msgpack_growable_buffer(&mbuf, &bench_allocator);
+    for (i = 0; i < BENCH_MAPS; ++i) {
+      bench_write_map(&mbuf, i);
+    }
+    bench_sink += mbuf.len;
+    msgpack_buffer_release(&mbuf));
+  BENCH_LOOP("small maps unpack x1024", 200, bench_corpus_len,
+    bench_unpack_all());
+  BENCH_LOOP("small maps skip x1024", 200, bench_corpus_len,
+    bench_skip_all());
+  BENCH_LOOP("small maps validate x1024", 200, bench_corpus_len,
+    bench_validate_all());
+  init_msgpack_growable_arena(&arena, (uint8_t *)bench_arena_mem,
+          sizeof(bench_arena_mem), &bench_allocator);
+  BENCH_LOOP("small maps parse x1024", 200, bench_corpus_len,
+    bench_parse_all(&arena));
+}
+
+BENCH(corpus, int_arrays) {
+  msgpack_buffer_t mbuf;
+  msgpack_arena_t arena;
+  int i;
+  int j;
+
+#define BENCH_ARRAY_INT(i, j) \
+  ((int64_t)(((uint64_t)((i) * BENCH_ARRAY_LEN + (j)) * 0x9E3779B97F4A7C15ull) \
+    >> (((j) % 4) * 16 + 1)) * (((j) & 4) ? -1 : 1))
+
+  init_msgpack_buffer(&mbuf, bench_corpus, sizeof(bench_corpus));
+  BENCH_LOOP("int arrays write_integer 64x256", 100, mbuf.len,
+    mbuf.len = 0;
+    for (i = 0; i < BENCH_ARRAYS; ++i) {
+      msgpack_write_arr(&mbuf, BENCH_ARRAY_LEN);
+      for (j = 0; j < BENCH_ARRAY_LEN; ++j) {
+        msgpack_write_integer(&mbuf, BENCH_ARRAY_INT(i, j));
+      }
+    }
+    bench_sink += mbuf.len);
+  BENCH_LOOP("int arrays put_integer 64x256", 100, mbuf.len,
+    mbuf.len = 0;
+    for (i = 0; i < BENCH_ARRAYS; ++i) {
+      msgpack_reserve(&mbuf, 5 + BENCH_ARRAY_LEN * 9);
+      msgpack_put_arr(&mbuf, BENCH_ARRAY_LEN);
+      for (j = 0; j < BENCH_ARRAY_LEN; ++j) {
+        msgpack_put_integer(&mbuf, BENCH_ARRAY_INT(i, j));
+      }
+    }
+    bench_sink += mbuf.len);
+  bench_corpus_len = mbuf.len;
+
+  BENCH_LOOP("int arrays unpack 64x256", 100, bench_corpus_len,
+    bench_unpack_all());
+  BENCH_LOOP("int arrays skip 64x256", 100, bench_corpus_len,
+    bench_skip_all());
+  BENCH_LOOP("int arrays validate 64x256", 100, bench_corpus_len,
+    bench_validate_all());
+  init_msgpack_growable_arena(&arena, (uint8_t *)bench_arena_mem,
+          sizeof(bench_arena_mem), &bench_allocator);
+  BENCH_LOOP("int arrays parse 64x256", 100, bench_corpus_len,
+    bench_parse_all(&arena));
+}
+
+BENCH(corpus, blobs) {
+  msgpack_buffer_t mbuf;
+  msgpack_iovec_list_t list;
+  msgpack_iovec_t iov[2 * BENCH_BLOBS + 2];
+  msgpack_unpacker_t unpacker;
+  const uint8_t *view;
+  uint32_t view_len;
+  uint8_t type;
+  int i;
+
+  for (i = 0; i < BENCH_BLOB_SIZE; ++i) {
+    bench_blob[i] = (uint8_t)(i * 31);
+  }
+
+  init_msgpack_buffer(&mbuf, bench_corpus, sizeof(bench_corpus));
+  BENCH_LOOP("blobs write_bin 16x64K", 50, mbuf.len,
+    mbuf.len = 0;
+    for (i = 0; i < BENCH_BLOBS; ++i) {
+      msgpack_write_bin(&mbuf, bench_blob, BENCH_BLOB_SIZE);
+    }
+    bench_sink += mbuf.len);
+  bench_corpus_len = mbuf.len;
+
+  BENCH_LOOP("blobs write_bin growable 16x64K", 50, bench_corpus_len,
+    init_msgpack_growable_buffer(&mbuf, &bench_allocator);
+    for (i = 0; i < BENCH_BLOBS; ++i) {
+      msgpack_write_bin(&mbuf, bench_blob, BENCH_BLOB_SIZE);
+    }
+    bench_sink += mbuf.len;
+    msgpack_buffer_release(&mbuf));
+  BENCH_LOOP("blobs write_bin iovec 16x64K", 50, bench_corpus_len,
+    init_msgpack_buffer(&mbuf, bench_scratch, sizeof(bench_scratch));
+    init_msgpack_iovec_list(&list, iov, sizeof(iov) / sizeof(iov[0]), 256);
+    mbuf.iov = &list;
+    for (i = 0; i < BENCH_BLOBS; ++i) {
+      msgpack_write_bin(&mbuf, bench_blob, BENCH_BLOB_SIZE);
+    }
+    msgpack_iovec_finish(&mbuf);
+    bench_sink += list.cnt);
+
+  BENCH_LOOP("blobs unpack 16x64K", 50, bench_corpus_len,
+    bench_unpack_all());
+  BENCH_LOOP("blobs unpack_view 16x64K", 50, bench_corpus_len,
+    init_msgpack_unpacker(&unpacker, bench_corpus, bench_corpus_len, 0);
+    for (i = 0; i < BENCH_BLOBS; ++i) {
+      type = MSGPACK_TYPE_ANY;
+      msgpack_unpack_view(&unpacker, &view, &view_len, &type);
+      bench_sink += view[view_len - 1];
+    });
+}
+
+/* [i, "x", [i, "x", [... [i, "x"]]]] BENCH_DEPTH arrays deep. */
+static void bench_write_deep(msgpack_buffer_t *mbuf, int i) {
+  int d;
+
+  for (d = 0; d < BENCH_DEPTH; ++d) {
+    msgpack_write_arr(mbuf, d == BENCH_DEPTH - 1 ? 2 : 3);
+    msgpack_write_integer(mbuf, (int64_t)(i + d));
+    msgpack_write_str(mbuf, "x", 1);
+  }
+}
+
+BENCH(corpus, deep) {
+  msgpack_buffer_t mbuf;
+  msgpack_arena_t arena;
+  int i;
+
+  init_msgpack_buffer(&mbuf, bench_corpus, sizeof(bench_corpus));
+  BENCH_LOOP("deep write 64 msgs x24 levels", 500, mbuf.len,
+    mbuf.len = 0;
+    for (i = 0; i < BENCH_DEEP_MSGS; ++i) {
+      bench_write_deep(&mbuf, i);
+    }
+    bench_sink += mbuf.len);
+  bench_corpus_len = mbuf.len;
+
+  BENCH_LOOP("deep unpack 64 msgs x24 levels", 500, bench_corpus_len,
+    bench_unpack_all());
+  BENCH_LOOP("deep skip 64 msgs x24 levels", 500, bench_corpus_len,
+    bench_skip_all());
+  init_msgpack_growable_arena(&arena, (uint8_t *)bench_arena_mem,
+          sizeof(bench_arena_mem), &bench_allocator);
+  BENCH_LOOP("deep parse 64 msgs x24 levels", 500, bench_corpus_len,
+    bench_parse_all(&arena));
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_VALUES 4096
+#define BENCH_ITERS 2000
+
+static uint8_t bench_msg[BENCH_VALUES * 16];
+static size_t bench_msg_len;
+
+static uint32_t bench_rand(uint32_t *x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+/* A stream of scalars of every kind in random order, so no tag repeats. */
+static void bench_fill_mixed(void) {
+  msgpack_buffer_t mbuf;
+  uint32_t x = 2463534242u;
+  uint32_t r;
+  int i;
+
+  init_msgpack_buffer(&mbuf, bench_msg, sizeof(bench_msg));
+  for (i = 0; i < BENCH_VALUES; ++i) {
+    r = bench_rand(&x);
+    switch (r % 10) {
+      case 0: msgpack_write_nil(&mbuf); break;
+      case 1: msgpack_write_bool(&mbuf, (r & 0x100) != 0); break;
+      case 2: msgpack_write_integer(&mbuf, (int64_t)(r >> 25)); break;
+      case 3: msgpack_write_integer(&mbuf, -(int64_t)(r >> 27)); break;
+      case 4: msgpack_write_integer(&mbuf, (int64_t)(r >> 8)); break;
+      case 5: msgpack_write_integer(&mbuf, -(int64_t)(r >> 12)); break;
+      case 6: msgpack_write_float(&mbuf, (float)r); break;
+      case 7: msgpack_write_double(&mbuf, (double)r); break;
+      case 8: msgpack_write_str(&mbuf, "mixed", r % 6); break;
+      default: msgpack_write_bin(&mbuf, "mixed", r % 6); break;
+    }
+  }
+  bench_msg_len = mbuf.len;
+}
+
+BENCH(dispatch, unpack_mixed) {
+  msgpack_unpacker_t unpacker;
+  uint8_t data[8];
+  uint32_t len;
+  uint8_t type;
+  int i;
+
+  bench_fill_mixed();
+  BENCH_LOOP("unpack mixed x4096", BENCH_ITERS, bench_msg_len,
+    init_msgpack_unpacker(&unpacker, bench_msg, bench_msg_len, 0);
+    for (i = 0; i < BENCH_VALUES; ++i) {
+      type = MSGPACK_TYPE_ANY;
+      len = sizeof(data);
+      msgpack_unpack(&unpacker, data, &len, &type);
+      bench_sink += type;
+    });
+}
+
+BENCH(dispatch, skip_mixed) {
+  msgpack_unpacker_t unpacker;
+  int i;
+
+  bench_fill_mixed();
+  BENCH_LOOP("skip mixed x4096", BENCH_ITERS, bench_msg_len,
+    init_msgpack_unpacker(&unpacker, bench_msg, bench_msg_len, 0);
+    for (i = 0; i < BENCH_VALUES; ++i) {
+      msgpack_skip(&unpacker);
+    }
+    bench_sink += unpacker.pos);
+}
@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_WORDS 1024
+#define BENCH_ITERS 20000
+
+static uint64_t bench_words[BENCH_WORDS];
+static uint8_t bench_out[BENCH_WORDS * 9 + 16];
+
+/* The byte loop msgpack used before the word kernels, kept as a baseline. */
+static const int32_t legacy_i = 1;
+#define legacy_is_bigendian() ((*(const char *)&legacy_i) == 0)
+
+static void legacy_endiancpy(void *buffer, const void *data, size_t len) {
+  int i;
+  if (legacy_is_bigendian()) {
+    memcpy(buffer, data, len);
+    return;
+  }
+  for (i = len - 1; i >= 0; --i) {
+    ((uint8_t *)buffer)[len - i - 1] = ((const uint8_t *)data)[i];
+  }
+}
+
+static void bench_fill_words(void) {
+  uint64_t x = 0x9E3779B97F4A7C15ull;
+  int i;
+  for (i = 0; i < BENCH_WORDS; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    bench_words[i] = x;
+  }
+}
+
+BENCH(endian, store) {
+  int i;
+  bench_fill_words();
+  BENCH_LOOP("store u64 x1024 (byte loop)", BENCH_ITERS, BENCH_WORDS * 8,
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      legacy_endiancpy(bench_out + i * 8, &bench_words[i], 8);
+    }
+    bench_sink += bench_out[_n & 1023]);
+  BENCH_LOOP("store u64 x1024 (msgpack_store_be64)", BENCH_ITERS, BENCH_WORDS * 8,
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      msgpack_store_be64(bench_out + i * 8, bench_words[i]);
+    }
+    bench_sink += bench_out[_n & 1023]);
+  BENCH_LOOP("store u32 x1024 (byte loop)", BENCH_ITERS, BENCH_WORDS * 4,
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      uint32_t v = (uint32_t)bench_words[i];
+      legacy_endiancpy(bench_out + i * 4, &v, 4);
+    }
+    bench_sink += bench_out[_n & 1023]);
+  BENCH_LOOP("store u32 x1024 (msgpack_store_be32)", BENCH_ITERS, BENCH_WORDS * 4,
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      msgpack_store_be32(bench_out + i * 4, (uint32_t)bench_words[i]);
+    }
+    bench_sink += bench_out[_n & 1023]);
+}
+
+BENCH(endian, load) {
+  uint64_t sum;
+  uint64_t v;
+  int i;
+  bench_fill_words();
+  memcpy(bench_out, bench_words, sizeof(bench_words));
+  BENCH_LOOP("load u64 x1024 (byte loop)", BENCH_ITERS, BENCH_WORDS * 8,
+    sum = 0;
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      legacy_endiancpy(&v, bench_out + i * 8, 8);
+      sum += v;
+    }
+    bench_sink += sum);
+  BENCH_LOOP("load u64 x1024 (msgpack_load_be64)", BENCH_ITERS, BENCH_WORDS * 8,
+    sum = 0;
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      sum += msgpack_load_be64(bench_out + i * 8);
+    }
+    bench_sink += sum);
+}
+
+/* An integer heavy message: an array of values of every integer width. */
+BENCH(endian, integers) {
+  msgpack_buffer_t mbuf;
+  msgpack_unpacker_t unpacker;
+  uint8_t type;
+  uint32_t len;
+  int64_t val;
+  int i;
+
+  bench_fill_words();
+  for (i = 0; i < BENCH_WORDS; ++i) {
+    bench_words[i] >>= (i % 4) * 16;
+  }
+
+  init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+  BENCH_LOOP("write_integer x1024", BENCH_ITERS / 4, mbuf.len,
+    mbuf.len = 0;
+    msgpack_write_arr(&mbuf, BENCH_WORDS);
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      msgpack_write_integer(&mbuf, (int64_t)bench_words[i]);
+    }
+    bench_sink += mbuf.len);
+
+  BENCH_LOOP("put_integer x1024 (one reserve)", BENCH_ITERS / 4, mbuf.len,
+    mbuf.len = 0;
+    msgpack_reserve(&mbuf, 5 + BENCH_WORDS * 9);
+    msgpack_put_arr(&mbuf, BENCH_WORDS);
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      msgpack_put_integer(&mbuf, (int64_t)bench_words[i]);
+    }
+    bench_sink += mbuf.len);
+
+  BENCH_LOOP("unpack integer x1024", BENCH_ITERS / 4, mbuf.len,
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    type = MSGPACK_TYPE_ANY;
+    msgpack_unpack(&unpacker, NULL, &len, &type);
+    for (i = 0; i < BENCH_WORDS; ++i) {
+      type = MSGPACK_TYPE_INTEGER;
+      len = sizeof(val);
+      val = 0;
+      msgpack_unpack(&unpacker, &val, &len, &type);
+      bench_sink += (uint64_t)val;
+    });
+}
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+volatile uint64_t bench_sink;
+const char *bench_filter;
+uint64_t bench_alloc_count;
+
+static void *bench_realloc(void *ud, void *ptr, size_t size) {
+  (void)ud;
+  bench_alloc_count++;
+  return realloc(ptr, size);
+}
+
+static void bench_free(void *ud, void *ptr) {
+  (void)ud;
+  free(ptr);
+}
+
+const msgpack_allocator_t bench_allocator = {bench_realloc, bench_free, NULL};
+
+DECLARE_BENCH(endian, store);
+DECLARE_BENCH(endian, load);
+DECLARE_BENCH(endian, integers);
+DECLARE_BENCH(dispatch, unpack_mixed);
+DECLARE_BENCH(dispatch, skip_mixed);
+DECLARE_BENCH(scan, records);
+DECLARE_BENCH(scan, int_arrays);
+DECLARE_BENCH(write, scalars);
+DECLARE_BENCH(write, raw);
+DECLARE_BENCH(write, containers);
+DECLARE_BENCH(read, scalars);
+DECLARE_BENCH(read, raw);
+DECLARE_BENCH(read, containers);
+DECLARE_BENCH(corpus, small_maps);
+DECLARE_BENCH(corpus, int_arrays);
+DECLARE_BENCH(corpus, blobs);
+DECLARE_BENCH(corpus, deep);
+DECLARE_BENCH(schema, write_struct);
+DECLARE_BENCH(schema, unpack_strcmp);
+DECLARE_BENCH(schema, unpack_ordered);
+DECLARE_BENCH(schema, unpack_shuffled);
+DECLARE_BENCH(schema, unpack_keys);
+DECLARE_BENCH(array, write_double_loop);
+DECLARE_BENCH(array, write_double_array);
+DECLARE_BENCH(array, write_s32_loop);
+DECLARE_BENCH(array, write_s32_array);
+DECLARE_BENCH(array, write_integer_loop);
+DECLARE_BENCH(array, write_s32_compact);
+DECLARE_BENCH(array, read_integer_loop);
+DECLARE_BENCH(array, read_int64_array);
+DECLARE_BENCH(array, read_double_array);
+#if MSGPACK_BUFFER_POOL
+DECLARE_BENCH(pool, growable);
+DECLARE_BENCH(pool, pooled);
+DECLARE_BENCH(pool, counted);
+#endif
+
+/* usage: msgpack_bench [filter], e.g. msgpack_bench corpus */
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    bench_filter = argv[1];
+  }
+
+  RUN_BENCH(endian, store);
+  RUN_BENCH(endian, load);
+  RUN_BENCH(endian, integers);
+  RUN_BENCH(dispatch, unpack_mixed);
+  RUN_BENCH(dispatch, skip_mixed);
+  RUN_BENCH(scan, records);
+  RUN_BENCH(scan, int_arrays);
+  RUN_BENCH(write, scalars);
+  RUN_BENCH(write, raw);
+  RUN_BENCH(write, containers);
+  RUN_BENCH(read, scalars);
+  RUN_BENCH(read, raw);
+  RUN_BENCH(read, containers);
+  RUN_BENCH(corpus, small_maps);
+  RUN_BENCH(corpus, int_arrays);
+  RUN_BENCH(corpus, blobs);
+  RUN_BENCH(corpus, deep);
+  RUN_BENCH(schema, write_struct);
+  RUN_BENCH(schema, unpack_strcmp);
+  RUN_BENCH(schema, unpack_ordered);
+  RUN_BENCH(schema, unpack_shuffled);
+  RUN_BENCH(schema, unpack_keys);
+  RUN_BENCH(array, write_double_loop);
+  RUN_BENCH(array, write_double_array);
+  RUN_BENCH(array, write_s32_loop);
+  RUN_BENCH(array, write_s32_array);
+  RUN_BENCH(array, write_integer_loop);
+  RUN_BENCH(array, write_s32_compact);
+  RUN_BENCH(array, read_integer_loop);
+  RUN_BENCH(array, read_int64_array);
+  RUN_BENCH(array, read_double_array);
+#if MSGPACK_BUFFER_POOL
+  RUN_BENCH(pool, growable);
+  RUN_BENCH(pool, pooled);
+  RUN_BENCH(pool, counted);
+#endif
+  return 0;
+}
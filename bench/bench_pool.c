@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_ITERS 200000
+
+static char bench_text[200];
+static size_t bench_message_size;
+
+/* An outgoing message: a small map that grows its buffer a few times. */
+static void bench_write_message(msgpack_buffer_t *mbuf, int seq) {
+  int i;
+
+  msgpack_write_map(mbuf, 3);
+  msgpack_write_str(mbuf, "seq", 3);
+  msgpack_write_integer(mbuf, (int64_t)seq);
+  msgpack_write_str(mbuf, "text", 4);
+  msgpack_write_str(mbuf, bench_text, sizeof(bench_text));
+  msgpack_write_str(mbuf, "values", 6);
+  msgpack_write_arr(mbuf, 32);
+  for (i = 0; i < 32; ++i) {
+    msgpack_write_u32(mbuf, (uint32_t)(seq + i * 70000));
+  }
+}
+
+BENCH(pool, growable) {
+  msgpack_buffer_t mbuf;
+  int seq = 0;
+
+  memset(bench_text, 'x', sizeof(bench_text));
+  init_msgpack_counter(&mbuf);
+  bench_write_message(&mbuf, 0);
+  bench_message_size = mbuf.len;
+  BENCH_LOOP("pool_growable", BENCH_ITERS, bench_message_size, {
+    init_msgpack_growable_buffer(&mbuf, &bench_allocator);
+    bench_write_message(&mbuf, seq++);
+    bench_sink += mbuf.len;
+    msgpack_buffer_release(&mbuf);
+  });
+}
+
+BENCH(pool, pooled) {
+  msgpack_pool_t pool;
+  msgpack_buffer_t mbuf;
+  int seq = 0;
+
+  memset(bench_text, 'x', sizeof(bench_text));
+  msgpack_pool_init(&pool, &bench_allocator);
+  BENCH_LOOP("pool_pooled", BENCH_ITERS, bench_message_size, {
+    init_msgpack_pool_buffer(&mbuf, &pool);
+    bench_write_message(&mbuf, seq++);
+    bench_sink += mbuf.len;
+    msgpack_buffer_release(&mbuf);
+  });
+  msgpack_pool_destroy(&pool);
+}
+
+BENCH(pool, counted) {
+  msgpack_pool_t pool;
+  msgpack_buffer_t counter;
+  msgpack_buffer_t mbuf;
+  int seq = 0;
+
+  memset(bench_text, 'x', sizeof(bench_text));
+  msgpack_pool_init(&pool, &bench_allocator);
+  BENCH_LOOP("pool_counted", BENCH_ITERS, bench_message_size, {
+    init_msgpack_counter(&counter);
+    bench_write_message(&counter, seq);
+    init_msgpack_pool_buffer(&mbuf, &pool);
+    msgpack_reserve(&mbuf, counter.len);
+    bench_write_message(&mbuf, seq++);
+    bench_sink += mbuf.len;
+    msgpack_buffer_release(&mbuf);
+  });
+  msgpack_pool_destroy(&pool);
+}
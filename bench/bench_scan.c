@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_MSGS 1024
+#define BENCH_ITERS 200
+
+static uint8_t bench_msg[BENCH_MSGS * 96];
+static size_t bench_msg_len;
+static size_t bench_offs[BENCH_MSGS];
+
+/* {"id": i, "vals": [16 small ints], "on": [8 bools], "name": "...", "t": f} */
+static void bench_fill_records(void) {
+  msgpack_buffer_t mbuf;
+  int i;
+  int j;
+
+  init_msgpack_buffer(&mbuf, bench_msg, sizeof(bench_msg));
+  for (i = 0; i < BENCH_MSGS; ++i) {
+    msgpack_write_map(&mbuf, 5);
+    msgpack_write_str(&mbuf, "id", 2);
+    msgpack_write_integer(&mbuf, (int64_t)i);
+    msgpack_write_str(&mbuf, "vals", 4);
+    msgpack_write_arr(&mbuf, 16);
+    for (j = 0; j < 16; ++j) {
+      msgpack_write_integer(&mbuf, (int64_t)((i + j) % 100));
+    }
+    msgpack_write_str(&mbuf, "on", 2);
+    msgpack_write_arr(&mbuf, 8);
+    for (j = 0; j < 8; ++j) {
+      msgpack_write_bool(&mbuf, ((i >> j) & 1) != 0);
+    }
+    msgpack_write_str(&mbuf, "name", 4);
+    msgpack_write_str(&mbuf, "record", 6);
+    msgpack_write_str(&mbuf, "t", 1);
+    msgpack_write_double(&mbuf, i * 0.5);
+  }
+  bench_msg_len = mbuf.len;
+}
+
+/* Arrays of 64 small ints, the best case of the vector run check. */
+static void bench_fill_ints(void) {
+  msgpack_buffer_t mbuf;
+  int i;
+  int j;
+
+  init_msgpack_buffer(&mbuf, bench_msg, sizeof(bench_msg));
+  for (i = 0; i < BENCH_MSGS; ++i) {
+    msgpack_write_arr16(&mbuf, 64);
+    for (j = 0; j < 64; ++j) {
+      msgpack_write_integer(&mbuf, (int64_t)((i * j) % 160 - 32));
+    }
+  }
+  bench_msg_len = mbuf.len;
+}
+
+/* Split with msgpack_unpack(), counting the values left in each message. */
+static size_t bench_split_unpack(void) {
+  msgpack_unpacker_t unpacker;
+  uint8_t data[16];
+  uint64_t left = 0;
+  size_t cnt = 0;
+  uint32_t len;
+  uint8_t type;
+
+  init_msgpack_unpacker(&unpacker, bench_msg, bench_msg_len, 0);
+  while (unpacker.pos < bench_msg_len) {
+    if (left == 0) {
+      bench_offs[cnt++] = unpacker.pos;
+      left = 1;
+    }
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(data);
+    if (!msgpack_unpack(&unpacker, data, &len, &type)) {
+      break;
+    }
+    left--;
+    if (type == MSGPACK_TYPE_ARRAY) {
+      left += len;
+    } else if (type == MSGPACK_TYPE_MAP) {
+      left += 2 * (uint64_t)len;
+    }
+  }
+  return cnt;
+}
+
+static size_t bench_split_skip(void) {
+  msgpack_unpacker_t unpacker;
+  size_t cnt = 0;
+
+  init_msgpack_unpacker(&unpacker, bench_msg, bench_msg_len, 0);
+  while (unpacker.pos < bench_msg_len) {
+    bench_offs[cnt++] = unpacker.pos;
+    if (!msgpack_skip(&unpacker)) {
+      break;
+    }
+  }
+  return cnt;
+}
+
+static size_t bench_split_scan(void) {
+  msgpack_scan_t sc;
+
+  init_msgpack_scan(&sc, bench_offs, BENCH_MSGS, NULL, 0);
+  msgpack_scan(&sc, bench_msg, bench_msg_len);
+  return sc.value_cnt;
+}
+
+BENCH(scan, records) {
+  bench_fill_records();
+  BENCH_LOOP("split records unpack x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_unpack());
+  BENCH_LOOP("split records skip x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_skip());
+  BENCH_LOOP("split records scan x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_scan());
+}
+
+BENCH(scan, int_arrays) {
+  bench_fill_ints();
+  BENCH_LOOP("split int arrays unpack x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_unpack());
+  BENCH_LOOP("split int arrays skip x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_skip());
+  BENCH_LOOP("split int arrays scan x1024", BENCH_ITERS, bench_msg_len,
+    bench_sink += bench_split_scan());
+}
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_MSGS 1024
+#define BENCH_ITERS 200
+
+struct bench_rec {
+  char host[16];
+  char service[16];
+  uint32_t id;
+  int32_t delta;
+  uint16_t port;
+  uint8_t level;
+  bool ok;
+  bool cached;
+  double latency;
+  double ratio;
+  float load;
+  int64_t ts;
+};
+
+#define BENCH_REC_FIELDS(X, S) \
+  X(S, STR, host) \
+  X(S, STR, service) \
+  X(S, UINT, id) \
+  X(S, INT, delta) \
+  X(S, UINT, port) \
+  X(S, UINT, level) \
+  X(S, BOOL, ok) \
+  X(S, BOOL, cached) \
+  X(S, DOUBLE, latency) \
+  X(S, DOUBLE, ratio) \
+  X(S, FLOAT, load) \
+  X(S, INT, ts)
+
+MSGPACK_SCHEMA(bench_rec_schema, struct bench_rec, BENCH_REC_FIELDS);
+
+static uint8_t bench_msg[BENCH_MSGS * 160];
+static uint8_t bench_rev[BENCH_MSGS * 160];
+static size_t bench_msg_len;
+static size_t bench_rev_len;
+static uint8_t bench_out[BENCH_MSGS * 160];
+
+static void bench_fill_rec(struct bench_rec *rec, int i) {
+  memset(rec, 0, sizeof(*rec));
+  strcpy(rec->host, "db-7.example");
+  strcpy(rec->service, "checkout");
+  rec->id = (uint32_t)i * 7919u;
+  rec->delta = i % 2 ? -i : i;
+  rec->port = (uint16_t)(8000 + i % 100);
+  rec->level = (uint8_t)(i % 5);
+  rec->ok = i % 3 != 0;
+  rec->cached = i % 2 == 0;
+  rec->latency = i * 0.25;
+  rec->ratio = 1.0 / (i + 1);
+  rec->load = (float)(i % 10) / 4.0f;
+  rec->ts = 1700000000000LL + i;
+}
+
+/* The records in schema order, and with their fields in reverse order. */
+static void bench_fill_schema(void) {
+  msgpack_buffer_t mbuf;
+  msgpack_unpacker_t up;
+  struct bench_rec rec;
+  const uint8_t *pairs[16];
+  size_t sizes[16];
+  size_t start;
+  uint32_t n;
+  uint32_t j;
+  int i;
+
+  init_msgpack_buffer(&mbuf, bench_msg, sizeof(bench_msg));
+  for (i = 0; i < BENCH_MSGS; ++i) {
+    bench_fill_rec(&rec, i);
+    msgpack_write_struct(&mbuf, &bench_rec_schema, &rec);
+  }
+  bench_msg_len = mbuf.len;
+
+  init_msgpack_unpacker(&up, bench_msg, bench_msg_len, 0);
+  init_msgpack_buffer(&mbuf, bench_rev, sizeof(bench_rev));
+  for (i = 0; i < BENCH_MSGS; ++i) {
+    n = bench_rec_schema.count;
+    up.pos += 1;
+    for (j = 0; j < n; ++j) {
+      start = up.pos;
+      msgpack_skip(&up);
+      msgpack_skip(&up);
+      pairs[j] = bench_msg + start;
+      sizes[j] = up.pos - start;
+    }
+    msgpack_write_map(&mbuf, n);
+    while (n-- > 0) {
+      msgpack_reserve(&mbuf, sizes[n]);
+      memcpy(mbuf.buf + mbuf.len, pairs[n], sizes[n]);
+      mbuf.len += sizes[n];
+    }
+  }
+  bench_rev_len = mbuf.len;
+}
+
+BENCH(schema, write_struct) {
+  msgpack_buffer_t mbuf;
+  static struct bench_rec recs[BENCH_MSGS];
+  int i;
+
+  bench_fill_schema();
+  for (i = 0; i < BENCH_MSGS; ++i) {
+    bench_fill_rec(&recs[i], i);
+  }
+  BENCH_LOOP("schema_write_struct", BENCH_ITERS, bench_msg_len, {
+    init_msgpack_buffer(&mbuf, bench_out, sizeof(bench_out));
+    for (i = 0; i < BENCH_MSGS; ++i) {
+      msgpack_write_struct(&mbuf, &bench_rec_schema, &recs[i]);
+    }
+    bench_sink += mbuf.len;
+  });
+}
+
+/* Field dispatch by copying each key out and comparing it with strcmp. */
+static void bench_unpack_strcmp(msgpack_unpacker_t *up, struct bench_rec *rec) {
+  char key[32];
+  uint32_t len;
+  uint32_t n;
+  uint32_t j;
+  uint32_t f;
+  uint8_t type = MSGPACK_TYPE_MAP;
+
+  msgpack_unpack(up, NULL, &n, &type);
+  for (j = 0; j < n; ++j) {
+    type = MSGPACK_TYPE_STR;
+    len = sizeof(key) - 1;
+    msgpack_unpack(up, key, &len, &type);
+    key[len] = 0;
+    for (f = 0; f < bench_rec_schema.count; ++f) {
+      if (strcmp(key, (const char *)bench_rec_schema.fields[f].key + 1) == 0) {
+        break;
+      }
+    }
+    rec->level = (uint8_t)f;
+    msgpack_skip(up);
+  }
+}
+
+BENCH(schema, unpack_strcmp) {
+  msgpack_unpacker_t up;
+  struct bench_rec rec = {0};
+
+  bench_fill_schema();
+  BENCH_LOOP("schema_unpack_strcmp", BENCH_ITERS, bench_rev_len, {
+    init_msgpack_unpacker(&up, bench_rev, bench_rev_len, 0);
+    while (up.pos < up.len) {
+      bench_unpack_strcmp(&up, &rec);
+    }
+    bench_sink += rec.level;
+  });
+}
+
+BENCH(schema, unpack_ordered) {
+  msgpack_unpacker_t up;
+  struct bench_rec rec;
+
+  bench_fill_schema();
+  BENCH_LOOP("schema_unpack_ordered", BENCH_ITERS, bench_msg_len, {
+    init_msgpack_unpacker(&up, bench_msg, bench_msg_len, 0);
+    while (msgpack_unpack_struct(&up, &bench_rec_schema, &rec)) {
+    }
+    bench_sink += rec.id;
+  });
+}
+
+BENCH(schema, unpack_shuffled) {
+  msgpack_unpacker_t up;
+  struct bench_rec rec;
+
+  bench_fill_schema();
+  BENCH_LOOP("schema_unpack_shuffled", BENCH_ITERS, bench_rev_len, {
+    init_msgpack_unpacker(&up, bench_rev, bench_rev_len, 0);
+    while (msgpack_unpack_struct(&up, &bench_rec_schema, &rec)) {
+    }
+    bench_sink += rec.id;
+  });
+}
+
+BENCH(schema, unpack_keys) {
+  msgpack_unpacker_t up;
+  msgpack_arena_t arena;
+  msgpack_keyset_t ks;
+  struct bench_rec rec;
+  static uint8_t arena_buf[1024];
+
+  bench_fill_schema();
+  init_msgpack_arena(&arena, arena_buf, sizeof(arena_buf));
+  msgpack_keyset_build_schema(&ks, &arena, &bench_rec_schema);
+  BENCH_LOOP("schema_unpack_keys", BENCH_ITERS, bench_rev_len, {
+    init_msgpack_unpacker(&up, bench_rev, bench_rev_len, 0);
+    while (msgpack_unpack_struct_keys(&up, &bench_rec_schema, &ks, &rec)) {
+    }
+    bench_sink += rec.id;
+  });
+}
@@ -0,0 +1,188 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "msgpack.h"
+#include "bench.h"
+
+#define BENCH_OPS 1024
+#define BENCH_ITERS 1000
+
+static uint8_t bench_buf[BENCH_OPS * 32];
+static uint8_t bench_data[64];
+static const char bench_text[] = "0123456789abcdef0123456789abcdef";
+
+/**
+ * Time BENCH_OPS calls of expr writing into mbuf, a fixed buffer that is
+ * emptied before every run. expr may use the loop counter i.
+ */
+#define BENCH_WRITE(name, expr) \
+  do { \
+    msgpack_buffer_t mbuf; \
+    int i; \
+    init_msgpack_buffer(&mbuf, bench_buf, sizeof(bench_buf)); \
+    BENCH_LOOP(name " x1024", BENCH_ITERS, mbuf.len, \
+      mbuf.len = 0; \
+      for (i = 0; i < BENCH_OPS; ++i) { \
+        expr; \
+      } \
+      bench_sink += mbuf.len); \
+  } while (0)
+
+/* Write BENCH_OPS values with expr, then time msgpack_unpack() of them. */
+#define BENCH_READ(name, expr) \
+  do { \
+    msgpack_buffer_t mbuf; \
+    msgpack_unpacker_t unpacker; \
+    uint8_t type; \
+    uint32_t len; \
+    int i; \
+    init_msgpack_buffer(&mbuf, bench_buf, sizeof(bench_buf)); \
+    for (i = 0; i < BENCH_OPS; ++i) { \
+      expr; \
+    } \
+    BENCH_LOOP(name " x1024", BENCH_ITERS, mbuf.len, \
+      init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0); \
+      for (i = 0; i < BENCH_OPS; ++i) { \
+        type = MSGPACK_TYPE_ANY; \
+        len = sizeof(bench_data); \
+        msgpack_unpack(&unpacker, bench_data, &len, &type); \
+      } \
+      bench_sink += unpacker.pos); \
+  } while (0)
+
+/* Spread the values over every width of the integer encodings. */
+#define BENCH_INT(i) ((int64_t)((uint64_t)(i) * 0x9E3779B97F4A7C15ull >> ((i) % 4 * 16)))
+
+BENCH(write, scalars) {
+  msgpack_timestamp_t ts = {1500000000, 123456789};
+
+  BENCH_WRITE("write_nil", msgpack_write_nil(&mbuf));
+  BENCH_WRITE("write_bool", msgpack_write_bool(&mbuf, (i & 1) != 0));
+  BENCH_WRITE("write_true", msgpack_write_true(&mbuf));
+  BENCH_WRITE("write_false", msgpack_write_false(&mbuf));
+  BENCH_WRITE("write_smallint", msgpack_write_smallint(&mbuf, i & 0x7f));
+  BENCH_WRITE("write_u8", msgpack_write_u8(&mbuf, i));
+  BENCH_WRITE("write_u16", msgpack_write_u16(&mbuf, i));
+  BENCH_WRITE("write_u32", msgpack_write_u32(&mbuf, i));
+  BENCH_WRITE("write_u64", msgpack_write_u64(&mbuf, i));
+  BENCH_WRITE("write_s8", msgpack_write_s8(&mbuf, -i));
+  BENCH_WRITE("write_s16", msgpack_write_s16(&mbuf, -i));
+  BENCH_WRITE("write_s32", msgpack_write_s32(&mbuf, -i));
+  BENCH_WRITE("write_s64", msgpack_write_s64(&mbuf, -i));
+  BENCH_WRITE("write_integer", msgpack_write_integer(&mbuf, BENCH_INT(i)));
+  BENCH_WRITE("write_float", msgpack_write_float(&mbuf, (float)i));
+  BENCH_WRITE("write_double", msgpack_write_double(&mbuf, (double)i));
+  BENCH_WRITE("write_ext (fixext4)", msgpack_write_ext(&mbuf, 1, bench_text, 4));
+  BENCH_WRITE("write_timestamp (64)", msgpack_write_timestamp(&mbuf, &ts));
+}
+
+BENCH(write, raw) {
+  BENCH_WRITE("write_smallstr 16B", msgpack_write_smallstr(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_str8 16B", msgpack_write_str8(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_str16 16B", msgpack_write_str16(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_str32 16B", msgpack_write_str32(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_str 0~31B", msgpack_write_str(&mbuf, bench_text, i & 31));
+  BENCH_WRITE("write_bin8 16B", msgpack_write_bin8(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_bin16 16B", msgpack_write_bin16(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_bin32 16B", msgpack_write_bin32(&mbuf, bench_text, 16));
+  BENCH_WRITE("write_bin 0~31B", msgpack_write_bin(&mbuf, bench_text, i & 31));
+}
+
+BENCH(write, containers) {
+  BENCH_WRITE("write_smallarr", msgpack_write_smallarr(&mbuf, i & 15));
+  BENCH_WRITE("write_arr16", msgpack_write_arr16(&mbuf, i));
+  BENCH_WRITE("write_arr32", msgpack_write_arr32(&mbuf, i));
+  BENCH_WRITE("write_arr", msgpack_write_arr(&mbuf, i));
+  BENCH_WRITE("write_smallmap", msgpack_write_smallmap(&mbuf, i & 15));
+  BENCH_WRITE("write_map16", msgpack_write_map16(&mbuf, i));
+  BENCH_WRITE("write_map32", msgpack_write_map32(&mbuf, i));
+  BENCH_WRITE("write_map", msgpack_write_map(&mbuf, i));
+}
+
+BENCH(read, scalars) {
+  BENCH_READ("unpack nil", msgpack_write_nil(&mbuf));
+  BENCH_READ("unpack bool", msgpack_write_bool(&mbuf, (i & 1) != 0));
+  BENCH_READ("unpack fixint", msgpack_write_smallint(&mbuf, i & 0x7f));
+  BENCH_READ("unpack u8", msgpack_write_u8(&mbuf, i));
+  BENCH_READ("unpack u16", msgpack_write_u16(&mbuf, i));
+  BENCH_READ("unpack u32", msgpack_write_u32(&mbuf, i));
+  BENCH_READ("unpack u64", msgpack_write_u64(&mbuf, i));
+  BENCH_READ("unpack s8", msgpack_write_s8(&mbuf, -i));
+  BENCH_READ("unpack s16", msgpack_write_s16(&mbuf, -i));
+  BENCH_READ("unpack s32", msgpack_write_s32(&mbuf, -i));
+  BENCH_READ("unpack s64", msgpack_write_s64(&mbuf, -i));
+  BENCH_READ("unpack integer (mixed)", msgpack_write_integer(&mbuf, BENCH_INT(i)));
+  BENCH_READ("unpack float", msgpack_write_float(&mbuf, (float)i));
+  BENCH_READ("unpack double", msgpack_write_double(&mbuf, (double)i));
+  BENCH_READ("unpack ext (fixext4)", msgpack_write_ext(&mbuf, 1, bench_text, 4));
+}
+
+BENCH(read, raw) {
+  msgpack_unpacker_t unpacker;
+  msgpack_timestamp_t ts = {1500000000, 123456789};
+  const uint8_t *view;
+  uint32_t view_len;
+  uint8_t view_type;
+  int j;
+
+  BENCH_READ("unpack fixstr 16B", msgpack_write_smallstr(&mbuf, bench_text, 16));
+  BENCH_READ("unpack str8 16B", msgpack_write_str8(&mbuf, bench_text, 16));
+  BENCH_READ("unpack str16 16B", msgpack_write_str16(&mbuf, bench_text, 16));
+  BENCH_READ("unpack str32 16B", msgpack_write_str32(&mbuf, bench_text, 16));
+  BENCH_READ("unpack bin8 16B", msgpack_write_bin8(&mbuf, bench_text, 16));
+  BENCH_READ("unpack bin16 16B", msgpack_write_bin16(&mbuf, bench_text, 16));
+  BENCH_READ("unpack bin32 16B", msgpack_write_bin32(&mbuf, bench_text, 16));
+
+  /* bench_buf still holds the bin32 values. */
+  BENCH_LOOP("unpack_view bin32 16B x1024", BENCH_ITERS, BENCH_OPS * 21,
+    init_msgpack_unpacker(&unpacker, bench_buf, BENCH_OPS * 21, 0);
+    for (j = 0; j < BENCH_OPS; ++j) {
+      view_type = MSGPACK_TYPE_ANY;
+      msgpack_unpack_view(&unpacker, &view, &view_len, &view_type);
+    }
+    bench_sink += unpacker.pos);
+
+  {
+    msgpack_buffer_t mbuf;
+    init_msgpack_buffer(&mbuf, bench_buf, sizeof(bench_buf));
+    for (j = 0; j < BENCH_OPS; ++j) {
+      msgpack_write_timestamp(&mbuf, &ts);
+    }
+    BENCH_LOOP("unpack_timestamp (64) x1024", BENCH_ITERS, mbuf.len,
+      init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+      for (j = 0; j < BENCH_OPS; ++j) {
+        msgpack_unpack_timestamp(&unpacker, &ts);
+      }
+      bench_sink += ts.nsec);
+  }
+}
+
+BENCH(read, containers) {
+  BENCH_READ("unpack fixarray", msgpack_write_smallarr(&mbuf, i & 15));
+  BENCH_READ("unpack array16", msgpack_write_arr16(&mbuf, i));
+  BENCH_READ("unpack array32", msgpack_write_arr32(&mbuf, i));
+  BENCH_READ("unpack fixmap", msgpack_write_smallmap(&mbuf, i & 15));
+  BENCH_READ("unpack map16", msgpack_write_map16(&mbuf, i));
+  BENCH_READ("unpack map32", msgpack_write_map32(&mbuf, i));
+}
@@ -83,8 +83,43 @@ void msgpack_person(void) {
   printf("]\n");
 }
 
+struct person {
+  char name[8];
+  uint8_t age;
+  char gender[8];
+};
+
+#define PERSON_FIELDS(X, S) \
+  X(S, STR, name) \
+  X(S, UINT, age) \
+  X(S, STR, gender)
+
+MSGPACK_SCHEMA(person_schema, struct person, PERSON_FIELDS);
+
+void msgpack_person_schema(void) {
+  msgpack_buffer_t mbuf;
+  uint8_t data[64];
+  struct person joan = {"Joan", 30, "female"};
+  struct person person;
+
+  init_msgpack_buffer(&mbuf, data, 64);
+  /* The same map, written and read through the schema of struct person. */
+  if (!msgpack_write_struct(&mbuf, &person_schema, &joan)) {
+    return;
+  }
+
+  msgpack_unpacker_t unpacker;
+  memset(&person, 0, sizeof(person));
+  init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+  if (msgpack_unpack_struct(&unpacker, &person_schema, &person)) {
+    printf("{name: \"%s\", age: %d, gender: \"%s\"}\n", person.name,
+        person.age, person.gender);
+  }
+}
+
 int main(void) {
   msgpack_person();
+  msgpack_person_schema();
   return 0;
 }
 
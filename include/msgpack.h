@@ -26,8 +26,99 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include "msgpack_conf.h"
 
+/* Provide msgpack_stdlib_allocator, pulls realloc()/free() into the link. */
+#ifndef MSGPACK_STDLIB_ALLOCATOR
+#define MSGPACK_STDLIB_ALLOCATOR (1)
+#endif
+
+/* Keep msgpack_errno() per thread, so concurrent callers do not share it. */
+#ifndef MSGPACK_THREAD_LOCAL_ERRNO
+#define MSGPACK_THREAD_LOCAL_ERRNO (1)
+#endif
+
+/* The first allocation size of a growable buffer. */
+#ifndef MSGPACK_BUFFER_MIN_ALLOC
+#define MSGPACK_BUFFER_MIN_ALLOC (64)
+#endif
+
+/* The storage class of thread local variables, if the compiler has one. */
+#ifndef MSGPACK_THREAD_LOCAL
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_THREADS__)
+#define MSGPACK_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define MSGPACK_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MSGPACK_THREAD_LOCAL __declspec(thread)
+#endif
+#endif
+
+/**
+ * Provide msgpack_pool_t, needs the __atomic builtins of GCC or clang and
+ * thread local storage.
+ */
+#ifndef MSGPACK_BUFFER_POOL
+#if defined(__GNUC__) && defined(MSGPACK_THREAD_LOCAL)
+#define MSGPACK_BUFFER_POOL (1)
+#else
+#define MSGPACK_BUFFER_POOL (0)
+#endif
+#endif
+
+/* The size classes of a pool, from MSGPACK_BUFFER_MIN_ALLOC doubling. */
+#ifndef MSGPACK_POOL_CLASSES
+#define MSGPACK_POOL_CLASSES (12)
+#endif
+
+/* The most blocks of a class a thread keeps before giving them back. */
+#ifndef MSGPACK_POOL_CACHE_BLOCKS
+#define MSGPACK_POOL_CACHE_BLOCKS (16)
+#endif
+
+/* Assert the bounds of the unchecked msgpack_put_* writers. */
+#ifndef MSGPACK_DEBUG
+#define MSGPACK_DEBUG (0)
+#endif
+
+/* msgpack_iovec_t is the struct iovec of <sys/uio.h>, usable by writev(). */
+#ifndef MSGPACK_POSIX_IOVEC
+#if defined(__unix__) || defined(__APPLE__)
+#define MSGPACK_POSIX_IOVEC (1)
+#else
+#define MSGPACK_POSIX_IOVEC (0)
+#endif
+#endif
+
+/* The size of the blocks a growable arena takes from its allocator. */
+#ifndef MSGPACK_ARENA_BLOCK_SIZE
+#define MSGPACK_ARENA_BLOCK_SIZE (4096)
+#endif
+
+/* The deepest nesting of arrays and maps msgpack_parse() accepts. */
+#ifndef MSGPACK_PARSE_MAX_DEPTH
+#define MSGPACK_PARSE_MAX_DEPTH (32)
+#endif
+
+/* Scan with SSE2 or AVX2 when the compiler targets them. */
+#ifndef MSGPACK_SIMD
+#define MSGPACK_SIMD (1)
+#endif
+
+/* Host byte order, detected at compile time, define it to override. */
+#ifndef MSGPACK_BIG_ENDIAN
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#define MSGPACK_BIG_ENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#elif defined(__BIG_ENDIAN__) || defined(__ARMEB__) || defined(__MIPSEB__) || \
+    defined(__AARCH64EB__)
+#define MSGPACK_BIG_ENDIAN (1)
+#else
+#define MSGPACK_BIG_ENDIAN (0)
+#endif
+#endif
+
 enum {
   MSGPACK_EOK = 0,
   MSGPACK_EUNKNOWN,
@@ -36,6 +127,8 @@ enum {
   MSGPACK_EINIT,
   MSGPACK_EENDBUF,
   MSGPACK_EUNEXPECTED,
+  MSGPACK_ELIMIT,
+  MSGPACK_EUTF8,
   MSGPACK_EMAX
 };
 
@@ -97,14 +190,82 @@ enum {
   MSGPACK_TYPE_BIN     = 0x60,
   MSGPACK_TYPE_ARRAY   = 0x70,
   MSGPACK_TYPE_MAP     = 0x80,
-  // MSGPACK_TYPE_EXT     = 0x90,
+  MSGPACK_TYPE_EXT     = 0x90,
 };
 
+/**
+ * @name Byte order
+ * Load and store big endian integers at unaligned addresses.
+ * @{
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define msgpack_bswap16(x) __builtin_bswap16(x)
+#define msgpack_bswap32(x) __builtin_bswap32(x)
+#define msgpack_bswap64(x) __builtin_bswap64(x)
+#else
+#define msgpack_bswap16(x) ((uint16_t)(((x) >> 8) | ((x) << 8)))
+#define msgpack_bswap32(x) ( \
+  (((x) >> 24) & 0x000000FFu) | (((x) >> 8) & 0x0000FF00u) | \
+  (((x) << 8) & 0x00FF0000u) | (((x) << 24) & 0xFF000000u))
+#define msgpack_bswap64(x) ( \
+  ((uint64_t)msgpack_bswap32((uint32_t)(x)) << 32) | \
+  msgpack_bswap32((uint32_t)((x) >> 32)))
+#endif
+
+#if MSGPACK_BIG_ENDIAN
+#define msgpack_be16(x) (x)
+#define msgpack_be32(x) (x)
+#define msgpack_be64(x) (x)
+#else
+#define msgpack_be16(x) msgpack_bswap16(x)
+#define msgpack_be32(x) msgpack_bswap32(x)
+#define msgpack_be64(x) msgpack_bswap64(x)
+#endif
+
+static inline void msgpack_store_be16(uint8_t *p, uint16_t v) {
+  v = msgpack_be16(v);
+  memcpy(p, &v, 2);
+}
+
+static inline void msgpack_store_be32(uint8_t *p, uint32_t v) {
+  v = msgpack_be32(v);
+  memcpy(p, &v, 4);
+}
+
+static inline void msgpack_store_be64(uint8_t *p, uint64_t v) {
+  v = msgpack_be64(v);
+  memcpy(p, &v, 8);
+}
+
+static inline uint16_t msgpack_load_be16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return msgpack_be16(v);
+}
+
+static inline uint32_t msgpack_load_be32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return msgpack_be32(v);
+}
+
+static inline uint64_t msgpack_load_be64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return msgpack_be64(v);
+}
+
+/**
+ * @}
+ */
+
 #ifdef  __cplusplus
 extern "C"
 {
 #endif
 
+/* The error of the last call made by the calling thread. */
 int msgpack_errno(void);
 #if !MSGPACK_SIZE_OPT
 const char *msgpack_errmsg(void);
@@ -122,26 +283,134 @@ const char *msgpack_errmsg(void);
  */
 
 typedef struct msgpack_buffer msgpack_buffer_t;
+typedef struct msgpack_allocator msgpack_allocator_t;
+typedef struct msgpack_iovec_list msgpack_iovec_list_t;
 
 #define init_msgpack_buffer(mbuf, b, l) \
   do { \
     (mbuf)->buf = (b); \
     (mbuf)->len = 0; \
     (mbuf)->alloc = (l); \
+    (mbuf)->allocator = NULL; \
+    (mbuf)->iov = NULL; \
+    (mbuf)->err = MSGPACK_EOK; \
+  } while(0)
+
+/**
+ * A growable buffer owns its memory: it starts empty and is grown through
+ * the allocator, so it must be released by msgpack_buffer_release().
+ */
+#define init_msgpack_growable_buffer(mbuf, a) \
+  do { \
+    (mbuf)->buf = NULL; \
+    (mbuf)->len = 0; \
+    (mbuf)->alloc = 0; \
+    (mbuf)->allocator = (a); \
+    (mbuf)->iov = NULL; \
+    (mbuf)->err = MSGPACK_EOK; \
+  } while(0)
+
+/**
+ * A counter has no memory: msgpack_write_* only add the encoded size to len,
+ * so running the same calls twice sizes a buffer exactly before encoding.
+ * msgpack_reserve() always succeeds on it, msgpack_put_* must not be used.
+ */
+#define init_msgpack_counter(mbuf) \
+  do { \
+    (mbuf)->buf = NULL; \
+    (mbuf)->len = 0; \
+    (mbuf)->alloc = (size_t)-1; \
+    (mbuf)->allocator = NULL; \
+    (mbuf)->iov = NULL; \
+    (mbuf)->err = MSGPACK_EOK; \
   } while(0)
 
+#define msgpack_buffer_counting(mbuf) \
+  (!(mbuf)->buf && (mbuf)->alloc == (size_t)-1)
+
+/**
+ * realloc(ud, NULL, size) allocates, realloc(ud, ptr, size) resizes and keeps
+ * the content, free(ud, ptr) releases. Returns NULL when out of memory.
+ */
+struct msgpack_allocator {
+  void *(*realloc)(void *ud, void *ptr, size_t size);
+  void (*free)(void *ud, void *ptr);
+  void *ud;
+};
 
 struct msgpack_buffer{
   uint8_t *buf;
   size_t len;
   size_t alloc;
+  const struct msgpack_allocator *allocator; /* NULL for a fixed buffer */
+  struct msgpack_iovec_list *iov; /* NULL to copy every body into buf */
+  int err; /* the error of the last call on this buffer */
+};
+
+#define msgpack_buffer_errno(mbuf) ((mbuf)->err)
+
+/**
+ * @name Scatter-gather writer
+ * With mbuf->iov set, msgpack_write_* does not copy str and bin bodies of at
+ * least threshold bytes: the buffer only gets their headers and the list
+ * references the caller's data, which must stay valid until sent. Call
+ * msgpack_iovec_finish() once the message is complete, then pass iov and
+ * cnt to writev(). When the list is full, bodies are copied again.
+ * @{
+ */
+
+#if MSGPACK_POSIX_IOVEC
+#include <sys/uio.h>
+typedef struct iovec msgpack_iovec_t;
+#else
+typedef struct msgpack_iovec {
+  void *iov_base;
+  size_t iov_len;
+} msgpack_iovec_t;
+#endif
+
+#define init_msgpack_iovec_list(l, v, n, t) \
+  do { \
+    (l)->iov = (v); \
+    (l)->cnt = 0; \
+    (l)->alloc = (n); \
+    (l)->threshold = (t); \
+    (l)->mark = 0; \
+  } while(0)
+
+struct msgpack_iovec_list {
+  msgpack_iovec_t *iov;
+  size_t cnt;
+  size_t alloc;
+  size_t threshold;
+  size_t mark; /* the start in buf of the bytes not in iov yet */
 };
 
+/**
+ * @}
+ */
+
 #ifdef  __cplusplus
 extern "C"
 {
 #endif
 
+#if MSGPACK_STDLIB_ALLOCATOR
+/* Allocator backed by realloc()/free() of the C library. */
+extern const struct msgpack_allocator msgpack_stdlib_allocator;
+#endif
+
+void msgpack_buffer_release(msgpack_buffer_t *mbuf);
+
+/**
+ * Make sure that size more bytes can be written, growing the buffer if it
+ * has an allocator. After it the msgpack_put_* writers may write size bytes.
+ */
+bool msgpack_reserve(msgpack_buffer_t *mbuf, size_t size);
+
+/* Add the unsent tail of mbuf->buf to mbuf->iov and resolve its entries. */
+bool msgpack_iovec_finish(msgpack_buffer_t *mbuf);
+
 bool msgpack_byte(msgpack_buffer_t *mbuf, uint8_t data);
 bool msgpack_data(msgpack_buffer_t *mbuf, uint8_t type, const void *data, size_t len);
 bool msgpack_len_data(msgpack_buffer_t *mbuf, uint8_t type, const void *data,
@@ -163,7 +432,7 @@ bool msgpack_data_double(struct msgpack_buffer *mbuf, uint8_t type,
 #define msgpack_write_nil(mbuf) \
   msgpack_byte(mbuf, NIL_TAG)
 #define msgpack_write_bool(mbuf, val) \
-  msgpack_byte(mbuf, val == true ? TRUE_TAG : FALSE_TAG)
+  msgpack_byte(mbuf, (val) == true ? TRUE_TAG : FALSE_TAG)
 #define msgpack_write_true(mbuf) \
   msgpack_byte(mbuf, TRUE_TAG)
 #define msgpack_write_false(mbuf) \
@@ -197,18 +466,19 @@ bool msgpack_data_double(struct msgpack_buffer *mbuf, uint8_t type,
   ((val) >> 8 == 0) ? 1 : \
   ((val) >> 16 == 0) ? 2 : \
   ((val) >> 32 == 0) ? 4 : 8)
+/* For val < 0, ~val is -val - 1, which does not overflow for INT64_MIN. */
 #define msgpack_sint_valsize(val) (\
-  ((-val) >> 7 == 0) ? 1 : \
-  ((-val) >> 15 == 0) ? 2 : \
-  ((-val) >> 31 == 0) ? 4 : 8)
+  (~(int64_t)(val) >> 7 == 0) ? 1 : \
+  (~(int64_t)(val) >> 15 == 0) ? 2 : \
+  (~(int64_t)(val) >> 31 == 0) ? 4 : 8)
 #define msgpack_uint_type(val) (\
   ((val) >> 8 == 0) ? U8_TAG : \
   ((val) >> 16 == 0) ? U16_TAG : \
   ((val) >> 32 == 0) ? U32_TAG : U64_TAG)
 #define msgpack_sint_type(val) (\
-  ((-val) >> 7 == 0) ? S8_TAG : \
-  ((-val) >> 15 == 0) ? S16_TAG : \
-  ((-val) >> 31 == 0) ? S32_TAG : S64_TAG)
+  (~(int64_t)(val) >> 7 == 0) ? S8_TAG : \
+  (~(int64_t)(val) >> 15 == 0) ? S16_TAG : \
+  (~(int64_t)(val) >> 31 == 0) ? S32_TAG : S64_TAG)
 #define msgpack_write_integer(mbuf, val) (\
   ((val) < 0) ? \
     (((val) >= -32) ? msgpack_byte(mbuf, val) : \
@@ -327,6 +597,224 @@ bool msgpack_data_double(struct msgpack_buffer *mbuf, uint8_t type,
  * @}
  */
 
+/**
+ * @name Ext
+ * An ext value is a payload tagged with a type id, negative ids are reserved
+ * by the spec. The timestamp (-1) has its own writer and reader that encode
+ * seconds and nanoseconds in the 32, 64 or 96 bit form directly.
+ * @{
+ */
+
+#define MSGPACK_EXT_TIMESTAMP (-1)
+
+typedef struct msgpack_timestamp msgpack_timestamp_t;
+
+struct msgpack_timestamp {
+  int64_t sec;   /* seconds since 1970-01-01 00:00:00 UTC */
+  uint32_t nsec; /* 0 to 999999999 */
+};
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/* Write in fixext when len is 1, 2, 4, 8 or 16, else in the smallest ext. */
+bool msgpack_write_ext(msgpack_buffer_t *mbuf, int8_t ext_type,
+        const void *data, uint32_t len);
+/* Write in the smallest timestamp form that holds ts. */
+bool msgpack_write_timestamp(msgpack_buffer_t *mbuf,
+        const msgpack_timestamp_t *ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Unchecked writer
+ * The msgpack_put_* writers mirror msgpack_write_*, but do not check the
+ * arguments nor the capacity and do not set errno. Reserve the encoded size
+ * with msgpack_reserve() first, MSGPACK_DEBUG asserts the bounds.
+ * @{
+ */
+
+#if MSGPACK_DEBUG
+#include <assert.h>
+#define msgpack_put_check(mbuf, size) \
+  assert((mbuf)->buf && (mbuf)->alloc - (mbuf)->len >= (size))
+#else
+#define msgpack_put_check(mbuf, size) ((void)0)
+#endif
+
+static inline void msgpack_put_byte(msgpack_buffer_t *mbuf, uint8_t data) {
+  msgpack_put_check(mbuf, 1);
+  mbuf->buf[mbuf->len++] = data;
+}
+
+static inline void msgpack_put_word(msgpack_buffer_t *mbuf, uint8_t type,
+        uint64_t data, size_t len) {
+  uint8_t *p;
+
+  msgpack_put_check(mbuf, 1 + len);
+  p = mbuf->buf + mbuf->len;
+  *p++ = type;
+  switch (len) {
+    case 1: *p = (uint8_t)data; break;
+    case 2: msgpack_store_be16(p, (uint16_t)data); break;
+    case 4: msgpack_store_be32(p, (uint32_t)data); break;
+    default: msgpack_store_be64(p, data); break;
+  }
+  mbuf->len += 1 + len;
+}
+
+static inline void msgpack_put_len_data(msgpack_buffer_t *mbuf, uint8_t type,
+        const void *data, uint32_t len, size_t len_size) {
+  uint8_t *p;
+
+  msgpack_put_check(mbuf, 1 + len_size + (data ? len : 0));
+  p = mbuf->buf + mbuf->len;
+  switch (len_size) {
+    case 0: *p = type | (uint8_t)len; break;
+    case 1: *p = type; p[1] = (uint8_t)len; break;
+    case 2: *p = type; msgpack_store_be16(p + 1, (uint16_t)len); break;
+    default: *p = type; msgpack_store_be32(p + 1, len); break;
+  }
+  mbuf->len += 1 + len_size;
+  if (data) {
+    memcpy(mbuf->buf + mbuf->len, data, len);
+    mbuf->len += len;
+  }
+}
+
+static inline void msgpack_put_float(msgpack_buffer_t *mbuf, float data) {
+  uint32_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  msgpack_put_word(mbuf, FLOAT_TAG, bits, 4);
+}
+
+static inline void msgpack_put_double(msgpack_buffer_t *mbuf, double data) {
+  uint64_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  msgpack_put_word(mbuf, DOUBLE_TAG, bits, 8);
+}
+
+/* Write val in the smallest encoding. */
+static inline void msgpack_put_integer(msgpack_buffer_t *mbuf, int64_t val) {
+  if (val >= -32 && val <= 127) {
+    msgpack_put_byte(mbuf, (uint8_t)val);
+  } else if (val > 0) {
+    if (val <= UINT8_MAX) {
+      msgpack_put_word(mbuf, U8_TAG, (uint64_t)val, 1);
+    } else if (val <= UINT16_MAX) {
+      msgpack_put_word(mbuf, U16_TAG, (uint64_t)val, 2);
+    } else if (val <= UINT32_MAX) {
+      msgpack_put_word(mbuf, U32_TAG, (uint64_t)val, 4);
+    } else {
+      msgpack_put_word(mbuf, U64_TAG, (uint64_t)val, 8);
+    }
+  } else if (val >= INT8_MIN) {
+    msgpack_put_word(mbuf, S8_TAG, (uint64_t)val, 1);
+  } else if (val >= INT16_MIN) {
+    msgpack_put_word(mbuf, S16_TAG, (uint64_t)val, 2);
+  } else if (val >= INT32_MIN) {
+    msgpack_put_word(mbuf, S32_TAG, (uint64_t)val, 4);
+  } else {
+    msgpack_put_word(mbuf, S64_TAG, (uint64_t)val, 8);
+  }
+}
+
+/* Write val in the smallest encoding. */
+static inline void msgpack_put_uinteger(msgpack_buffer_t *mbuf, uint64_t val) {
+  if (val <= 127) {
+    msgpack_put_byte(mbuf, (uint8_t)val);
+  } else if (val <= UINT8_MAX) {
+    msgpack_put_word(mbuf, U8_TAG, val, 1);
+  } else if (val <= UINT16_MAX) {
+    msgpack_put_word(mbuf, U16_TAG, val, 2);
+  } else if (val <= UINT32_MAX) {
+    msgpack_put_word(mbuf, U32_TAG, val, 4);
+  } else {
+    msgpack_put_word(mbuf, U64_TAG, val, 8);
+  }
+}
+
+#define msgpack_put_nil(mbuf) \
+  msgpack_put_byte(mbuf, NIL_TAG)
+#define msgpack_put_bool(mbuf, val) \
+  msgpack_put_byte(mbuf, (val) ? TRUE_TAG : FALSE_TAG)
+#define msgpack_put_true(mbuf) \
+  msgpack_put_byte(mbuf, TRUE_TAG)
+#define msgpack_put_false(mbuf) \
+  msgpack_put_byte(mbuf, FALSE_TAG)
+#define msgpack_put_smallint(mbuf, val) \
+  msgpack_put_byte(mbuf, (uint8_t)(val))
+#define msgpack_put_u8(mbuf, val) \
+  msgpack_put_word(mbuf, U8_TAG, (uint8_t)(val), 1)
+#define msgpack_put_u16(mbuf, val) \
+  msgpack_put_word(mbuf, U16_TAG, (uint16_t)(val), 2)
+#define msgpack_put_u32(mbuf, val) \
+  msgpack_put_word(mbuf, U32_TAG, (uint32_t)(val), 4)
+#define msgpack_put_u64(mbuf, val) \
+  msgpack_put_word(mbuf, U64_TAG, (uint64_t)(val), 8)
+#define msgpack_put_s8(mbuf, val) \
+  msgpack_put_word(mbuf, S8_TAG, (uint64_t)(int64_t)(val), 1)
+#define msgpack_put_s16(mbuf, val) \
+  msgpack_put_word(mbuf, S16_TAG, (uint64_t)(int64_t)(val), 2)
+#define msgpack_put_s32(mbuf, val) \
+  msgpack_put_word(mbuf, S32_TAG, (uint64_t)(int64_t)(val), 4)
+#define msgpack_put_s64(mbuf, val) \
+  msgpack_put_word(mbuf, S64_TAG, (uint64_t)(int64_t)(val), 8)
+
+#define msgpack_put_smallstr(mbuf, str, len) \
+  msgpack_put_len_data(mbuf, FIXSTR_TAG, str, len, 0)
+#define msgpack_put_str8(mbuf, str, len) \
+  msgpack_put_len_data(mbuf, STR8_TAG, str, len, 1)
+#define msgpack_put_str16(mbuf, str, len) \
+  msgpack_put_len_data(mbuf, STR16_TAG, str, len, 2)
+#define msgpack_put_str32(mbuf, str, len) \
+  msgpack_put_len_data(mbuf, STR32_TAG, str, len, 4)
+#define msgpack_put_str(mbuf, str, len) \
+  msgpack_put_len_data(mbuf, msgpack_str_type(len), str, len, \
+    msgpack_str_lensize(len))
+
+#define msgpack_put_bin8(mbuf, bin, len) \
+  msgpack_put_len_data(mbuf, BIN8_TAG, bin, len, 1)
+#define msgpack_put_bin16(mbuf, bin, len) \
+  msgpack_put_len_data(mbuf, BIN16_TAG, bin, len, 2)
+#define msgpack_put_bin32(mbuf, bin, len) \
+  msgpack_put_len_data(mbuf, BIN32_TAG, bin, len, 4)
+#define msgpack_put_bin(mbuf, bin, len) \
+  msgpack_put_len_data(mbuf, msgpack_bin_type(len), bin, len, \
+    msgpack_bin_lensize(len))
+
+#define msgpack_put_smallarr(mbuf, len) \
+  msgpack_put_len_data(mbuf, FIXARRAY_TAG, NULL, len, 0)
+#define msgpack_put_arr16(mbuf, len) \
+  msgpack_put_len_data(mbuf, ARRAY16_TAG, NULL, len, 2)
+#define msgpack_put_arr32(mbuf, len) \
+  msgpack_put_len_data(mbuf, ARRAY32_TAG, NULL, len, 4)
+#define msgpack_put_arr(mbuf, len) \
+  msgpack_put_len_data(mbuf, msgpack_arr_type(len), NULL, len, \
+    msgpack_arr_lensize(len))
+
+#define msgpack_put_smallmap(mbuf, len) \
+  msgpack_put_len_data(mbuf, FIXMAP_TAG, NULL, len, 0)
+#define msgpack_put_map16(mbuf, len) \
+  msgpack_put_len_data(mbuf, MAP16_TAG, NULL, len, 2)
+#define msgpack_put_map32(mbuf, len) \
+  msgpack_put_len_data(mbuf, MAP32_TAG, NULL, len, 4)
+#define msgpack_put_map(mbuf, len) \
+  msgpack_put_len_data(mbuf, msgpack_map_type(len), NULL, len, \
+    msgpack_map_lensize(len))
+
+/**
+ * @}
+ */
+
 /**
  * @}
  */
@@ -343,26 +831,859 @@ typedef struct msgpack_unpacker msgpack_unpacker_t;
     (upr)->buf = (b); \
     (upr)->len = (l); \
     (upr)->pos = (used); \
+    (upr)->err = MSGPACK_EOK; \
+    (upr)->flags = 0; \
   } while(0)
 
+/**
+ * Flags of an unpacker, set after init_msgpack_unpacker(), on st->up for a
+ * stream. With MSGPACK_UNPACK_UTF8 every str value read must be UTF-8, else
+ * MSGPACK_EUTF8: by msgpack_unpack(), msgpack_unpack_view(), the stream
+ * reader, the str fields of msgpack_unpack_struct(), msgpack_parse() and
+ * msgpack_index_open(). An index checks its str keys when it is built and
+ * passes the flags to the cursors of msgpack_index_at()/msgpack_index_key()
+ * and to its children, whose values are checked as they are read.
+ */
+#define MSGPACK_UNPACK_UTF8 0x01
+
 struct msgpack_unpacker{
   uint8_t *buf;
   size_t pos;
   size_t len;
+  int err; /* the error of the last call on this unpacker */
+  uint8_t flags; /* MSGPACK_UNPACK_* */
 };
 
+#define msgpack_unpacker_errno(upr) ((upr)->err)
+
 #ifdef  __cplusplus
 extern "C"
 {
 #endif
 
+/* An ext value fails with MSGPACK_EUNEXPECTED, see msgpack_unpack_ext(). */
 bool msgpack_unpack(struct msgpack_unpacker *up, void *data, uint32_t *data_len,
         uint8_t *type);
 
+/**
+ * Read a str or bin value without copying it: *data points to the payload
+ * inside up->buf and the unpacker moves past the value. *type works as in
+ * msgpack_unpack(), other value types fail with MSGPACK_EUNEXPECTED.
+ */
+bool msgpack_unpack_view(struct msgpack_unpacker *up, const uint8_t **data,
+        uint32_t *data_len, uint8_t *type);
+
+/**
+ * Whether data is well formed UTF-8: no overlong forms, surrogates or code
+ * points over U+10FFFF. ASCII runs are checked 16 bytes at a time.
+ */
+bool msgpack_utf8_valid(const void *data, size_t len);
+
+/**
+ * Move past the next value, with all the values of an array or map. The
+ * position does not change on error.
+ */
+bool msgpack_skip(struct msgpack_unpacker *up);
+
+/**
+ * Read an ext value without copying it: *data points to the payload inside
+ * up->buf. Other value types fail with MSGPACK_EUNEXPECTED.
+ */
+bool msgpack_unpack_ext(struct msgpack_unpacker *up, int8_t *ext_type,
+        const uint8_t **data, uint32_t *data_len);
+
+/**
+ * Read a timestamp in any of its forms. Another ext type, a bad size or
+ * nanoseconds out of range fail with MSGPACK_EUNEXPECTED.
+ */
+bool msgpack_unpack_timestamp(struct msgpack_unpacker *up,
+        msgpack_timestamp_t *ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @name Stream reader
+ * Unpack items from data arriving in chunks. Items are read in place from
+ * the fed chunk; an item cut by the end of a chunk is rebuilt whole in the
+ * stage buffer, with the bytes of the next chunk. The stage does not grow:
+ * it must hold the largest item (a container counts as its header only)
+ * and the bytes left unread at each feed, else MSGPACK_ENOBUF is returned
+ * and the stream can not go on. Each call reads one item as msgpack_unpack()
+ * does and fails with MSGPACK_EENDBUF when the next chunk must be fed.
+ * @{
+ */
+
+typedef struct msgpack_stream msgpack_stream_t;
+
+#define init_msgpack_stream(st, b, l) \
+  do { \
+    init_msgpack_unpacker(&(st)->up, NULL, 0, 0); \
+    (st)->stage = (b); \
+    (st)->stage_pos = 0; \
+    (st)->stage_len = 0; \
+    (st)->stage_alloc = (l); \
+    (st)->err = MSGPACK_EOK; \
+  } while(0)
+
+struct msgpack_stream {
+  struct msgpack_unpacker up; /* the current chunk */
+  uint8_t *stage;
+  size_t stage_pos; /* the staged bytes already read */
+  size_t stage_len;
+  size_t stage_alloc;
+  int err; /* the error of the last call on this stream */
+};
+
+#define msgpack_stream_errno(st) ((st)->err)
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Continue with the next chunk. Bytes left unread in the previous chunk are
+ * staged first, so it can be released once this returns true.
+ */
+bool msgpack_stream_feed(msgpack_stream_t *st, const uint8_t *chunk,
+        size_t len);
+bool msgpack_stream_unpack(msgpack_stream_t *st, void *data,
+        uint32_t *data_len, uint8_t *type);
+/* As msgpack_unpack_view(), *data is valid until the next call or feed. */
+bool msgpack_stream_unpack_view(msgpack_stream_t *st, const uint8_t **data,
+        uint32_t *data_len, uint8_t *type);
+bool msgpack_stream_unpack_ext(msgpack_stream_t *st, int8_t *ext_type,
+        const uint8_t **data, uint32_t *data_len);
+bool msgpack_stream_unpack_timestamp(msgpack_stream_t *st,
+        msgpack_timestamp_t *ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Tree
+ * msgpack_parse() reads a whole value into a tree of nodes taken from an
+ * arena. The values of an array or map are contiguous, a map stores each
+ * key followed by its value. str, bin and ext nodes point into the source
+ * buffer, which must outlive the tree. msgpack_arena_release() frees all
+ * the nodes at once.
+ * @{
+ */
+
+typedef struct msgpack_arena msgpack_arena_t;
+typedef struct msgpack_node msgpack_node_t;
+
+/* An arena bumping through the caller's memory only. */
+#define init_msgpack_arena(arena, b, l) \
+  do { \
+    (arena)->base = (b); \
+    (arena)->base_alloc = (l); \
+    (arena)->buf = (b); \
+    (arena)->len = 0; \
+    (arena)->alloc = (l); \
+    (arena)->allocator = NULL; \
+    (arena)->blocks = NULL; \
+    (arena)->err = MSGPACK_EOK; \
+  } while(0)
+
+/* An arena taking blocks from the allocator, b may be NULL. */
+#define init_msgpack_growable_arena(arena, b, l, a) \
+  do { \
+    init_msgpack_arena(arena, b, l); \
+    (arena)->allocator = (a); \
+  } while(0)
+
+struct msgpack_arena {
+  uint8_t *base; /* the caller's memory, used first */
+  size_t base_alloc;
+  uint8_t *buf; /* the block allocations are bumped from */
+  size_t len;
+  size_t alloc;
+  const struct msgpack_allocator *allocator; /* NULL for a fixed arena */
+  union msgpack_arena_block *blocks; /* taken from the allocator */
+  int err; /* the error of the last call on this arena */
+};
+
+#define msgpack_arena_errno(arena) ((arena)->err)
+
+struct msgpack_node {
+  uint8_t type; /* the MSGPACK_TYPE_* the value is encoded in */
+  int8_t ext_type;
+  uint32_t len; /* bytes of str, bin and ext, values of array, pairs of map */
+  union {
+    bool b;
+    uint64_t u; /* MSGPACK_TYPE_U8 ~ MSGPACK_TYPE_U64 */
+    int64_t i;  /* MSGPACK_TYPE_S8 ~ MSGPACK_TYPE_S64 */
+    double f;   /* MSGPACK_TYPE_SINGLE and MSGPACK_TYPE_DOUBLE */
+    const uint8_t *data;
+    struct msgpack_node *child;
+  } v;
+};
+
+#define msgpack_node_at(node, i) (&(node)->v.child[i])
+#define msgpack_node_key(node, i) (&(node)->v.child[2 * (i)])
+#define msgpack_node_value(node, i) (&(node)->v.child[2 * (i) + 1])
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/* size bytes aligned for any node, NULL with MSGPACK_ENOBUF when full. */
+void *msgpack_arena_alloc(msgpack_arena_t *arena, size_t size);
+
+/* Free the blocks and start over from the caller's memory. */
+void msgpack_arena_release(msgpack_arena_t *arena);
+
+/**
+ * Parse the value at up->pos and move past it. Nesting deeper than
+ * MSGPACK_PARSE_MAX_DEPTH fails with MSGPACK_ELIMIT. On error the position
+ * does not change and the arena keeps what was allocated until released.
+ */
+bool msgpack_parse(struct msgpack_unpacker *up, msgpack_arena_t *arena,
+        msgpack_node_t **root);
+
+/* The value of the str key in map, NULL if absent. */
+const msgpack_node_t *msgpack_node_find(const msgpack_node_t *map,
+        const char *key, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Index
+ * An index records where the values of one array or map start, so they are
+ * reached without walking the encoded buffer again. Only the containers that
+ * are opened get an index: msgpack_index_child() indexes a nested container
+ * the first time it is asked for and returns the same index afterwards. The
+ * str keys of a map are hashed, msgpack_index_find() does not compare every
+ * key. Indexes are taken from an arena and refer to the buffer of the
+ * unpacker they were opened on.
+ * @{
+ */
+
+typedef struct msgpack_index msgpack_index_t;
+
+struct msgpack_index {
+  const uint8_t *buf;
+  size_t len;
+  uint8_t type;  /* MSGPACK_TYPE_ARRAY or MSGPACK_TYPE_MAP */
+  uint32_t count; /* values of an array, pairs of a map */
+  size_t *offs;  /* the start of each value, keys and values for a map */
+  uint32_t *slots; /* hash of the str keys to pair + 1, 0 if free */
+  uint32_t slot_mask;
+  struct msgpack_index **kids; /* indexes of nested values, NULL until asked */
+  uint8_t flags; /* MSGPACK_UNPACK_* of the unpacker it was opened on */
+  int err; /* the error of the last call on this index */
+};
+
+#define msgpack_index_errno(idx) ((idx)->err)
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Index the array or map at up->pos and move past it. Other value types fail
+ * with MSGPACK_EUNEXPECTED.
+ */
+bool msgpack_index_open(struct msgpack_unpacker *up, msgpack_arena_t *arena,
+        msgpack_index_t **idx);
+
+/* Point cur at the value i: the element of an array, the value of a pair. */
+bool msgpack_index_at(msgpack_index_t *idx, uint32_t i,
+        struct msgpack_unpacker *cur);
+
+/* Point cur at the key of the pair i of a map. */
+bool msgpack_index_key(msgpack_index_t *idx, uint32_t i,
+        struct msgpack_unpacker *cur);
+
+/* The pair of the str key, false if the map does not have it. */
+bool msgpack_index_find(const msgpack_index_t *idx, const char *key,
+        uint32_t len, uint32_t *i);
+
+/* The index of the container at value i, opened on the first call. */
+bool msgpack_index_child(msgpack_index_t *idx, uint32_t i,
+        msgpack_arena_t *arena, msgpack_index_t **child);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Scanner
+ * msgpack_scan() finds where every top level value of a buffer starts, and
+ * every array and map if containers is set, without decoding any value.
+ * Runs of one byte values (fixint, nil, bool, empty str) are checked 16 or
+ * 32 bytes at a time with SSE2 or AVX2. A scan continues at pos, so a full
+ * list or a value cut by the end of the buffer is resumed by emptying the
+ * lists or appending the data and calling it again.
+ * @{
+ */
+
+typedef struct msgpack_scan msgpack_scan_t;
+
+#define init_msgpack_scan(sc, v, n, c, m) \
+  do { \
+    (sc)->values = (v); \
+    (sc)->value_cnt = 0; \
+    (sc)->value_alloc = (n); \
+    (sc)->containers = (c); \
+    (sc)->container_cnt = 0; \
+    (sc)->container_alloc = (m); \
+    (sc)->pos = 0; \
+    (sc)->err = MSGPACK_EOK; \
+  } while(0)
+
+struct msgpack_scan {
+  size_t *values; /* the offsets of the top level values */
+  size_t value_cnt;
+  size_t value_alloc;
+  size_t *containers; /* the offsets of arrays and maps, NULL to not record */
+  size_t container_cnt;
+  size_t container_alloc;
+  size_t pos; /* the end of the last complete value */
+  int err; /* the error of the last call on this scan */
+};
+
+#define msgpack_scan_errno(sc) ((sc)->err)
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Scan buf from sc->pos to len. Fails with MSGPACK_ENOBUF when a list is
+ * full and MSGPACK_EENDBUF when the last value is cut, pos is then the start
+ * of the value not recorded.
+ */
+bool msgpack_scan(msgpack_scan_t *sc, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Schema
+ * The fields of a struct are listed once in an X-macro, from which
+ * MSGPACK_SCHEMA() builds a table of their offsets, sizes and map keys. The
+ * keys are encoded as fixstr at compile time, so msgpack_write_struct()
+ * copies each one with a memcpy and stores the value without any lookup:
+ *
+ *   struct person { char name[16]; uint8_t age; char gender[8]; };
+ *
+ *   #define PERSON_FIELDS(X, S) \
+ *     X(S, STR, name) \
+ *     X(S, UINT, age) \
+ *     X(S, STR, gender)
+ *
+ *   MSGPACK_SCHEMA(person_schema, struct person, PERSON_FIELDS);
+ *
+ * BOOL, INT and UINT members may be of any width, FLOAT and DOUBLE are float
+ * and double, STR is a char array holding a NUL terminated string, of which
+ * a full array writes all but the last byte. A field name longer than 31
+ * bytes fails to compile.
+ * @{
+ */
+
+enum {
+  MSGPACK_FIELD_BOOL,
+  MSGPACK_FIELD_INT,
+  MSGPACK_FIELD_UINT,
+  MSGPACK_FIELD_FLOAT,
+  MSGPACK_FIELD_DOUBLE,
+  MSGPACK_FIELD_STR,
+};
+
+typedef struct msgpack_field msgpack_field_t;
+typedef struct msgpack_schema msgpack_schema_t;
+
+struct msgpack_field {
+  const uint8_t *key; /* the fixstr tag followed by the name */
+  uint8_t key_size; /* the bytes of key */
+  uint8_t kind;
+  uint32_t size; /* the size of the member */
+  size_t offset;
+};
+
+struct msgpack_schema {
+  const struct msgpack_field *fields;
+  uint32_t count;
+};
+
+#define MSGPACK_SCHEMA_KEY_(S, kind, member) \
+  struct { \
+    uint8_t tag; \
+    char str[sizeof(#member) <= 32 ? (int)sizeof(#member) : -1]; \
+  } member;
+
+#define MSGPACK_SCHEMA_KEY_INIT_(S, kind, member) \
+  { FIXSTR_TAG | (sizeof(#member) - 1), #member },
+
+#define MSGPACK_SCHEMA_FIELD_(S, kind, member) \
+  { &S##_keys_.member.tag, sizeof(#member), MSGPACK_FIELD_##kind, \
+    sizeof(((S##_type_ *)0)->member), offsetof(S##_type_, member) },
+
+/* Define the static schema name of type from the field list FIELDS. */
+#define MSGPACK_SCHEMA(name, type, FIELDS) \
+  typedef type name##_type_; \
+  static const struct { \
+    FIELDS(MSGPACK_SCHEMA_KEY_, name) \
+  } name##_keys_ = { \
+    FIELDS(MSGPACK_SCHEMA_KEY_INIT_, name) \
+  }; \
+  static const struct msgpack_field name##_fields_[] = { \
+    FIELDS(MSGPACK_SCHEMA_FIELD_, name) \
+  }; \
+  static const struct msgpack_schema name = { \
+    name##_fields_, sizeof(name##_fields_) / sizeof(name##_fields_[0]) \
+  }
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Write obj as a map of all the fields of schema, in their order. The space
+ * is reserved once, then keys and values are stored unchecked.
+ */
+bool msgpack_write_struct(msgpack_buffer_t *mbuf, const msgpack_schema_t *schema,
+        const void *obj);
+
+/**
+ * Read a map into obj. A key is first compared with the field that follows
+ * the last one read, so maps written in schema order match at once. Unknown
+ * keys are skipped and a nil value or a missing key leaves its member as it
+ * is. A value of the wrong type or out of the range of its member fails with
+ * MSGPACK_EUNEXPECTED, a string too long for its array with MSGPACK_ENOBUF;
+ * obj may then be partly filled but the position does not change.
+ */
+bool msgpack_unpack_struct(msgpack_unpacker_t *up, const msgpack_schema_t *schema,
+        void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Keyset
+ * A keyset encodes a list of map keys once. Writers emit a key by its handle,
+ * its position in the list, with a single copy of the encoded bytes, and
+ * readers look the key at the unpacker up without copying it out. The table
+ * is a perfect hash built by hash and displace: the hash of a key picks a
+ * bucket, whose displacement was searched at build time so that the keys of
+ * the list never share a slot, and a lookup is one hash, one slot and one
+ * compare. The keyset is taken from an arena.
+ * @{
+ */
+
+typedef struct msgpack_keyset msgpack_keyset_t;
+
+#define MSGPACK_KEY_NONE UINT32_MAX
+
+struct msgpack_keyset {
+  uint8_t *data; /* the keys encoded as str, back to back */
+  uint32_t *offs; /* key i is from offs[i] to offs[i + 1] in data */
+  uint32_t count;
+  uint32_t *disp; /* the displacement of each bucket */
+  uint32_t disp_mask;
+  uint32_t *slots; /* handle + 1 of the key in each slot, 0 if free */
+  uint32_t slot_mask;
+  int err; /* the error of the last call on this keyset */
+};
+
+#define msgpack_keyset_errno(ks) ((ks)->err)
+
+/* Write the key of handle h, with msgpack_reserve() done by the caller. */
+static inline void msgpack_put_key(msgpack_buffer_t *mbuf,
+        const msgpack_keyset_t *ks, uint32_t h) {
+  size_t size = ks->offs[h + 1] - ks->offs[h];
+
+  msgpack_put_check(mbuf, size);
+  memcpy(mbuf->buf + mbuf->len, ks->data + ks->offs[h], size);
+  mbuf->len += size;
+}
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Encode the count NUL terminated keys into ks. The handle of a key is its
+ * position in keys, a repeated key is found by the first handle.
+ */
+bool msgpack_keyset_build(msgpack_keyset_t *ks, msgpack_arena_t *arena,
+        const char *const *keys, uint32_t count);
+
+/* Build the keyset of the field names of schema, handles are field indexes. */
+bool msgpack_keyset_build_schema(msgpack_keyset_t *ks, msgpack_arena_t *arena,
+        const msgpack_schema_t *schema);
+
+/* Write the key of handle h. */
+bool msgpack_write_key(msgpack_buffer_t *mbuf, const msgpack_keyset_t *ks,
+        uint32_t h);
+
+/* The handle of the key of len bytes, false if it is not in ks. */
+bool msgpack_keyset_find(const msgpack_keyset_t *ks, const void *key,
+        uint32_t len, uint32_t *h);
+
+/**
+ * Read a str and set *h to the handle of that key, MSGPACK_KEY_NONE when it
+ * is not in ks. Other value types fail with MSGPACK_EUNEXPECTED.
+ */
+bool msgpack_unpack_key(msgpack_unpacker_t *up, const msgpack_keyset_t *ks,
+        uint32_t *h);
+
+/**
+ * msgpack_unpack_struct() with the field of each key found through ks, built
+ * by msgpack_keyset_build_schema(), in place of a search by name.
+ */
+bool msgpack_unpack_struct_keys(msgpack_unpacker_t *up,
+        const msgpack_schema_t *schema, const msgpack_keyset_t *ks, void *obj);
+
 #ifdef __cplusplus
 }
 #endif
 
+/**
+ * @}
+ */
+
+/**
+ * @name Typed arrays
+ * Write n numbers of one C type as an array in one call. The space is
+ * reserved once and the elements are stored without further checks, each
+ * with one byte swap and one store. The plain writers keep the width of the
+ * type, a uint16_t is always a U16. The compact ones pick the smallest
+ * encoding of every integer, and find runs of fixints 16 elements at a time
+ * with SSE2 when it is available. The readers fill a C array from an array
+ * of any encoding the same way.
+ * @{
+ */
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * type is one of MSGPACK_TYPE_U8 ~ MSGPACK_TYPE_U64, MSGPACK_TYPE_S8 ~
+ * MSGPACK_TYPE_S64, MSGPACK_TYPE_SINGLE (float) and MSGPACK_TYPE_DOUBLE.
+ * compact has no effect on floats.
+ */
+bool msgpack_write_typed_array(msgpack_buffer_t *mbuf, uint8_t type,
+        const void *data, uint32_t n, bool compact);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define msgpack_write_u8_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U8, data, n, false)
+#define msgpack_write_u16_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U16, data, n, false)
+#define msgpack_write_u32_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U32, data, n, false)
+#define msgpack_write_u64_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U64, data, n, false)
+#define msgpack_write_s8_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S8, data, n, false)
+#define msgpack_write_s16_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S16, data, n, false)
+#define msgpack_write_s32_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S32, data, n, false)
+#define msgpack_write_s64_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S64, data, n, false)
+#define msgpack_write_float_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_SINGLE, data, n, false)
+#define msgpack_write_double_array(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_DOUBLE, data, n, false)
+
+#define msgpack_write_u8_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U8, data, n, true)
+#define msgpack_write_u16_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U16, data, n, true)
+#define msgpack_write_u32_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U32, data, n, true)
+#define msgpack_write_u64_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_U64, data, n, true)
+#define msgpack_write_s8_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S8, data, n, true)
+#define msgpack_write_s16_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S16, data, n, true)
+#define msgpack_write_s32_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S32, data, n, true)
+#define msgpack_write_s64_array_compact(mbuf, data, n) \
+  msgpack_write_typed_array(mbuf, MSGPACK_TYPE_S64, data, n, true)
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Read an array of integers of any encoding into data, whose room is *len
+ * elements. Runs of fixints are widened 16 at a time with SSE2 when it is
+ * available. On success *len is the number of elements. An element that is
+ * not an integer, or a uint64 over INT64_MAX, fails with MSGPACK_EUNEXPECTED
+ * and *len is its index; an array longer than *len fails with MSGPACK_ENOBUF
+ * and *len is its length. The position does not change on error, but data
+ * may be partly filled.
+ */
+bool msgpack_unpack_int64_array(msgpack_unpacker_t *up, int64_t *data,
+        uint32_t *len);
+
+/**
+ * msgpack_unpack_int64_array() for an array of floats, doubles and integers,
+ * all read as double.
+ */
+bool msgpack_unpack_double_array(msgpack_unpacker_t *up, double *data,
+        uint32_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Size
+ * The exact encoded size of a value, as msgpack_write_* and msgpack_put_*
+ * write it. The size of a container header leaves out its elements.
+ * @{
+ */
+
+static inline size_t msgpack_sizeof_uinteger(uint64_t val) {
+  return val <= 127 ? 1 : 1 + msgpack_uint_valsize(val);
+}
+
+static inline size_t msgpack_sizeof_integer(int64_t val) {
+  if (val >= 0) {
+    return msgpack_sizeof_uinteger((uint64_t)val);
+  }
+  return val >= -32 ? 1 : 1 + msgpack_sint_valsize(val);
+}
+
+static inline size_t msgpack_sizeof_ext(uint32_t len) {
+  switch (len) {
+    case 1: case 2: case 4: case 8: case 16:
+      return 2 + (size_t)len;
+    default:
+      return 2 + (size_t)len + (len >> 8 == 0 ? 1 : len >> 16 == 0 ? 2 : 4);
+  }
+}
+
+static inline size_t msgpack_sizeof_timestamp(const msgpack_timestamp_t *ts) {
+  if ((uint64_t)ts->sec >> 34 != 0) {
+    return 15;
+  }
+  return (((uint64_t)ts->nsec << 34) | (uint64_t)ts->sec) >> 32 != 0 ? 10 : 6;
+}
+
+#define msgpack_sizeof_nil() ((size_t)1)
+#define msgpack_sizeof_bool(val) ((size_t)1)
+#define msgpack_sizeof_float(val) ((size_t)5)
+#define msgpack_sizeof_double(val) ((size_t)9)
+#define msgpack_sizeof_str(len) \
+  (1 + (size_t)(msgpack_str_lensize(len)) + (size_t)(len))
+#define msgpack_sizeof_bin(len) \
+  (1 + (size_t)(msgpack_bin_lensize(len)) + (size_t)(len))
+#define msgpack_sizeof_arr(len) (1 + (size_t)(msgpack_arr_lensize(len)))
+#define msgpack_sizeof_map(len) (1 + (size_t)(msgpack_map_lensize(len)))
+
+/**
+ * @}
+ */
+
+#if MSGPACK_BUFFER_POOL
+/**
+ * @name Pool
+ * A pool recycles the memory of growable buffers. Blocks come in size
+ * classes, each thread keeps the blocks it frees on its own free lists and
+ * takes from them first. Past MSGPACK_POOL_CACHE_BLOCKS, or from a thread
+ * whose lists hold another pool's blocks, a block goes back to the pool
+ * through a lock-free stack, so a buffer may be released by any thread.
+ * Blocks over the largest class go straight to the allocator.
+ * @{
+ */
+
+typedef struct msgpack_pool msgpack_pool_t;
+typedef struct msgpack_pool_stats msgpack_pool_stats_t;
+
+/* A growable buffer whose memory comes from pool. */
+#define init_msgpack_pool_buffer(mbuf, pool) \
+  init_msgpack_growable_buffer(mbuf, &(pool)->allocator)
+
+/**
+ * Only the allocator calls are counted, so a block moving between buffers
+ * and free lists costs no shared write. allocated is the memory the pool
+ * holds, by its buffers or on free lists, less the block headers.
+ */
+struct msgpack_pool_stats {
+  size_t allocated;
+  size_t high_water; /* the most allocated has been */
+  size_t allocs;     /* blocks taken from the allocator */
+  size_t frees;      /* blocks given back to the allocator */
+};
+
+struct msgpack_pool {
+  struct msgpack_allocator allocator; /* given to the pool's buffers */
+  const struct msgpack_allocator *backing;
+  union msgpack_pool_block *returned[MSGPACK_POOL_CLASSES];
+  struct msgpack_pool_stats stats;
+};
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/* The pool refers to itself, it must not move once initialized. */
+void msgpack_pool_init(msgpack_pool_t *pool, const msgpack_allocator_t *backing);
+
+/**
+ * Give the blocks the calling thread keeps for pool back to it. A thread
+ * must flush before it exits, or its blocks are lost.
+ */
+void msgpack_pool_flush(msgpack_pool_t *pool);
+
+/**
+ * Flush the calling thread and free every block given back to the pool.
+ * Fails with MSGPACK_EINVL when blocks are still out, in buffers not
+ * released or on the lists of other threads that did not flush: those are
+ * not the pool's to free and are left alone.
+ */
+bool msgpack_pool_destroy(msgpack_pool_t *pool);
+
+void msgpack_pool_get_stats(const msgpack_pool_t *pool,
+        msgpack_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+#endif
+
+/**
+ * @name Deferred containers
+ * msgpack_write_arr_begin() and msgpack_write_map_begin() write an ARRAY32
+ * or MAP32 header whose count is patched by msgpack_write_end(), so the
+ * elements can be streamed without counting them first.
+ * @{
+ */
+
+typedef struct msgpack_container msgpack_container_t;
+
+struct msgpack_container {
+  size_t pos; /* the offset of the header in buf */
+  uint8_t tag;
+};
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+bool msgpack_write_arr_begin(msgpack_buffer_t *mbuf, msgpack_container_t *c);
+bool msgpack_write_map_begin(msgpack_buffer_t *mbuf, msgpack_container_t *c);
+
+/**
+ * Patch count, the elements of an array or pairs of a map, into the header
+ * of c. With compact the header is shrunk to the smallest form and what
+ * follows it moves back, unless mbuf->iov already has entries past it.
+ */
+bool msgpack_write_end(msgpack_buffer_t *mbuf, const msgpack_container_t *c,
+        uint32_t count, bool compact);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Validator
+ * msgpack_validate() checks that a whole value is well formed and within
+ * limits before it is decoded, so untrusted input can not make the decode
+ * loops run over huge declared counts. It reads the headers only, once.
+ * @{
+ */
+
+typedef struct msgpack_limits msgpack_limits_t;
+
+/* No limits but a depth of MSGPACK_PARSE_MAX_DEPTH. */
+#define init_msgpack_limits(lim) \
+  do { \
+    (lim)->max_depth = MSGPACK_PARSE_MAX_DEPTH; \
+    (lim)->max_elements = (size_t)-1; \
+    (lim)->max_str = UINT32_MAX; \
+    (lim)->max_size = (size_t)-1; \
+  } while(0)
+
+struct msgpack_limits {
+  /* nesting of non-empty arrays and maps, MSGPACK_PARSE_MAX_DEPTH at most */
+  uint32_t max_depth;
+  size_t max_elements; /* values in all the arrays and maps, keys included */
+  uint32_t max_str; /* bytes of a str, bin or ext payload */
+  size_t max_size; /* bytes of the whole value */
+};
+
+#ifdef  __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Check the value at up->pos and move past it. A value over a limit fails
+ * with MSGPACK_ELIMIT, a bad tag with MSGPACK_EUNKNOWN and a value cut by
+ * the end of the buffer, or a count over the bytes left, with
+ * MSGPACK_EENDBUF. The position does not change on error.
+ */
+bool msgpack_validate(msgpack_unpacker_t *up, const msgpack_limits_t *limits);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
 /**
  * @}
  */
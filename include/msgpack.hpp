@@ -0,0 +1,483 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MSGPACK_HPP
+#define MSGPACK_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
+#include "msgpack.h"
+
+/**
+ * @name C++ wrapper
+ * Header only C++17 packer and unpacker over msgpack_buffer_t and
+ * msgpack_unpacker_t. The encoding of a value is chosen from its C++ type at
+ * compile time: integers only test the ranges their width can reach, so a
+ * uint8_t is a fixint or a U8 and never looks at wider tags. The calls are
+ * inline and return false on error, which is kept in error(). Only the calls
+ * that go through the C functions, such as growing a buffer, timestamps,
+ * views and skip(), also update msgpack_errno().
+ * @{
+ */
+
+namespace msgpack {
+
+struct nil_t {};
+inline constexpr nil_t nil{};
+
+/* A bin payload, pointing into the unpacked buffer when read. */
+struct bin {
+  const void *data;
+  uint32_t size;
+};
+
+struct array_header {
+  uint32_t size;
+};
+
+struct map_header {
+  uint32_t size;
+};
+
+template <class T>
+inline constexpr bool is_integer_v =
+    std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+class packer {
+public:
+  packer(uint8_t *buf, size_t len) {
+    init_msgpack_buffer(&mbuf_, buf, len);
+  }
+
+  explicit packer(const msgpack_allocator_t *allocator) {
+    init_msgpack_growable_buffer(&mbuf_, allocator);
+  }
+
+  ~packer() {
+    if (mbuf_.allocator) {
+      msgpack_buffer_release(&mbuf_);
+    }
+  }
+
+  packer(const packer &) = delete;
+  packer &operator=(const packer &) = delete;
+
+  const uint8_t *data() const { return mbuf_.buf; }
+  size_t size() const { return mbuf_.len; }
+  int error() const { return mbuf_.err; }
+  void clear() { mbuf_.len = 0; }
+  msgpack_buffer_t *buffer() { return &mbuf_; }
+
+  /* Write v in the smallest encoding its type allows. */
+  template <class T>
+  bool pack(const T &v) {
+    if constexpr (std::is_same_v<T, nil_t>) {
+      return put_byte(NIL_TAG);
+    } else if constexpr (std::is_same_v<T, bool>) {
+      return put_byte(v ? TRUE_TAG : FALSE_TAG);
+    } else if constexpr (is_integer_v<T> && std::is_signed_v<T>) {
+      if (v >= 0) {
+        return pack_unsigned(static_cast<std::make_unsigned_t<T>>(v));
+      }
+      return pack_negative(v);
+    } else if constexpr (is_integer_v<T>) {
+      return pack_unsigned(v);
+    } else if constexpr (std::is_same_v<T, float>) {
+      uint32_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      return put_word(FLOAT_TAG, bits, 4);
+    } else if constexpr (std::is_same_v<T, double>) {
+      uint64_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      return put_word(DOUBLE_TAG, bits, 8);
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      std::string_view s(v);
+      if (static_cast<uint64_t>(s.size()) > UINT32_MAX) {
+        return fail(MSGPACK_ELIMIT);
+      }
+      return pack_raw(msgpack_str_type(s.size()), msgpack_str_lensize(s.size()),
+          s.data(), static_cast<uint32_t>(s.size()));
+    } else if constexpr (std::is_same_v<T, bin>) {
+      return pack_raw(msgpack_bin_type(v.size), msgpack_bin_lensize(v.size),
+          v.data, v.size);
+    } else if constexpr (std::is_same_v<T, array_header>) {
+      return pack_raw(msgpack_arr_type(v.size), msgpack_arr_lensize(v.size),
+          nullptr, v.size);
+    } else if constexpr (std::is_same_v<T, map_header>) {
+      return pack_raw(msgpack_map_type(v.size), msgpack_map_lensize(v.size),
+          nullptr, v.size);
+    } else if constexpr (std::is_same_v<T, msgpack_timestamp_t>) {
+      return msgpack_write_timestamp(&mbuf_, &v);
+    } else {
+      static_assert(sizeof(T) == 0, "msgpack::packer can not pack this type");
+    }
+  }
+
+  /* Write an integer in the tag of its exact width, U16 for uint16_t. */
+  template <class T>
+  bool pack_fixed(T v) {
+    static_assert(is_integer_v<T>, "pack_fixed takes integers");
+    constexpr size_t n = sizeof(T);
+    constexpr bool s = std::is_signed_v<T>;
+    constexpr uint8_t tag = n == 1 ? (s ? S8_TAG : U8_TAG) :
+        n == 2 ? (s ? S16_TAG : U16_TAG) :
+        n == 4 ? (s ? S32_TAG : U32_TAG) : (s ? S64_TAG : U64_TAG);
+    return put_word(tag, static_cast<uint64_t>(v), n);
+  }
+
+  template <class T, class... Rest>
+  bool pack(const T &v, const Rest &...rest) {
+    return pack(v) && (pack(rest) && ...);
+  }
+
+private:
+  bool fail(int code) {
+    mbuf_.err = code;
+    return false;
+  }
+
+  bool reserve(size_t n) {
+    return mbuf_.buf && mbuf_.alloc - mbuf_.len >= n ? true :
+        msgpack_reserve(&mbuf_, n);
+  }
+
+  bool put_byte(uint8_t b) {
+    if (!reserve(1)) {
+      return false;
+    }
+    msgpack_put_byte(&mbuf_, b);
+    return true;
+  }
+
+  bool put_word(uint8_t tag, uint64_t v, size_t n) {
+    if (!reserve(1 + n)) {
+      return false;
+    }
+    msgpack_put_word(&mbuf_, tag, v, n);
+    return true;
+  }
+
+  template <class U>
+  bool pack_unsigned(U v) {
+    if (v <= 0x7F) {
+      return put_byte(static_cast<uint8_t>(v));
+    }
+    if constexpr (sizeof(U) == 1) {
+      return put_word(U8_TAG, v, 1);
+    } else {
+      if (v <= UINT8_MAX) {
+        return put_word(U8_TAG, v, 1);
+      }
+      if constexpr (sizeof(U) == 2) {
+        return put_word(U16_TAG, v, 2);
+      } else {
+        if (v <= UINT16_MAX) {
+          return put_word(U16_TAG, v, 2);
+        }
+        if constexpr (sizeof(U) == 4) {
+          return put_word(U32_TAG, v, 4);
+        } else {
+          if (v <= UINT32_MAX) {
+            return put_word(U32_TAG, v, 4);
+          }
+          return put_word(U64_TAG, v, 8);
+        }
+      }
+    }
+  }
+
+  template <class S>
+  bool pack_negative(S v) {
+    const uint64_t bits = static_cast<uint64_t>(static_cast<int64_t>(v));
+    if (v >= -32) {
+      return put_byte(static_cast<uint8_t>(v));
+    }
+    if constexpr (sizeof(S) == 1) {
+      return put_word(S8_TAG, bits, 1);
+    } else {
+      if (v >= INT8_MIN) {
+        return put_word(S8_TAG, bits, 1);
+      }
+      if constexpr (sizeof(S) == 2) {
+        return put_word(S16_TAG, bits, 2);
+      } else {
+        if (v >= INT16_MIN) {
+          return put_word(S16_TAG, bits, 2);
+        }
+        if constexpr (sizeof(S) == 4) {
+          return put_word(S32_TAG, bits, 4);
+        } else {
+          if (v >= INT32_MIN) {
+            return put_word(S32_TAG, bits, 4);
+          }
+          return put_word(S64_TAG, bits, 8);
+        }
+      }
+    }
+  }
+
+  /* Bodies go through msgpack_len_data() when they may be referenced. */
+  bool pack_raw(uint8_t tag, size_t len_size, const void *data, uint32_t len) {
+    if (mbuf_.iov) {
+      return msgpack_len_data(&mbuf_, tag, data, len, len_size);
+    }
+    if (!reserve(1 + len_size + (data ? len : 0))) {
+      return false;
+    }
+    msgpack_put_len_data(&mbuf_, tag, data, len, len_size);
+    return true;
+  }
+
+  msgpack_buffer_t mbuf_;
+};
+
+class unpacker {
+public:
+  unpacker(const uint8_t *buf, size_t len) {
+    init_msgpack_unpacker(&up_, const_cast<uint8_t *>(buf), len, 0);
+  }
+
+  size_t position() const { return up_.pos; }
+  bool at_end() const { return up_.pos >= up_.len; }
+  int error() const { return up_.err; }
+  msgpack_unpacker_t *context() { return &up_; }
+
+  /**
+   * Read the next value into v. A value of another type, or an integer out
+   * of the range of T, fails with MSGPACK_EUNEXPECTED and is not consumed.
+   */
+  template <class T>
+  bool unpack(T &v) {
+    if constexpr (std::is_same_v<T, nil_t>) {
+      if (!head(1)) {
+        return false;
+      }
+      return up_.buf[up_.pos] == NIL_TAG ? consume(1) : unexpected();
+    } else if constexpr (std::is_same_v<T, bool>) {
+      if (!head(1)) {
+        return false;
+      }
+      const uint8_t tag = up_.buf[up_.pos];
+      if (tag != TRUE_TAG && tag != FALSE_TAG) {
+        return unexpected();
+      }
+      v = tag == TRUE_TAG;
+      return consume(1);
+    } else if constexpr (is_integer_v<T>) {
+      return unpack_integer(v);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      return unpack_float(v);
+    } else if constexpr (std::is_same_v<T, std::string_view>) {
+      const uint8_t *data;
+      uint32_t len;
+      if (!unpack_raw(MSGPACK_TYPE_STR, data, len)) {
+        return false;
+      }
+      v = std::string_view(reinterpret_cast<const char *>(data), len);
+      return true;
+    } else if constexpr (std::is_same_v<T, bin>) {
+      const uint8_t *data;
+      if (!unpack_raw(MSGPACK_TYPE_BIN, data, v.size)) {
+        return false;
+      }
+      v.data = data;
+      return true;
+    } else if constexpr (std::is_same_v<T, array_header>) {
+      return unpack_count(FIXARRAY_TAG, ARRAY16_TAG, ARRAY32_TAG, v.size);
+    } else if constexpr (std::is_same_v<T, map_header>) {
+      return unpack_count(FIXMAP_TAG, MAP16_TAG, MAP32_TAG, v.size);
+    } else if constexpr (std::is_same_v<T, msgpack_timestamp_t>) {
+      return msgpack_unpack_timestamp(&up_, &v);
+    } else {
+      static_assert(sizeof(T) == 0, "msgpack::unpacker can not unpack this type");
+    }
+  }
+
+  template <class T, class... Rest>
+  bool unpack(T &v, Rest &...rest) {
+    return unpack(v) && (unpack(rest) && ...);
+  }
+
+  bool skip() { return msgpack_skip(&up_); }
+
+private:
+  bool fail(int code) {
+    up_.err = code;
+    return false;
+  }
+
+  bool unexpected() { return fail(MSGPACK_EUNEXPECTED); }
+
+  bool head(size_t n) {
+    if (!up_.buf) {
+      return fail(MSGPACK_EINIT);
+    }
+    if (up_.pos > up_.len || up_.len - up_.pos < n) {
+      return fail(MSGPACK_EENDBUF);
+    }
+    return true;
+  }
+
+  bool consume(size_t n) {
+    up_.pos += n;
+    up_.err = MSGPACK_EOK;
+    return true;
+  }
+
+  template <class T>
+  bool unpack_integer(T &v) {
+    if (!head(1)) {
+      return false;
+    }
+    const uint8_t *p = up_.buf + up_.pos;
+    uint64_t u = 0;
+    int64_t s = 0;
+    bool neg = false;
+    size_t size = 1;
+
+    if (p[0] <= 0x7F) {
+      u = p[0];
+    } else if (p[0] >= NEG_FIXNUM_TAG) {
+      s = static_cast<int8_t>(p[0]);
+      neg = true;
+    } else {
+      switch (p[0]) {
+        case U8_TAG: size = 2; break;
+        case U16_TAG: size = 3; break;
+        case U32_TAG: size = 5; break;
+        case U64_TAG: size = 9; break;
+        case S8_TAG: size = 2; break;
+        case S16_TAG: size = 3; break;
+        case S32_TAG: size = 5; break;
+        case S64_TAG: size = 9; break;
+        default: return unexpected();
+      }
+      if (!head(size)) {
+        return false;
+      }
+      switch (p[0]) {
+        case U8_TAG: u = p[1]; break;
+        case U16_TAG: u = msgpack_load_be16(p + 1); break;
+        case U32_TAG: u = msgpack_load_be32(p + 1); break;
+        case U64_TAG: u = msgpack_load_be64(p + 1); break;
+        case S8_TAG: s = static_cast<int8_t>(p[1]); break;
+        case S16_TAG: s = static_cast<int16_t>(msgpack_load_be16(p + 1)); break;
+        case S32_TAG: s = static_cast<int32_t>(msgpack_load_be32(p + 1)); break;
+        default: s = static_cast<int64_t>(msgpack_load_be64(p + 1)); break;
+      }
+      if (p[0] >= S8_TAG) {
+        neg = s < 0;
+        u = static_cast<uint64_t>(s);
+      }
+    }
+
+    if (neg) {
+      if constexpr (std::is_unsigned_v<T>) {
+        return unexpected();
+      } else {
+        if (s < static_cast<int64_t>(std::numeric_limits<T>::min())) {
+          return unexpected();
+        }
+        v = static_cast<T>(s);
+      }
+    } else {
+      if (u > static_cast<uint64_t>(std::numeric_limits<T>::max())) {
+        return unexpected();
+      }
+      v = static_cast<T>(u);
+    }
+    return consume(size);
+  }
+
+  template <class T>
+  bool unpack_float(T &v) {
+    if (!head(1)) {
+      return false;
+    }
+    const uint8_t *p = up_.buf + up_.pos;
+    if (p[0] == FLOAT_TAG) {
+      if (!head(5)) {
+        return false;
+      }
+      const uint32_t bits = msgpack_load_be32(p + 1);
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      v = static_cast<T>(f);
+      return consume(5);
+    }
+    if (p[0] == DOUBLE_TAG) {
+      if (!head(9)) {
+        return false;
+      }
+      const uint64_t bits = msgpack_load_be64(p + 1);
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      v = static_cast<T>(d);
+      return consume(9);
+    }
+    return unexpected();
+  }
+
+  bool unpack_raw(uint8_t type, const uint8_t *&data, uint32_t &len) {
+    return msgpack_unpack_view(&up_, &data, &len, &type);
+  }
+
+  bool unpack_count(uint8_t fix, uint8_t tag16, uint8_t tag32, uint32_t &n) {
+    if (!head(1)) {
+      return false;
+    }
+    const uint8_t *p = up_.buf + up_.pos;
+    if ((p[0] & 0xF0) == fix) {
+      n = p[0] & 0x0F;
+      return consume(1);
+    }
+    if (p[0] == tag16) {
+      if (!head(3)) {
+        return false;
+      }
+      n = msgpack_load_be16(p + 1);
+      return consume(3);
+    }
+    if (p[0] == tag32) {
+      if (!head(5)) {
+        return false;
+      }
+      n = msgpack_load_be32(p + 1);
+      return consume(5);
+    }
+    return unexpected();
+  }
+
+  msgpack_unpacker_t up_;
+};
+
+} // namespace msgpack
+
+/**
+ * @}
+ */
+
+#endif
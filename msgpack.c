@@ -23,19 +23,43 @@
 #include <string.h>
 
 #include "msgpack.h"
+#if MSGPACK_STDLIB_ALLOCATOR
+#include <stdlib.h>
+#endif
+#if MSGPACK_SIMD && defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define MSGPACK_SCAN_AVX2 1
+#elif MSGPACK_SIMD && defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define MSGPACK_SCAN_SSE2 1
+#endif
 
 #define FIX_TAG_MASK 0xC0
 #define FIX_TAG      0x80 /* (FIXMAP_TAG || FIXARRAY_TAG || FIXSTR_TAG) */
-#define FIXSTR_TAG_MASK 0xE0
 
-static int g_errno = 0;
+#if MSGPACK_THREAD_LOCAL_ERRNO && defined(MSGPACK_THREAD_LOCAL)
+#define MSGPACK_TLS MSGPACK_THREAD_LOCAL
+#else
+#define MSGPACK_TLS
+#endif
+
+static MSGPACK_TLS int g_errno = 0;
 
 inline int msgpack_errno(void) {
   return g_errno;
 }
 
-static void set_errno(int errno) {
-  g_errno = errno;
+/**
+ * Record code in the context (err may be NULL) and in the per thread errno.
+ * The errno is only stored when it changes, the common success path reads it.
+ */
+static void set_errno(int *err, int code) {
+  if (err) {
+    *err = code;
+  }
+  if (g_errno != code) {
+    g_errno = code;
+  }
 }
 
 #if !MSGPACK_SIZE_OPT
@@ -47,6 +71,8 @@ const char *g_errmsgs[MSGPACK_EMAX] = {
   "No Initial",
   "Reach the buffer end",
   "Read a unexpect type",
+  "Exceed a limit",
+  "Invalid UTF-8",
 };
 
 const char *msgpack_errmsg(void) {
@@ -55,25 +81,126 @@ const char *msgpack_errmsg(void) {
 #endif
 
 #define type_mask(t) (0xF0 & (t))
-static const int32_t _i = 1;
-#define is_bigendian() ((*(char *)&_i) == 0)
+
+#if MSGPACK_STDLIB_ALLOCATOR
+static void *msgpack_stdlib_realloc(void *ud, void *ptr, size_t size) {
+  (void)ud;
+  return realloc(ptr, size);
+}
+
+static void msgpack_stdlib_free(void *ud, void *ptr) {
+  (void)ud;
+  free(ptr);
+}
+
+const struct msgpack_allocator msgpack_stdlib_allocator = {
+  msgpack_stdlib_realloc,
+  msgpack_stdlib_free,
+  NULL,
+};
+#endif
+
+void msgpack_buffer_release(struct msgpack_buffer *mbuf) {
+  if (!mbuf || !mbuf->allocator) {
+    return;
+  }
+
+  if (mbuf->buf && mbuf->allocator->free) {
+    mbuf->allocator->free(mbuf->allocator->ud, mbuf->buf);
+  }
+  mbuf->buf = NULL;
+  mbuf->len = 0;
+  mbuf->alloc = 0;
+}
+
+/* Grow by half of the current size, so appending n bytes costs O(n). */
+static bool msgpack_buffer_grow(struct msgpack_buffer *mbuf, size_t need) {
+  size_t alloc;
+  uint8_t *buf;
+
+  if (!mbuf->allocator || !mbuf->allocator->realloc) {
+    set_errno(&mbuf->err, MSGPACK_ENOBUF);
+    return false;
+  }
+
+  alloc = mbuf->alloc + (mbuf->alloc >> 1);
+  if (alloc < MSGPACK_BUFFER_MIN_ALLOC) {
+    alloc = MSGPACK_BUFFER_MIN_ALLOC;
+  }
+  if (alloc < need) {
+    alloc = need;
+  }
+
+  buf = (uint8_t *)mbuf->allocator->realloc(mbuf->allocator->ud, mbuf->buf,
+          alloc);
+  if (!buf) {
+    set_errno(&mbuf->err, MSGPACK_ENOBUF);
+    return false;
+  }
+  mbuf->buf = buf;
+  mbuf->alloc = alloc;
+  return true;
+}
+
+/* Make sure that size more bytes can be written at mbuf->len. */
+static bool msgpack_buffer_ensure(struct msgpack_buffer *mbuf, size_t size) {
+  if (!mbuf->buf && !mbuf->allocator) {
+    set_errno(&mbuf->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  if (mbuf->alloc - mbuf->len >= size) {
+    return true;
+  }
+
+  if (size > (size_t)-1 - mbuf->len) {
+    set_errno(&mbuf->err, MSGPACK_ENOBUF);
+    return false;
+  }
+  return msgpack_buffer_grow(mbuf, mbuf->len + size);
+}
+
+bool msgpack_reserve(struct msgpack_buffer *mbuf, size_t size) {
+  if (!mbuf) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_buffer_counting(mbuf) && !msgpack_buffer_ensure(mbuf, size)) {
+    return false;
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  return true;
+}
+
+/* A counter only adds up the size of what would be written. */
+static bool msgpack_buffer_count(struct msgpack_buffer *mbuf, size_t size) {
+  if (size > (size_t)-1 - mbuf->len) {
+    set_errno(&mbuf->err, MSGPACK_ENOBUF);
+    return false;
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  mbuf->len += size;
+  return true;
+}
 
 bool msgpack_byte(struct msgpack_buffer *mbuf, uint8_t data) {
   if (!mbuf) {
-    set_errno(MSGPACK_EINVL);
+    set_errno(NULL, MSGPACK_EINVL);
     goto error;
   }
 
-  if (!mbuf->buf) {
-    set_errno(MSGPACK_EINIT);
-    goto error;
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, 1);
   }
 
-  set_errno(MSGPACK_EOK);
-  if (mbuf->alloc <= mbuf->len) {
-    set_errno(MSGPACK_ENOBUF);
+  if (!msgpack_buffer_ensure(mbuf, 1)) {
     goto error;
   }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
   mbuf->buf[mbuf->len++] = data;
   return true;
 
@@ -81,33 +208,60 @@ error:
   return false;
 }
 
+/* Copy a len bytes number, converting between host and big endian order. */
 static void msgpack_endiancpy(void *buffer, const void *data, size_t len) {
-  int i;
-  if (is_bigendian()) {
-    memcpy(buffer, data, len);
-  }
-  for (i = len - 1; i >= 0; --i) {
-    ((uint8_t *)buffer)[len - i - 1] = ((uint8_t *)data)[i];
+  uint16_t v16;
+  uint32_t v32;
+  uint64_t v64;
+  size_t i;
+
+  switch (len) {
+    case 1:
+      *(uint8_t *)buffer = *(const uint8_t *)data;
+      break;
+    case 2:
+      memcpy(&v16, data, 2);
+      v16 = msgpack_be16(v16);
+      memcpy(buffer, &v16, 2);
+      break;
+    case 4:
+      memcpy(&v32, data, 4);
+      v32 = msgpack_be32(v32);
+      memcpy(buffer, &v32, 4);
+      break;
+    case 8:
+      memcpy(&v64, data, 8);
+      v64 = msgpack_be64(v64);
+      memcpy(buffer, &v64, 8);
+      break;
+    default:
+#if MSGPACK_BIG_ENDIAN
+      memcpy(buffer, data, len);
+#else
+      for (i = 0; i < len; ++i) {
+        ((uint8_t *)buffer)[i] = ((const uint8_t *)data)[len - i - 1];
+      }
+#endif
+      break;
   }
 }
 
 bool msgpack_data(struct msgpack_buffer *mbuf, uint8_t type,
         const void *data, size_t len) {
   if (!mbuf || !data || len == 0) {
-    set_errno(MSGPACK_EINVL);
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
     goto error;
   }
 
-  if (!mbuf->buf) {
-    set_errno(MSGPACK_EINIT);
-    goto error;
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, 1 + len);
   }
 
-  set_errno(MSGPACK_EOK);
-  if (mbuf->alloc <= mbuf->len + len) {
-    set_errno(MSGPACK_ENOBUF);
+  if (!msgpack_buffer_ensure(mbuf, 1 + len)) {
     goto error;
   }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
   mbuf->buf[mbuf->len++] = type;
   msgpack_endiancpy(mbuf->buf + mbuf->len, data, len);
   mbuf->len += len;
@@ -117,39 +271,101 @@ error:
   return false;
 }
 
+/**
+ * Entries for bytes of buf keep a NULL iov_base until msgpack_iovec_finish(),
+ * because a growable buffer may still move.
+ */
+static void msgpack_iovec_add(struct msgpack_iovec_list *l, size_t len,
+        const void *data) {
+  l->iov[l->cnt].iov_base = (void *)data;
+  l->iov[l->cnt].iov_len = len;
+  l->cnt++;
+}
+
+/* Reference data when it is large and there is room for its entries. */
+static bool msgpack_iovec_can_ref(const struct msgpack_iovec_list *l,
+        uint32_t len) {
+  /* the bytes before data, data and the tail at finish */
+  return l && len > 0 && len >= l->threshold && l->cnt + 3 <= l->alloc;
+}
+
+static void msgpack_iovec_ref(struct msgpack_buffer *mbuf, const void *data,
+        uint32_t len) {
+  struct msgpack_iovec_list *l = mbuf->iov;
+
+  if (mbuf->len > l->mark) {
+    msgpack_iovec_add(l, mbuf->len - l->mark, NULL);
+    l->mark = mbuf->len;
+  }
+  msgpack_iovec_add(l, len, data);
+}
+
+bool msgpack_iovec_finish(struct msgpack_buffer *mbuf) {
+  struct msgpack_iovec_list *l;
+  size_t off = 0;
+  size_t i;
+
+  if (!mbuf || !mbuf->iov) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  l = mbuf->iov;
+  if (mbuf->len > l->mark) {
+    if (l->cnt >= l->alloc) {
+      set_errno(&mbuf->err, MSGPACK_ENOBUF);
+      return false;
+    }
+    msgpack_iovec_add(l, mbuf->len - l->mark, NULL);
+    l->mark = mbuf->len;
+  }
+
+  for (i = 0; i < l->cnt; ++i) {
+    if (!l->iov[i].iov_base) {
+      l->iov[i].iov_base = mbuf->buf + off;
+      off += l->iov[i].iov_len;
+    }
+  }
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  return true;
+}
+
 bool msgpack_len_data(struct msgpack_buffer *mbuf, uint8_t type, const void *data,
         uint32_t len, size_t len_size) {
-  int i;
-  int index;
+  uint8_t *p;
+  bool ref;
 
-  if (!mbuf) {
-    set_errno(MSGPACK_EINVL);
+  if (!mbuf || len_size == 3 || len_size > 4) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
     goto error;
   }
 
-  if (!mbuf->buf) {
-    set_errno(MSGPACK_EINIT);
-    goto error;
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, 1 + len_size + (data ? len : 0));
   }
 
-  set_errno(MSGPACK_EOK);
-  if (mbuf->alloc <= mbuf->len + len_size + (data ? len : 0)) {
-    set_errno(MSGPACK_ENOBUF);
+  ref = data && msgpack_iovec_can_ref(mbuf->iov, len);
+  if (!msgpack_buffer_ensure(mbuf, 1 + len_size + (data && !ref ? len : 0))) {
     goto error;
   }
 
+  set_errno(&mbuf->err, MSGPACK_EOK);
+
   if ((type & FIX_TAG_MASK) == FIX_TAG) {
     type |= (uint8_t)len;
   }
-  mbuf->buf[mbuf->len++] = type;
-  for (i = 0; i < len_size; ++i) {
-    index = len_size - i - 1;
-    if (is_bigendian()) {
-      index = i;
-    }
-    mbuf->buf[mbuf->len++] = ((uint8_t *)&len)[index];
+  p = mbuf->buf + mbuf->len;
+  *p++ = type;
+  switch (len_size) {
+    case 0: break;
+    case 1: *p = (uint8_t)len; break;
+    case 2: msgpack_store_be16(p, (uint16_t)len); break;
+    default: msgpack_store_be32(p, len); break;
   }
-  if (data) {
+  mbuf->len += 1 + len_size;
+  if (ref) {
+    msgpack_iovec_ref(mbuf, data, len);
+  } else if (data) {
     memcpy(mbuf->buf + mbuf->len, data, len);
     mbuf->len += len;
   }
@@ -159,28 +375,325 @@ error:
   return false;
 }
 
+/* Write type and the low len bytes of data in big endian. */
+static bool msgpack_data_word(struct msgpack_buffer *mbuf, uint8_t type,
+        uint64_t data, size_t len) {
+  uint8_t *p;
+
+  if (!mbuf || (len != 1 && len != 2 && len != 4 && len != 8)) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    goto error;
+  }
+
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, 1 + len);
+  }
+
+  if (!msgpack_buffer_ensure(mbuf, 1 + len)) {
+    goto error;
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  p = mbuf->buf + mbuf->len;
+  *p++ = type;
+  switch (len) {
+    case 1: *p = (uint8_t)data; break;
+    case 2: msgpack_store_be16(p, (uint16_t)data); break;
+    case 4: msgpack_store_be32(p, (uint32_t)data); break;
+    default: msgpack_store_be64(p, data); break;
+  }
+  mbuf->len += 1 + len;
+  return true;
+
+error:
+  return false;
+}
+
 bool msgpack_data_uinteger(struct msgpack_buffer *mbuf, uint8_t type,
         const uint64_t data, size_t len) {
-  uint64_t temp = data;
-  return msgpack_data(mbuf, type, &temp, len);
+  return msgpack_data_word(mbuf, type, data, len);
 }
 
 bool msgpack_data_sinteger(struct msgpack_buffer *mbuf, uint8_t type,
         const int64_t data, size_t len) {
-  int64_t temp = data;
-  return msgpack_data(mbuf, type, &temp, len);
+  return msgpack_data_word(mbuf, type, (uint64_t)data, len);
 }
 
 bool msgpack_data_float(struct msgpack_buffer *mbuf, uint8_t type,
         const float data, size_t len) {
-  float temp = data;
-  return msgpack_data(mbuf, type, &temp, len);
+  uint32_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  return msgpack_data_word(mbuf, type, bits, len);
 }
 
 bool msgpack_data_double(struct msgpack_buffer *mbuf, uint8_t type,
         const double data, size_t len) {
-  double temp = data;
-  return msgpack_data(mbuf, type, &temp, len);
+  uint64_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  return msgpack_data_word(mbuf, type, bits, len);
+}
+
+bool msgpack_write_ext(struct msgpack_buffer *mbuf, int8_t ext_type,
+        const void *data, uint32_t len) {
+  uint8_t *p;
+  uint8_t tag;
+  size_t len_size = 0;
+  bool ref;
+
+  if (!mbuf || (!data && len > 0)) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    goto error;
+  }
+
+  switch (len) {
+    case 1: tag = FIXEXT1_TAG; break;
+    case 2: tag = FIXEXT2_TAG; break;
+    case 4: tag = FIXEXT4_TAG; break;
+    case 8: tag = FIXEXT8_TAG; break;
+    case 16: tag = FIXEXT16_TAG; break;
+    default:
+      if (len >> 8 == 0) {
+        tag = EXT8_TAG;
+        len_size = 1;
+      } else if (len >> 16 == 0) {
+        tag = EXT16_TAG;
+        len_size = 2;
+      } else {
+        tag = EXT32_TAG;
+        len_size = 4;
+      }
+      break;
+  }
+
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, 2 + len_size + (size_t)len);
+  }
+
+  ref = msgpack_iovec_can_ref(mbuf->iov, len);
+  if (!msgpack_buffer_ensure(mbuf, 2 + len_size + (ref ? 0 : len))) {
+    goto error;
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  p = mbuf->buf + mbuf->len;
+  *p++ = tag;
+  switch (len_size) {
+    case 0: break;
+    case 1: *p = (uint8_t)len; break;
+    case 2: msgpack_store_be16(p, (uint16_t)len); break;
+    default: msgpack_store_be32(p, len); break;
+  }
+  p[len_size] = (uint8_t)ext_type;
+  mbuf->len += 2 + len_size;
+  if (ref) {
+    msgpack_iovec_ref(mbuf, data, len);
+  } else if (len > 0) {
+    memcpy(mbuf->buf + mbuf->len, data, len);
+    mbuf->len += len;
+  }
+  return true;
+
+error:
+  return false;
+}
+
+/**
+ * timestamp 32: seconds in [0, 2^32)
+ * timestamp 64: 30 bits of nanoseconds, 34 bits of seconds in [0, 2^34)
+ * timestamp 96: 32 bits of nanoseconds, signed 64 bits of seconds
+ */
+bool msgpack_write_timestamp(struct msgpack_buffer *mbuf,
+        const struct msgpack_timestamp *ts) {
+  uint8_t *p;
+  uint64_t word;
+  size_t size;
+
+  if (!mbuf || !ts || ts->nsec >= 1000000000u) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    goto error;
+  }
+
+  word = ((uint64_t)ts->nsec << 34) | (uint64_t)ts->sec;
+  if ((uint64_t)ts->sec >> 34 != 0) {
+    size = 15;
+  } else if (word >> 32 != 0) {
+    size = 10;
+  } else {
+    size = 6;
+  }
+
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, size);
+  }
+
+  if (!msgpack_buffer_ensure(mbuf, size)) {
+    goto error;
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  p = mbuf->buf + mbuf->len;
+  switch (size) {
+    case 6:
+      p[0] = FIXEXT4_TAG;
+      p[1] = (uint8_t)MSGPACK_EXT_TIMESTAMP;
+      msgpack_store_be32(p + 2, (uint32_t)word);
+      break;
+    case 10:
+      p[0] = FIXEXT8_TAG;
+      p[1] = (uint8_t)MSGPACK_EXT_TIMESTAMP;
+      msgpack_store_be64(p + 2, word);
+      break;
+    default:
+      p[0] = EXT8_TAG;
+      p[1] = 12;
+      p[2] = (uint8_t)MSGPACK_EXT_TIMESTAMP;
+      msgpack_store_be32(p + 3, ts->nsec);
+      msgpack_store_be64(p + 7, (uint64_t)ts->sec);
+      break;
+  }
+  mbuf->len += size;
+  return true;
+
+error:
+  return false;
+}
+
+/**
+ * @name Tag table
+ * What the reader needs to know about each head byte, so every reader path
+ * decodes a tag with one lookup instead of mask tests and a switch.
+ * @{
+ */
+
+#define TAG_BAD     0x01 /* never used by the spec */
+#define TAG_INLINE  0x02 /* the value is the tag itself: fixint and bool */
+#define TAG_ENDIAN  0x04 /* a big endian number of size bytes follows */
+#define TAG_COUNT   0x08 /* array or map, the length is the number of values */
+#define TAG_PAIRS   0x10 /* map, every entry counts as two values */
+#define TAG_EXT     0x20 /* an ext type byte follows the length */
+#define TAG_SINGLE  0x40 /* the tag is the whole value: fixint, nil, bool, "" */
+
+struct msgpack_tag {
+  uint8_t type;     /* MSGPACK_TYPE_* */
+  uint8_t len_size; /* bytes of the length following the tag, 0 if fixed */
+  uint8_t size;     /* the fixed payload size, or the length of a fix tag */
+  uint8_t flags;
+};
+
+#define T_POS          { MSGPACK_TYPE_U8, 0, 1, TAG_INLINE | TAG_SINGLE }
+#define T_NEG          { MSGPACK_TYPE_S8, 0, 1, TAG_INLINE | TAG_SINGLE }
+#define T_FIXMAP(n)    { MSGPACK_TYPE_MAP, 0, (n), TAG_COUNT | TAG_PAIRS }
+#define T_FIXARR(n)    { MSGPACK_TYPE_ARRAY, 0, (n), TAG_COUNT }
+#define T_FIXSTR(n)    { MSGPACK_TYPE_STR, 0, (n), (n) ? 0 : TAG_SINGLE }
+#define T_NUM(t, n)    { (t), 0, (n), TAG_ENDIAN }
+#define T_RAW(t, l)    { (t), (l), 0, 0 }
+#define T_EXT(l)       { MSGPACK_TYPE_EXT, (l), 0, TAG_EXT }
+#define T_FIXEXT(n)    { MSGPACK_TYPE_EXT, 0, (n), TAG_EXT }
+#define T_ARR(l)       { MSGPACK_TYPE_ARRAY, (l), 0, TAG_COUNT }
+#define T_MAP(l)       { MSGPACK_TYPE_MAP, (l), 0, TAG_COUNT | TAG_PAIRS }
+#define T_BAD          { MSGPACK_TYPE_ANY, 0, 0, TAG_BAD }
+
+#define T_REP16(t) t, t, t, t, t, t, t, t, t, t, t, t, t, t, t, t
+#define T_SEQ16(m, b) \
+  m((b) + 0), m((b) + 1), m((b) + 2), m((b) + 3), \
+  m((b) + 4), m((b) + 5), m((b) + 6), m((b) + 7), \
+  m((b) + 8), m((b) + 9), m((b) + 10), m((b) + 11), \
+  m((b) + 12), m((b) + 13), m((b) + 14), m((b) + 15)
+
+static const struct msgpack_tag msgpack_tags[256] = {
+  /* 0x00 ~ 0x7f */
+  T_REP16(T_POS), T_REP16(T_POS), T_REP16(T_POS), T_REP16(T_POS),
+  T_REP16(T_POS), T_REP16(T_POS), T_REP16(T_POS), T_REP16(T_POS),
+  /* 0x80 ~ 0xbf */
+  T_SEQ16(T_FIXMAP, 0), T_SEQ16(T_FIXARR, 0),
+  T_SEQ16(T_FIXSTR, 0), T_SEQ16(T_FIXSTR, 16),
+  /* 0xc0 ~ 0xcf */
+  { MSGPACK_TYPE_NIL, 0, 0, TAG_SINGLE }, /* NIL_TAG */
+  T_BAD,                                  /* 0xc1 */
+  { MSGPACK_TYPE_BOOL, 0, 1, TAG_INLINE | TAG_SINGLE },
+  { MSGPACK_TYPE_BOOL, 0, 1, TAG_INLINE | TAG_SINGLE },
+  T_RAW(MSGPACK_TYPE_BIN, 1),
+  T_RAW(MSGPACK_TYPE_BIN, 2),
+  T_RAW(MSGPACK_TYPE_BIN, 4),
+  T_EXT(1),
+  T_EXT(2),
+  T_EXT(4),
+  T_NUM(MSGPACK_TYPE_SINGLE, 4),
+  T_NUM(MSGPACK_TYPE_DOUBLE, 8),
+  T_NUM(MSGPACK_TYPE_U8, 1),
+  T_NUM(MSGPACK_TYPE_U16, 2),
+  T_NUM(MSGPACK_TYPE_U32, 4),
+  T_NUM(MSGPACK_TYPE_U64, 8),
+  /* 0xd0 ~ 0xdf */
+  T_NUM(MSGPACK_TYPE_S8, 1),
+  T_NUM(MSGPACK_TYPE_S16, 2),
+  T_NUM(MSGPACK_TYPE_S32, 4),
+  T_NUM(MSGPACK_TYPE_S64, 8),
+  T_FIXEXT(1),
+  T_FIXEXT(2),
+  T_FIXEXT(4),
+  T_FIXEXT(8),
+  T_FIXEXT(16),
+  T_RAW(MSGPACK_TYPE_STR, 1),
+  T_RAW(MSGPACK_TYPE_STR, 2),
+  T_RAW(MSGPACK_TYPE_STR, 4),
+  T_ARR(2),
+  T_ARR(4),
+  T_MAP(2),
+  T_MAP(4),
+  /* 0xe0 ~ 0xff */
+  T_REP16(T_NEG), T_REP16(T_NEG),
+};
+
+/**
+ * @}
+ */
+
+/* Read the len_size bytes length at p. */
+static inline uint32_t msgpack_tag_len(const uint8_t *p, size_t len_size) {
+  switch (len_size) {
+    case 1: return *p;
+    case 2: return msgpack_load_be16(p);
+    default: return msgpack_load_be32(p);
+  }
+}
+
+/**
+ * The size of the item at p: the header plus the payload of a scalar, str,
+ * bin or ext, only the header of an array or map. If avail bytes are too few
+ * to read the length, the header size is returned. Returns 0 for a bad tag.
+ */
+static size_t msgpack_item_size(const uint8_t *p, size_t avail) {
+  const struct msgpack_tag *tag = &msgpack_tags[p[0]];
+  size_t head_size;
+
+  if (tag->flags & TAG_BAD) {
+    return 0;
+  }
+
+  head_size = 1 + tag->len_size + ((tag->flags & TAG_EXT) ? 1 : 0);
+  if (tag->flags & (TAG_COUNT | TAG_INLINE)) {
+    return head_size;
+  }
+  if (tag->len_size == 0) {
+    return head_size + tag->size;
+  }
+  if (avail < 1 + (size_t)tag->len_size) {
+    return head_size;
+  }
+  return head_size + msgpack_tag_len(p + 1, tag->len_size);
+}
+
+/* The number of values in the array or map whose header is at p. */
+static uint64_t msgpack_item_children(const uint8_t *p) {
+  const struct msgpack_tag *tag = &msgpack_tags[p[0]];
+  uint64_t count;
+
+  if (!(tag->flags & TAG_COUNT)) {
+    return 0;
+  }
+  count = tag->len_size ? msgpack_tag_len(p + 1, tag->len_size) : tag->size;
+  return (tag->flags & TAG_PAIRS) ? count * 2 : count;
 }
 
 static inline uint8_t msgpack_read_byte(struct msgpack_unpacker *up) {
@@ -189,7 +702,7 @@ static inline uint8_t msgpack_read_byte(struct msgpack_unpacker *up) {
 
 static bool msgpack_read(struct msgpack_unpacker *up, void *data, size_t len) {
   if (up->pos + len > up->len) {
-    set_errno(MSGPACK_EENDBUF);
+    set_errno(&up->err, MSGPACK_EENDBUF);
     return false;
   }
 
@@ -200,28 +713,20 @@ static bool msgpack_read(struct msgpack_unpacker *up, void *data, size_t len) {
 
 static bool msgpack_read_len(struct msgpack_unpacker *up, uint32_t *len,
         size_t len_size) {
-  int i;
-  int index;
-
   if (up->pos + len_size > up->len) {
-    set_errno(MSGPACK_EENDBUF);
+    set_errno(&up->err, MSGPACK_EENDBUF);
     return false;
   }
 
-  for (i = 0; i < len_size; ++i) {
-    index = len_size - i - 1;
-    if (is_bigendian()) {
-      index = i;
-    }
-    ((uint8_t *)len)[index] = up->buf[up->pos++];
-  }
+  *len = msgpack_tag_len(up->buf + up->pos, len_size);
+  up->pos += len_size;
   return true;
 }
 
 static bool msgpack_read_endian(struct msgpack_unpacker *up,
         void *data, size_t len) {
   if (up->pos + len > up->len) {
-    set_errno(MSGPACK_EENDBUF);
+    set_errno(&up->err, MSGPACK_EENDBUF);
     return false;
   }
 
@@ -230,42 +735,123 @@ static bool msgpack_read_endian(struct msgpack_unpacker *up,
   return true;
 }
 
+/**
+ * UTF-8 DFA after Bjoern Hoehrmann: the first 256 entries map a byte to its
+ * class, the rest map a state plus a class to the next state.
+ */
+#define MSGPACK_UTF8_ACCEPT 0
+#define MSGPACK_UTF8_REJECT 12
+
+static const uint8_t msgpack_utf8d[] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3,
+  11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+  0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72,
+  12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+  12, 0, 12, 12, 12, 12, 12, 0, 12, 0, 12, 12,
+  12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12,
+  12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12,
+  12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12,
+  12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+  12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+  12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+};
+
+#if MSGPACK_SCAN_AVX2 || MSGPACK_SCAN_SSE2
+/* The leading blocks of 16 bytes of p that are all ASCII. */
+static size_t msgpack_ascii_span(const uint8_t *p, size_t n) {
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)))) {
+      break;
+    }
+  }
+  return i;
+}
+#else
+/* The leading words of p that are all ASCII. */
+static size_t msgpack_ascii_span(const uint8_t *p, size_t n) {
+  size_t i = 0;
+  uint64_t w;
+
+  for (; i + sizeof(w) <= n; i += sizeof(w)) {
+    memcpy(&w, p + i, sizeof(w));
+    if (w & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+  return i;
+}
+#endif
+
+bool msgpack_utf8_valid(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t state = MSGPACK_UTF8_ACCEPT;
+  size_t i = 0;
+
+  while (i < len) {
+    if (state == MSGPACK_UTF8_ACCEPT) {
+      i += msgpack_ascii_span(p + i, len - i);
+      if (i >= len) {
+        break;
+      }
+    }
+    state = msgpack_utf8d[256 + state + msgpack_utf8d[p[i++]]];
+    if (state == MSGPACK_UTF8_REJECT) {
+      return false;
+    }
+  }
+  return state == MSGPACK_UTF8_ACCEPT;
+}
+
 bool msgpack_unpack(struct msgpack_unpacker *up, void *data, uint32_t *data_len,
         uint8_t *type) {
+  const struct msgpack_tag *tag;
   uint8_t head;
   uint32_t len = 0;
-  bool has_len;
-  size_t len_size;
-  bool endian;
-  bool len_ok = false;
   uint8_t m_type = MSGPACK_TYPE_ANY;
   size_t read = 0;
   bool ret;
 
   if (!up || !type) {
-    set_errno(MSGPACK_EINVL);
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
     goto error;
   }
 
   if (!up->buf) {
-    set_errno(MSGPACK_EINIT);
+    set_errno(&up->err, MSGPACK_EINIT);
     goto error;
   }
 
   if (up->pos >= up->len) {
-    set_errno(MSGPACK_EENDBUF);
+    set_errno(&up->err, MSGPACK_EENDBUF);
     goto error;
   }
 
-  set_errno(MSGPACK_EOK);
+  set_errno(&up->err, MSGPACK_EOK);
   head = msgpack_read_byte(up);
   read++;
+  tag = &msgpack_tags[head];
+  m_type = tag->type;
 
   /* If the byte is NIL, data and data_len can be NULL. */
-  if (head == NIL_TAG) {
-    m_type = MSGPACK_TYPE_NIL;
+  if (m_type == MSGPACK_TYPE_NIL) {
     if (*type != MSGPACK_TYPE_ANY && type_mask(*type) != type_mask(m_type)) {
-      set_errno(MSGPACK_EUNEXPECTED);
+      set_errno(&up->err, MSGPACK_EUNEXPECTED);
       goto error;
     }
     goto exit;
@@ -279,31 +865,28 @@ bool msgpack_unpack(struct msgpack_unpacker *up, void *data, uint32_t *data_len,
    * 3. data_len = NULL or *data_len < 1, is invalid parameters.
    */
   if (!data_len || (data && *data_len < 1)) {
-    set_errno(MSGPACK_EINVL);
+    set_errno(&up->err, MSGPACK_EINVL);
     goto error;
   }
 
-  if ((head & FIXSTR_TAG_MASK) == FIXSTR_TAG) {
-    len = head & 0x1F;
-    head = FIXSTR_TAG;
-  } else if ((head & FIX_TAG_MASK) == FIX_TAG) {
-    len = head & 0x0F;
-    head = head & 0xF0;
-  } else if ((head & 0x80) == POS_FIXNUM_TAG) { /* positive fixnum */
-    m_type = MSGPACK_TYPE_U8;
-    goto read_head_data;
-  } else if ((head & 0xE0) == NEG_FIXNUM_TAG) { /* negative fixnum */
-    m_type = MSGPACK_TYPE_S8;
-    goto read_head_data;
-  } else if (head == FALSE_TAG || head == TRUE_TAG) {
-    m_type = MSGPACK_TYPE_BOOL;
-    head = (head == TRUE_TAG) ? (uint8_t)true : (uint8_t)false;
-read_head_data:
-    if (*type != MSGPACK_TYPE_ANY && type_mask(*type) != type_mask(m_type)) {
-      set_errno(MSGPACK_EUNEXPECTED);
-      goto error;
-    }
+  if (tag->flags & TAG_BAD) {
+    set_errno(&up->err, MSGPACK_EUNKNOWN);
+    goto error;
+  }
+
+  /* An ext would lose its type id, msgpack_unpack_ext() reads it. */
+  if ((tag->flags & TAG_EXT) ||
+      (*type != MSGPACK_TYPE_ANY && type_mask(*type) != type_mask(m_type))) {
+    set_errno(&up->err, MSGPACK_EUNEXPECTED);
+    goto error;
+  }
+
+  /* fixnum and bool, the value is the head byte. */
+  if (tag->flags & TAG_INLINE) {
     len = 1;
+    if (m_type == MSGPACK_TYPE_BOOL) {
+      head = (head == TRUE_TAG) ? (uint8_t)true : (uint8_t)false;
+    }
     if (data) {
       *((uint8_t *)data) = head;
     } else {
@@ -312,75 +895,16 @@ read_head_data:
     goto exit;
   }
 
-  has_len = false;
-  endian = false;
-  switch (head) {
-    case FIXMAP_TAG: goto map_break;
-    case FIXARRAY_TAG: goto arr_break;
-    case FIXSTR_TAG: goto str_break;
-    case BIN8_TAG: len_size = 1; goto bin_break;
-    case BIN16_TAG: len_size = 2; goto bin_break;
-    case BIN32_TAG: len_size = 4; goto bin_break;
-bin_break:
-      has_len = true;
-      m_type = MSGPACK_TYPE_BIN;
-      break;
-    // case EXT8_TAG:
-    // case EXT16_TAG:
-    // case EXT32_TAG:
-    case FLOAT_TAG: m_type = MSGPACK_TYPE_SINGLE; len = 4; goto endian_break;
-    case DOUBLE_TAG: m_type = MSGPACK_TYPE_DOUBLE; len = 8; goto endian_break;
-    case U8_TAG: m_type = MSGPACK_TYPE_U8; len = 1; goto endian_break;
-    case U16_TAG: m_type = MSGPACK_TYPE_U16; len = 2; goto endian_break;
-    case U32_TAG: m_type = MSGPACK_TYPE_U32; len = 4; goto endian_break;
-    case U64_TAG: m_type = MSGPACK_TYPE_U64; len = 8; goto endian_break;
-    case S8_TAG: m_type = MSGPACK_TYPE_S8; len = 1; goto endian_break;
-    case S16_TAG: m_type = MSGPACK_TYPE_S16; len = 2; goto endian_break;
-    case S32_TAG: m_type = MSGPACK_TYPE_S32; len = 4; goto endian_break;
-    case S64_TAG: m_type = MSGPACK_TYPE_S64; len = 8; goto endian_break;
-endian_break:
-      endian = true;
-      break;
-    // case FIXEXT1_TAG:break;
-    // case FIXEXT2_TAG:break;
-    // case FIXEXT4_TAG:break;
-    // case FIXEXT8_TAG:break;
-    // case FIXEXT16_TAG:break;
-    case STR8_TAG: has_len = true; len_size = 1; goto str_break;
-    case STR16_TAG: has_len = true; len_size = 2; goto str_break;
-    case STR32_TAG: has_len = true; len_size = 4; goto str_break;
-str_break:
-      m_type = MSGPACK_TYPE_STR;
-      break;
-    case ARRAY16_TAG: has_len = true; len_size = 2; goto arr_break;
-    case ARRAY32_TAG: has_len = true; len_size = 4; goto arr_break;
-arr_break:
-      len_ok = true;
-      m_type = MSGPACK_TYPE_ARRAY;
-      break;
-    case MAP16_TAG: has_len = true; len_size = 2; goto map_break;
-    case MAP32_TAG: has_len = true; len_size = 4; goto map_break;
-map_break:
-      len_ok = true;
-      m_type = MSGPACK_TYPE_MAP;
-      break;
-    default: set_errno(MSGPACK_EUNKNOWN); goto error;
-  }
-
-  if (*type != MSGPACK_TYPE_ANY && type_mask(*type) != type_mask(m_type)) {
-    set_errno(MSGPACK_EUNEXPECTED);
-    goto error;
-  }
-
-  if (has_len) {
-    if (!msgpack_read_len(up, &len, len_size)) {
+  len = tag->size;
+  if (tag->len_size) {
+    if (!msgpack_read_len(up, &len, tag->len_size)) {
       goto error;
     }
-    read += len_size;
+    read += tag->len_size;
   }
 
   /* Only read length, case as array and map type. */
-  if (len_ok) {
+  if (tag->flags & TAG_COUNT) {
     goto exit;
   }
 
@@ -391,11 +915,11 @@ map_break:
   }
 
   if (*data_len < len) {
-    set_errno(MSGPACK_ENOBUF);
+    set_errno(&up->err, MSGPACK_ENOBUF);
     goto error;
   }
 
-  if (endian) {
+  if (tag->flags & TAG_ENDIAN) {
     ret = msgpack_read_endian(up, data, len);
   } else {
     ret = msgpack_read(up, data, len);
@@ -405,6 +929,12 @@ map_break:
   }
   read += len;
 
+  if ((up->flags & MSGPACK_UNPACK_UTF8) && m_type == MSGPACK_TYPE_STR &&
+      !msgpack_utf8_valid(data, len)) {
+    set_errno(&up->err, MSGPACK_EUTF8);
+    goto error;
+  }
+
 exit:
   *type = m_type;
   if (data_len) {
@@ -419,3 +949,2833 @@ error:
   return false;
 }
 
+bool msgpack_unpack_view(struct msgpack_unpacker *up, const uint8_t **data,
+        uint32_t *data_len, uint8_t *type) {
+  const struct msgpack_tag *tag;
+  uint32_t len;
+  size_t pos;
+
+  if (!up || !data || !data_len || !type) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  if (up->pos >= up->len) {
+    set_errno(&up->err, MSGPACK_EENDBUF);
+    return false;
+  }
+
+  pos = up->pos;
+  tag = &msgpack_tags[up->buf[pos++]];
+  if (tag->type != MSGPACK_TYPE_STR && tag->type != MSGPACK_TYPE_BIN) {
+    set_errno(&up->err, MSGPACK_EUNEXPECTED);
+    return false;
+  }
+
+  if (*type != MSGPACK_TYPE_ANY && type_mask(*type) != type_mask(tag->type)) {
+    set_errno(&up->err, MSGPACK_EUNEXPECTED);
+    return false;
+  }
+
+  len = tag->size;
+  if (tag->len_size) {
+    if (tag->len_size > up->len - pos) {
+      set_errno(&up->err, MSGPACK_EENDBUF);
+      return false;
+    }
+    len = msgpack_tag_len(up->buf + pos, tag->len_size);
+    pos += tag->len_size;
+  }
+
+  if (len > up->len - pos) {
+    set_errno(&up->err, MSGPACK_EENDBUF);
+    return false;
+  }
+
+  if ((up->flags & MSGPACK_UNPACK_UTF8) && tag->type == MSGPACK_TYPE_STR &&
+      !msgpack_utf8_valid(up->buf + pos, len)) {
+    set_errno(&up->err, MSGPACK_EUTF8);
+    return false;
+  }
+
+  set_errno(&up->err, MSGPACK_EOK);
+  *data = up->buf + pos;
+  *data_len = len;
+  *type = tag->type;
+  up->pos = pos + len;
+  return true;
+}
+
+bool msgpack_unpack_ext(struct msgpack_unpacker *up, int8_t *ext_type,
+        const uint8_t **data, uint32_t *data_len) {
+  const struct msgpack_tag *tag;
+  uint32_t len;
+  size_t pos;
+
+  if (!up || !ext_type || !data || !data_len) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  if (up->pos >= up->len) {
+    set_errno(&up->err, MSGPACK_EENDBUF);
+    return false;
+  }
+
+  pos = up->pos;
+  tag = &msgpack_tags[up->buf[pos++]];
+  if (!(tag->flags & TAG_EXT)) {
+    set_errno(&up->err, MSGPACK_EUNEXPECTED);
+    return false;
+  }
+
+  len = tag->size;
+  if (tag->len_size) {
+    if (tag->len_size > up->len - pos) {
+      set_errno(&up->err, MSGPACK_EENDBUF);
+      return false;
+    }
+    len = msgpack_tag_len(up->buf + pos, tag->len_size);
+    pos += tag->len_size;
+  }
+
+  if (pos >= up->len || len > up->len - pos - 1) {
+    set_errno(&up->err, MSGPACK_EENDBUF);
+    return false;
+  }
+
+  set_errno(&up->err, MSGPACK_EOK);
+  *ext_type = (int8_t)up->buf[pos++];
+  *data = up->buf + pos;
+  *data_len = len;
+  up->pos = pos + len;
+  return true;
+}
+
+bool msgpack_unpack_timestamp(struct msgpack_unpacker *up,
+        struct msgpack_timestamp *ts) {
+  const uint8_t *p;
+  uint32_t len;
+  int8_t ext_type;
+  uint64_t word;
+  size_t pos;
+
+  if (!up || !ts) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  pos = up->pos;
+  if (!msgpack_unpack_ext(up, &ext_type, &p, &len)) {
+    return false;
+  }
+
+  if (ext_type != MSGPACK_EXT_TIMESTAMP) {
+    goto unexpected;
+  }
+  switch (len) {
+    case 4:
+      ts->sec = msgpack_load_be32(p);
+      ts->nsec = 0;
+      break;
+    case 8:
+      word = msgpack_load_be64(p);
+      ts->sec = (int64_t)(word & 0x3FFFFFFFFull);
+      ts->nsec = (uint32_t)(word >> 34);
+      break;
+    case 12:
+      ts->nsec = msgpack_load_be32(p);
+      ts->sec = (int64_t)msgpack_load_be64(p + 4);
+      break;
+    default:
+      goto unexpected;
+  }
+  if (ts->nsec >= 1000000000u) {
+    goto unexpected;
+  }
+  return true;
+
+unexpected:
+  up->pos = pos;
+  set_errno(&up->err, MSGPACK_EUNEXPECTED);
+  return false;
+}
+
+/**
+ * Move *pos past the value there. Only headers are read: every value of a
+ * container adds to the number of values left, so any depth is skipped in
+ * one loop without recursion.
+ */
+static int msgpack_skip_at(const uint8_t *buf, size_t len, size_t *pos) {
+  uint64_t left = 1;
+  size_t p = *pos;
+  size_t size;
+
+  while (left > 0) {
+    if (p >= len) {
+      return MSGPACK_EENDBUF;
+    }
+    size = msgpack_item_size(buf + p, len - p);
+    if (size == 0) {
+      return MSGPACK_EUNKNOWN;
+    }
+    if (size > len - p) {
+      return MSGPACK_EENDBUF;
+    }
+    left += msgpack_item_children(buf + p) - 1;
+    p += size;
+  }
+
+  *pos = p;
+  return MSGPACK_EOK;
+}
+
+bool msgpack_skip(struct msgpack_unpacker *up) {
+  int code;
+
+  if (!up) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  code = msgpack_skip_at(up->buf, up->len, &up->pos);
+  set_errno(&up->err, code);
+  return code == MSGPACK_EOK;
+}
+
+/**
+ * Drop the staged bytes already read. Not done as they are read, so a view
+ * into the stage stays valid until the next call.
+ */
+static void msgpack_stream_compact(struct msgpack_stream *st) {
+  if (st->stage_pos == 0) {
+    return;
+  }
+  st->stage_len -= st->stage_pos;
+  memmove(st->stage, st->stage + st->stage_pos, st->stage_len);
+  st->stage_pos = 0;
+}
+
+bool msgpack_stream_feed(struct msgpack_stream *st, const uint8_t *chunk,
+        size_t len) {
+  size_t rest;
+  uint8_t flags;
+
+  if (!st || (!chunk && len > 0)) {
+    set_errno(st ? &st->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  /* Keep what was not read from the last chunk, it may be released now. */
+  msgpack_stream_compact(st);
+  rest = st->up.len - st->up.pos;
+  if (rest > st->stage_alloc - st->stage_len) {
+    set_errno(&st->err, MSGPACK_ENOBUF);
+    return false;
+  }
+  if (rest > 0) {
+    memcpy(st->stage + st->stage_len, st->up.buf + st->up.pos, rest);
+    st->stage_len += rest;
+  }
+
+  set_errno(&st->err, MSGPACK_EOK);
+  flags = st->up.flags;
+  init_msgpack_unpacker(&st->up, (uint8_t *)chunk, len, 0);
+  st->up.flags = flags;
+  return true;
+}
+
+/**
+ * Point up at the next complete item, taken from the chunk when it holds the
+ * whole item, or completed in the stage from the bytes of the chunk.
+ */
+static bool msgpack_stream_next(struct msgpack_stream *st,
+        struct msgpack_unpacker *up) {
+  struct msgpack_unpacker *chunk = &st->up;
+  size_t avail = chunk->len - chunk->pos;
+  size_t size;
+  size_t copy;
+
+  msgpack_stream_compact(st);
+  if (st->stage_len == 0) {
+    if (avail == 0) {
+      set_errno(&st->err, MSGPACK_EENDBUF);
+      return false;
+    }
+    size = msgpack_item_size(chunk->buf + chunk->pos, avail);
+    if (size == 0) {
+      set_errno(&st->err, MSGPACK_EUNKNOWN);
+      return false;
+    }
+    if (size <= avail) {
+      init_msgpack_unpacker(up, chunk->buf + chunk->pos, size, 0);
+      up->flags = chunk->flags;
+      return true;
+    }
+    copy = avail;
+  } else {
+    while ((size = msgpack_item_size(st->stage, st->stage_len)) >
+            st->stage_len) {
+      copy = size - st->stage_len;
+      if (copy > avail) {
+        copy = avail;
+      }
+      if (copy == 0) {
+        break;
+      }
+      if (copy > st->stage_alloc - st->stage_len) {
+        set_errno(&st->err, MSGPACK_ENOBUF);
+        return false;
+      }
+      memcpy(st->stage + st->stage_len, chunk->buf + chunk->pos, copy);
+      st->stage_len += copy;
+      chunk->pos += copy;
+      avail -= copy;
+    }
+    if (size == 0) {
+      set_errno(&st->err, MSGPACK_EUNKNOWN);
+      return false;
+    }
+    if (size <= st->stage_len) {
+      init_msgpack_unpacker(up, st->stage, size, 0);
+      up->flags = chunk->flags;
+      return true;
+    }
+    copy = 0;
+  }
+
+  /* The item is cut by the end of the chunk, stage its head. */
+  if (copy > st->stage_alloc - st->stage_len) {
+    set_errno(&st->err, MSGPACK_ENOBUF);
+    return false;
+  }
+  memcpy(st->stage + st->stage_len, chunk->buf + chunk->pos, copy);
+  st->stage_len += copy;
+  chunk->pos += copy;
+  set_errno(&st->err, MSGPACK_EENDBUF);
+  return false;
+}
+
+/* Move the stream past what msgpack_unpack() consumed from up. */
+static void msgpack_stream_advance(struct msgpack_stream *st,
+        const struct msgpack_unpacker *up) {
+  st->err = up->err;
+  if (up->buf == st->stage) {
+    st->stage_pos += up->pos;
+  } else {
+    st->up.pos += up->pos;
+  }
+}
+
+bool msgpack_stream_unpack(struct msgpack_stream *st, void *data,
+        uint32_t *data_len, uint8_t *type) {
+  struct msgpack_unpacker up;
+  bool ret;
+
+  if (!st) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_stream_next(st, &up)) {
+    return false;
+  }
+  ret = msgpack_unpack(&up, data, data_len, type);
+  msgpack_stream_advance(st, &up);
+  return ret;
+}
+
+bool msgpack_stream_unpack_view(struct msgpack_stream *st,
+        const uint8_t **data, uint32_t *data_len, uint8_t *type) {
+  struct msgpack_unpacker up;
+  bool ret;
+
+  if (!st) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_stream_next(st, &up)) {
+    return false;
+  }
+  ret = msgpack_unpack_view(&up, data, data_len, type);
+  msgpack_stream_advance(st, &up);
+  return ret;
+}
+
+bool msgpack_stream_unpack_ext(struct msgpack_stream *st, int8_t *ext_type,
+        const uint8_t **data, uint32_t *data_len) {
+  struct msgpack_unpacker up;
+  bool ret;
+
+  if (!st) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_stream_next(st, &up)) {
+    return false;
+  }
+  ret = msgpack_unpack_ext(&up, ext_type, data, data_len);
+  msgpack_stream_advance(st, &up);
+  return ret;
+}
+
+bool msgpack_stream_unpack_timestamp(struct msgpack_stream *st,
+        struct msgpack_timestamp *ts) {
+  struct msgpack_unpacker up;
+  bool ret;
+
+  if (!st) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_stream_next(st, &up)) {
+    return false;
+  }
+  ret = msgpack_unpack_timestamp(&up, ts);
+  msgpack_stream_advance(st, &up);
+  return ret;
+}
+
+/**
+ * @name Tree
+ * @{
+ */
+
+union msgpack_arena_block {
+  union msgpack_arena_block *next;
+  uint64_t align_u;
+  double align_f;
+};
+
+#define MSGPACK_ARENA_ALIGN sizeof(union msgpack_arena_block)
+
+void *msgpack_arena_alloc(struct msgpack_arena *arena, size_t size) {
+  union msgpack_arena_block *block;
+  size_t block_size;
+  size_t off;
+
+  if (!arena) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return NULL;
+  }
+
+  if (arena->buf) {
+    off = (size_t)((((uintptr_t)arena->buf + arena->len + MSGPACK_ARENA_ALIGN - 1)
+            & ~(uintptr_t)(MSGPACK_ARENA_ALIGN - 1)) - (uintptr_t)arena->buf);
+    if (off <= arena->alloc && size <= arena->alloc - off) {
+      set_errno(&arena->err, MSGPACK_EOK);
+      arena->len = off + size;
+      return arena->buf + off;
+    }
+  }
+
+  if (!arena->allocator) {
+    set_errno(&arena->err, arena->buf ? MSGPACK_ENOBUF : MSGPACK_EINIT);
+    return NULL;
+  }
+
+  /* The rest of the current block is left unused. */
+  block_size = MSGPACK_ARENA_BLOCK_SIZE;
+  if (size > block_size - sizeof(*block)) {
+    if (size > SIZE_MAX - sizeof(*block)) {
+      set_errno(&arena->err, MSGPACK_ENOBUF);
+      return NULL;
+    }
+    block_size = sizeof(*block) + size;
+  }
+  block = arena->allocator->realloc(arena->allocator->ud, NULL, block_size);
+  if (!block) {
+    set_errno(&arena->err, MSGPACK_ENOBUF);
+    return NULL;
+  }
+
+  set_errno(&arena->err, MSGPACK_EOK);
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->buf = (uint8_t *)block;
+  arena->alloc = block_size;
+  arena->len = sizeof(*block) + size;
+  return arena->buf + sizeof(*block);
+}
+
+void msgpack_arena_release(struct msgpack_arena *arena) {
+  union msgpack_arena_block *next;
+
+  if (!arena) {
+    return;
+  }
+
+  while (arena->blocks) {
+    next = arena->blocks->next;
+    arena->allocator->free(arena->allocator->ud, arena->blocks);
+    arena->blocks = next;
+  }
+  arena->buf = arena->base;
+  arena->len = 0;
+  arena->alloc = arena->base_alloc;
+}
+
+/* Read the big endian number of a TAG_ENDIAN item into node. */
+static void msgpack_parse_number(struct msgpack_node *node, const uint8_t *p,
+        size_t size) {
+  uint64_t word;
+  uint32_t bits;
+
+  switch (size) {
+    case 1: word = *p; break;
+    case 2: word = msgpack_load_be16(p); break;
+    case 4: word = msgpack_load_be32(p); break;
+    default: word = msgpack_load_be64(p); break;
+  }
+
+  switch (node->type) {
+    case MSGPACK_TYPE_SINGLE: {
+      float f;
+      bits = (uint32_t)word;
+      memcpy(&f, &bits, sizeof(f));
+      node->v.f = f;
+      break;
+    }
+    case MSGPACK_TYPE_DOUBLE:
+      memcpy(&node->v.f, &word, sizeof(word));
+      break;
+    case MSGPACK_TYPE_S8: node->v.i = (int8_t)word; break;
+    case MSGPACK_TYPE_S16: node->v.i = (int16_t)word; break;
+    case MSGPACK_TYPE_S32: node->v.i = (int32_t)word; break;
+    case MSGPACK_TYPE_S64: node->v.i = (int64_t)word; break;
+    default: node->v.u = word; break;
+  }
+}
+
+/**
+ * Values are filled in document order. The children of a container are
+ * allocated when its header is read and the stack remembers, for each open
+ * container, the next child to fill and how many are left.
+ */
+bool msgpack_parse(struct msgpack_unpacker *up, struct msgpack_arena *arena,
+        struct msgpack_node **root) {
+  struct {
+    struct msgpack_node *next;
+    uint64_t left;
+  } stack[MSGPACK_PARSE_MAX_DEPTH];
+  size_t depth = 0;
+  const struct msgpack_tag *tag;
+  struct msgpack_node *top;
+  struct msgpack_node *node;
+  const uint8_t *p;
+  size_t pos;
+  size_t avail;
+  size_t size;
+  uint64_t count;
+  int code;
+
+  if (!up || !arena || !root) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  pos = up->pos;
+  top = msgpack_arena_alloc(arena, sizeof(*top));
+  if (!top) {
+    code = arena->err;
+    goto error;
+  }
+
+  node = top;
+  for (;;) {
+    if (pos >= up->len) {
+      code = MSGPACK_EENDBUF;
+      goto error;
+    }
+    p = up->buf + pos;
+    avail = up->len - pos;
+    size = msgpack_item_size(p, avail);
+    if (size == 0) {
+      code = MSGPACK_EUNKNOWN;
+      goto error;
+    }
+    if (size > avail) {
+      code = MSGPACK_EENDBUF;
+      goto error;
+    }
+
+    tag = &msgpack_tags[*p];
+    node->type = tag->type;
+    node->ext_type = 0;
+    node->len = 0;
+    if (tag->flags & TAG_INLINE) {
+      if (tag->type == MSGPACK_TYPE_BOOL) {
+        node->v.b = *p == TRUE_TAG;
+      } else if (tag->type == MSGPACK_TYPE_S8) {
+        node->v.i = (int8_t)*p;
+      } else {
+        node->v.u = *p;
+      }
+    } else if (tag->flags & TAG_ENDIAN) {
+      msgpack_parse_number(node, p + 1, tag->size);
+    } else if (tag->flags & TAG_COUNT) {
+      count = msgpack_item_children(p);
+      node->len = (uint32_t)((tag->flags & TAG_PAIRS) ? count / 2 : count);
+      node->v.child = NULL;
+      /* Every value takes a byte at least, do not allocate for a lie. */
+      if (count > avail - size) {
+        code = MSGPACK_EENDBUF;
+        goto error;
+      }
+      if (count > 0) {
+        if (depth == MSGPACK_PARSE_MAX_DEPTH) {
+          code = MSGPACK_ELIMIT;
+          goto error;
+        }
+        if (count > SIZE_MAX / sizeof(*node)) {
+          code = MSGPACK_ENOBUF;
+          goto error;
+        }
+        node->v.child = msgpack_arena_alloc(arena,
+                (size_t)count * sizeof(*node));
+        if (!node->v.child) {
+          code = arena->err;
+          goto error;
+        }
+        stack[depth].next = node->v.child;
+        stack[depth].left = count;
+        depth++;
+      }
+    } else if (tag->type != MSGPACK_TYPE_NIL) {
+      /* str, bin and ext, the payload ends the item. */
+      node->len = (uint32_t)(size - 1 - tag->len_size -
+              ((tag->flags & TAG_EXT) ? 1 : 0));
+      if (tag->flags & TAG_EXT) {
+        node->ext_type = (int8_t)p[1 + tag->len_size];
+      }
+      node->v.data = p + size - node->len;
+      if ((up->flags & MSGPACK_UNPACK_UTF8) && tag->type == MSGPACK_TYPE_STR &&
+          !msgpack_utf8_valid(node->v.data, node->len)) {
+        code = MSGPACK_EUTF8;
+        goto error;
+      }
+    }
+    pos += size;
+
+    while (depth > 0 && stack[depth - 1].left == 0) {
+      depth--;
+    }
+    if (depth == 0) {
+      break;
+    }
+    node = stack[depth - 1].next++;
+    stack[depth - 1].left--;
+  }
+
+  set_errno(&up->err, MSGPACK_EOK);
+  up->pos = pos;
+  *root = top;
+  return true;
+
+error:
+  set_errno(&up->err, code);
+  return false;
+}
+
+const struct msgpack_node *msgpack_node_find(const struct msgpack_node *map,
+        const char *key, uint32_t len) {
+  const struct msgpack_node *k;
+  uint32_t i;
+
+  if (!map || map->type != MSGPACK_TYPE_MAP || (!key && len > 0)) {
+    return NULL;
+  }
+
+  for (i = 0; i < map->len; ++i) {
+    k = msgpack_node_key(map, i);
+    if (k->type == MSGPACK_TYPE_STR && k->len == len &&
+        (len == 0 || memcmp(k->v.data, key, len) == 0)) {
+      return msgpack_node_value(map, i);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Index
+ * @{
+ */
+
+/* FNV-1a, keys are short and this is cheap to compute inline. */
+static uint32_t msgpack_hash(const uint8_t *data, uint32_t len) {
+  uint32_t h = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < len; ++i) {
+    h = (h ^ data[i]) * 16777619u;
+  }
+  return h;
+}
+
+/* The payload of the str at p, false for another type. */
+static bool msgpack_str_at(const uint8_t *p, const uint8_t **data,
+        uint32_t *len) {
+  const struct msgpack_tag *tag = &msgpack_tags[p[0]];
+
+  if (tag->type != MSGPACK_TYPE_STR) {
+    return false;
+  }
+  *len = tag->len_size ? msgpack_tag_len(p + 1, tag->len_size) : tag->size;
+  *data = p + 1 + tag->len_size;
+  return true;
+}
+
+/* Hash the str keys, keeping the first of duplicated keys. */
+static bool msgpack_index_hash(struct msgpack_index *idx,
+        struct msgpack_arena *arena) {
+  const uint8_t *key;
+  uint32_t key_len;
+  uint32_t slots = 2;
+  uint32_t i;
+  uint32_t h;
+
+  while (slots < idx->count * 2) {
+    slots <<= 1;
+  }
+  idx->slots = msgpack_arena_alloc(arena, slots * sizeof(*idx->slots));
+  if (!idx->slots) {
+    return false;
+  }
+  memset(idx->slots, 0, slots * sizeof(*idx->slots));
+  idx->slot_mask = slots - 1;
+
+  for (i = 0; i < idx->count; ++i) {
+    if (!msgpack_str_at(idx->buf + idx->offs[2 * i], &key, &key_len)) {
+      continue;
+    }
+    h = msgpack_hash(key, key_len) & idx->slot_mask;
+    while (idx->slots[h]) {
+      h = (h + 1) & idx->slot_mask;
+    }
+    idx->slots[h] = i + 1;
+  }
+  return true;
+}
+
+/* Index the container at *pos of buf and move *pos past it. */
+static int msgpack_index_build(const uint8_t *buf, size_t len, size_t *pos,
+        uint8_t flags, struct msgpack_arena *arena,
+        struct msgpack_index **out) {
+  const struct msgpack_tag *tag;
+  struct msgpack_index *idx;
+  const uint8_t *key;
+  uint32_t key_len;
+  size_t p = *pos;
+  size_t size;
+  uint64_t children;
+  uint64_t i;
+  int code;
+
+  if (p >= len) {
+    return MSGPACK_EENDBUF;
+  }
+  tag = &msgpack_tags[buf[p]];
+  if (!(tag->flags & TAG_COUNT)) {
+    return MSGPACK_EUNEXPECTED;
+  }
+  size = msgpack_item_size(buf + p, len - p);
+  if (size > len - p) {
+    return MSGPACK_EENDBUF;
+  }
+  children = msgpack_item_children(buf + p);
+  if (children > len - p - size) {
+    return MSGPACK_EENDBUF;
+  }
+  if (children >= SIZE_MAX / sizeof(size_t)) {
+    return MSGPACK_ENOBUF;
+  }
+  /* The key hash needs a power of two slots above the pairs. */
+  if ((tag->flags & TAG_PAIRS) && children / 2 > (UINT32_MAX >> 2)) {
+    return MSGPACK_ELIMIT;
+  }
+
+  idx = msgpack_arena_alloc(arena, sizeof(*idx));
+  if (!idx) {
+    return arena->err;
+  }
+  idx->offs = msgpack_arena_alloc(arena, (size_t)children * sizeof(size_t));
+  if (!idx->offs && children > 0) {
+    return arena->err;
+  }
+  idx->buf = buf;
+  idx->len = len;
+  idx->type = tag->type;
+  idx->count = (uint32_t)((tag->flags & TAG_PAIRS) ? children / 2 : children);
+  idx->slots = NULL;
+  idx->slot_mask = 0;
+  idx->kids = NULL;
+  idx->flags = flags;
+  idx->err = MSGPACK_EOK;
+
+  p += size;
+  for (i = 0; i < children; ++i) {
+    idx->offs[i] = p;
+    code = msgpack_skip_at(buf, len, &p);
+    if (code != MSGPACK_EOK) {
+      return code;
+    }
+    /* The keys are hashed now, the values are checked as they are read. */
+    if ((flags & MSGPACK_UNPACK_UTF8) && (tag->flags & TAG_PAIRS) &&
+        i % 2 == 0 && msgpack_str_at(buf + idx->offs[i], &key, &key_len) &&
+        !msgpack_utf8_valid(key, key_len)) {
+      return MSGPACK_EUTF8;
+    }
+  }
+
+  if (idx->type == MSGPACK_TYPE_MAP && idx->count > 0 &&
+      !msgpack_index_hash(idx, arena)) {
+    return arena->err;
+  }
+  *pos = p;
+  *out = idx;
+  return MSGPACK_EOK;
+}
+
+bool msgpack_index_open(struct msgpack_unpacker *up,
+        struct msgpack_arena *arena, struct msgpack_index **idx) {
+  int code;
+
+  if (!up || !arena || !idx) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  code = msgpack_index_build(up->buf, up->len, &up->pos, up->flags, arena,
+          idx);
+  set_errno(&up->err, code);
+  return code == MSGPACK_EOK;
+}
+
+/* The position in offs of the value i, or of the key when key is set. */
+static bool msgpack_index_slot(struct msgpack_index *idx, uint32_t i,
+        bool key, size_t *slot) {
+  if (i >= idx->count || (key && idx->type != MSGPACK_TYPE_MAP)) {
+    set_errno(&idx->err, MSGPACK_EINVL);
+    return false;
+  }
+  if (idx->type == MSGPACK_TYPE_MAP) {
+    *slot = 2 * (size_t)i + (key ? 0 : 1);
+  } else {
+    *slot = i;
+  }
+  return true;
+}
+
+bool msgpack_index_at(struct msgpack_index *idx, uint32_t i,
+        struct msgpack_unpacker *cur) {
+  size_t slot;
+
+  if (!idx || !cur) {
+    set_errno(idx ? &idx->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+  if (!msgpack_index_slot(idx, i, false, &slot)) {
+    return false;
+  }
+  set_errno(&idx->err, MSGPACK_EOK);
+  init_msgpack_unpacker(cur, (uint8_t *)idx->buf, idx->len, idx->offs[slot]);
+  cur->flags = idx->flags;
+  return true;
+}
+
+bool msgpack_index_key(struct msgpack_index *idx, uint32_t i,
+        struct msgpack_unpacker *cur) {
+  size_t slot;
+
+  if (!idx || !cur) {
+    set_errno(idx ? &idx->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+  if (!msgpack_index_slot(idx, i, true, &slot)) {
+    return false;
+  }
+  set_errno(&idx->err, MSGPACK_EOK);
+  init_msgpack_unpacker(cur, (uint8_t *)idx->buf, idx->len, idx->offs[slot]);
+  cur->flags = idx->flags;
+  return true;
+}
+
+bool msgpack_index_find(const struct msgpack_index *idx, const char *key,
+        uint32_t len, uint32_t *i) {
+  const uint8_t *k;
+  uint32_t k_len;
+  uint32_t h;
+  uint32_t pair;
+
+  if (!idx || !idx->slots || (!key && len > 0) || !i) {
+    return false;
+  }
+
+  h = msgpack_hash((const uint8_t *)key, len) & idx->slot_mask;
+  while ((pair = idx->slots[h]) != 0) {
+    msgpack_str_at(idx->buf + idx->offs[2 * (pair - 1)], &k, &k_len);
+    if (k_len == len && (len == 0 || memcmp(k, key, len) == 0)) {
+      *i = pair - 1;
+      return true;
+    }
+    h = (h + 1) & idx->slot_mask;
+  }
+  return false;
+}
+
+bool msgpack_index_child(struct msgpack_index *idx, uint32_t i,
+        struct msgpack_arena *arena, struct msgpack_index **child) {
+  size_t slot;
+  size_t pos;
+  int code;
+
+  if (!idx || !arena || !child) {
+    set_errno(idx ? &idx->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+  if (!msgpack_index_slot(idx, i, false, &slot)) {
+    return false;
+  }
+
+  if (!idx->kids) {
+    idx->kids = msgpack_arena_alloc(arena, idx->count * sizeof(*idx->kids));
+    if (!idx->kids) {
+      set_errno(&idx->err, arena->err);
+      return false;
+    }
+    memset(idx->kids, 0, idx->count * sizeof(*idx->kids));
+  }
+
+  if (!idx->kids[i]) {
+    pos = idx->offs[slot];
+    code = msgpack_index_build(idx->buf, idx->len, &pos, idx->flags, arena,
+            &idx->kids[i]);
+    if (code != MSGPACK_EOK) {
+      set_errno(&idx->err, code);
+      return false;
+    }
+  }
+  set_errno(&idx->err, MSGPACK_EOK);
+  *child = idx->kids[i];
+  return true;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Scanner
+ * @{
+ */
+
+/**
+ * The number of one byte values at the start of the n bytes at p. As signed
+ * bytes, every fixint is above -33, the other one byte tags are compared.
+ */
+static size_t msgpack_scan_run(const uint8_t *p, size_t n) {
+  size_t i = 0;
+#if MSGPACK_SCAN_AVX2
+  const __m256i fixint = _mm256_set1_epi8(-33);
+  const __m256i nil = _mm256_set1_epi8((char)NIL_TAG);
+  const __m256i no = _mm256_set1_epi8((char)FALSE_TAG);
+  const __m256i yes = _mm256_set1_epi8((char)TRUE_TAG);
+  const __m256i empty = _mm256_set1_epi8((char)FIXSTR_TAG);
+  __m256i v;
+  __m256i m;
+  uint32_t bits;
+
+  for (; i + 32 <= n; i += 32) {
+    v = _mm256_loadu_si256((const __m256i *)(p + i));
+    m = _mm256_or_si256(_mm256_cmpgt_epi8(v, fixint),
+            _mm256_cmpeq_epi8(v, nil));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, no));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, yes));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, empty));
+    bits = ~(uint32_t)_mm256_movemask_epi8(m);
+    if (bits) {
+      return i + (size_t)__builtin_ctz(bits);
+    }
+  }
+#elif MSGPACK_SCAN_SSE2
+  const __m128i fixint = _mm_set1_epi8(-33);
+  const __m128i nil = _mm_set1_epi8((char)NIL_TAG);
+  const __m128i no = _mm_set1_epi8((char)FALSE_TAG);
+  const __m128i yes = _mm_set1_epi8((char)TRUE_TAG);
+  const __m128i empty = _mm_set1_epi8((char)FIXSTR_TAG);
+  __m128i v;
+  __m128i m;
+  uint32_t bits;
+
+  for (; i + 16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(p + i));
+    m = _mm_or_si128(_mm_cmpgt_epi8(v, fixint), _mm_cmpeq_epi8(v, nil));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, no));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, yes));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, empty));
+    bits = ~(uint32_t)_mm_movemask_epi8(m) & 0xFFFFu;
+    if (bits) {
+      return i + (size_t)__builtin_ctz(bits);
+    }
+  }
+#endif
+  while (i < n && (msgpack_tags[p[i]].flags & TAG_SINGLE)) {
+    i++;
+  }
+  return i;
+}
+
+bool msgpack_scan(struct msgpack_scan *sc, const uint8_t *buf, size_t len) {
+  const struct msgpack_tag *tag;
+  size_t p;
+  size_t start;
+  size_t size;
+  size_t run;
+  size_t i;
+  size_t mark;
+  uint64_t left;
+  int code;
+
+  if (!sc || !sc->values || (!buf && len > 0)) {
+    set_errno(sc ? &sc->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  p = sc->pos;
+  while (p < len) {
+    if (sc->value_cnt == sc->value_alloc) {
+      code = MSGPACK_ENOBUF;
+      goto error;
+    }
+
+    /* Top level one byte values are values of their own. */
+    run = sc->value_alloc - sc->value_cnt;
+    run = msgpack_scan_run(buf + p, len - p < run ? len - p : run);
+    if (run > 0) {
+      for (i = 0; i < run; ++i) {
+        sc->values[sc->value_cnt++] = p + i;
+      }
+      p += run;
+      sc->pos = p;
+      continue;
+    }
+
+    start = p;
+    mark = sc->container_cnt;
+    left = 1;
+    while (left > 0) {
+      if (p >= len) {
+        code = MSGPACK_EENDBUF;
+        goto rewind;
+      }
+      tag = &msgpack_tags[buf[p]];
+      if (tag->flags & TAG_SINGLE) {
+        run = msgpack_scan_run(buf + p, len - p < left ? len - p : (size_t)left);
+        p += run;
+        left -= run;
+        continue;
+      }
+      size = msgpack_item_size(buf + p, len - p);
+      if (size == 0) {
+        code = MSGPACK_EUNKNOWN;
+        goto rewind;
+      }
+      if (size > len - p) {
+        code = MSGPACK_EENDBUF;
+        goto rewind;
+      }
+      if (tag->flags & TAG_COUNT) {
+        if (sc->containers) {
+          if (sc->container_cnt == sc->container_alloc) {
+            code = MSGPACK_ENOBUF;
+            goto rewind;
+          }
+          sc->containers[sc->container_cnt++] = p;
+        }
+        left += msgpack_item_children(buf + p);
+      }
+      p += size;
+      left--;
+    }
+    sc->values[sc->value_cnt++] = start;
+    sc->pos = p;
+  }
+
+  set_errno(&sc->err, MSGPACK_EOK);
+  return true;
+
+rewind:
+  sc->container_cnt = mark;
+error:
+  set_errno(&sc->err, code);
+  return false;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Schema
+ * @{
+ */
+
+/**
+ * The length of the string in the char array of size bytes at p, at most
+ * size - 1 so that msgpack_unpack_struct() can terminate it in the same array.
+ */
+static size_t msgpack_field_strlen(const uint8_t *p, size_t size) {
+  const uint8_t *end = memchr(p, 0, size - 1);
+  return end ? (size_t)(end - p) : size - 1;
+}
+
+/* Load the integer member of size bytes at p, sign extended if is_signed. */
+static uint64_t msgpack_field_load(const uint8_t *p, size_t size,
+        bool is_signed) {
+  uint8_t u8;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+
+  switch (size) {
+    case 1:
+      memcpy(&u8, p, 1);
+      return is_signed ? (uint64_t)(int8_t)u8 : u8;
+    case 2:
+      memcpy(&u16, p, 2);
+      return is_signed ? (uint64_t)(int16_t)u16 : u16;
+    case 4:
+      memcpy(&u32, p, 4);
+      return is_signed ? (uint64_t)(int32_t)u32 : u32;
+    default:
+      memcpy(&u64, p, 8);
+      return u64;
+  }
+}
+
+static void msgpack_field_store(uint8_t *p, size_t size, uint64_t val) {
+  uint8_t u8 = (uint8_t)val;
+  uint16_t u16 = (uint16_t)val;
+  uint32_t u32 = (uint32_t)val;
+
+  switch (size) {
+    case 1: memcpy(p, &u8, 1); break;
+    case 2: memcpy(p, &u16, 2); break;
+    case 4: memcpy(p, &u32, 4); break;
+    default: memcpy(p, &val, 8); break;
+  }
+}
+
+bool msgpack_write_struct(struct msgpack_buffer *mbuf,
+        const struct msgpack_schema *schema, const void *obj) {
+  const struct msgpack_field *f;
+  const uint8_t *base = obj;
+  const uint8_t *p;
+  size_t need;
+  size_t len;
+  uint32_t i;
+  float fv;
+  double dv;
+
+  if (!mbuf || !schema || !obj) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  need = msgpack_sizeof_map(schema->count);
+  for (i = 0; i < schema->count; ++i) {
+    f = &schema->fields[i];
+    p = base + f->offset;
+    need += f->key_size;
+    switch (f->kind) {
+      case MSGPACK_FIELD_BOOL:
+        need += msgpack_sizeof_bool(0);
+        break;
+      case MSGPACK_FIELD_INT:
+        need += msgpack_sizeof_integer(
+                (int64_t)msgpack_field_load(p, f->size, true));
+        break;
+      case MSGPACK_FIELD_UINT:
+        need += msgpack_sizeof_uinteger(msgpack_field_load(p, f->size, false));
+        break;
+      case MSGPACK_FIELD_FLOAT:
+        need += msgpack_sizeof_float(0);
+        break;
+      case MSGPACK_FIELD_DOUBLE:
+        need += msgpack_sizeof_double(0);
+        break;
+      default:
+        need += msgpack_sizeof_str(msgpack_field_strlen(p, f->size));
+        break;
+    }
+  }
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, need);
+  }
+  if (!msgpack_reserve(mbuf, need)) {
+    return false;
+  }
+
+  msgpack_put_len_data(mbuf, msgpack_map_type(schema->count), NULL,
+          schema->count, msgpack_map_lensize(schema->count));
+  for (i = 0; i < schema->count; ++i) {
+    f = &schema->fields[i];
+    p = base + f->offset;
+    memcpy(mbuf->buf + mbuf->len, f->key, f->key_size);
+    mbuf->len += f->key_size;
+    switch (f->kind) {
+      case MSGPACK_FIELD_BOOL:
+        msgpack_put_bool(mbuf, msgpack_field_load(p, f->size, false) != 0);
+        break;
+      case MSGPACK_FIELD_INT:
+        msgpack_put_integer(mbuf, (int64_t)msgpack_field_load(p, f->size, true));
+        break;
+      case MSGPACK_FIELD_UINT:
+        msgpack_put_uinteger(mbuf, msgpack_field_load(p, f->size, false));
+        break;
+      case MSGPACK_FIELD_FLOAT:
+        memcpy(&fv, p, sizeof(fv));
+        msgpack_put_float(mbuf, fv);
+        break;
+      case MSGPACK_FIELD_DOUBLE:
+        memcpy(&dv, p, sizeof(dv));
+        msgpack_put_double(mbuf, dv);
+        break;
+      default:
+        len = msgpack_field_strlen(p, f->size);
+        msgpack_put_len_data(mbuf, msgpack_str_type(len), p, (uint32_t)len,
+                msgpack_str_lensize(len));
+        break;
+    }
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  return true;
+}
+
+/**
+ * Read the integer at p. Returns false for another type, *neg tells that
+ * *val holds a negative int64_t.
+ */
+static bool msgpack_integer_at(const uint8_t *p, uint64_t *val, bool *neg) {
+  const struct msgpack_tag *tag = &msgpack_tags[p[0]];
+  uint64_t word;
+
+  if (type_mask(tag->type) != MSGPACK_TYPE_INTEGER) {
+    return false;
+  }
+  if (tag->flags & TAG_INLINE) {
+    *val = (uint64_t)(int64_t)(int8_t)p[0];
+    *neg = p[0] >= NEG_FIXNUM_TAG;
+    return true;
+  }
+
+  switch (tag->size) {
+    case 1: word = p[1]; break;
+    case 2: word = msgpack_load_be16(p + 1); break;
+    case 4: word = msgpack_load_be32(p + 1); break;
+    default: word = msgpack_load_be64(p + 1); break;
+  }
+  switch (tag->type) {
+    case MSGPACK_TYPE_S8: word = (uint64_t)(int64_t)(int8_t)word; break;
+    case MSGPACK_TYPE_S16: word = (uint64_t)(int64_t)(int16_t)word; break;
+    case MSGPACK_TYPE_S32: word = (uint64_t)(int64_t)(int32_t)word; break;
+    case MSGPACK_TYPE_S64: break;
+    default:
+      *val = word;
+      *neg = false;
+      return true;
+  }
+  *val = word;
+  *neg = (int64_t)word < 0;
+  return true;
+}
+
+/* Read the value at p, whose bounds are checked, into the member of f. */
+static int msgpack_field_read(const uint8_t *p, const struct msgpack_field *f,
+        uint8_t flags, uint8_t *member) {
+  const uint8_t *data;
+  uint64_t val;
+  uint64_t max;
+  uint32_t len;
+  uint32_t bits;
+  bool neg;
+  float fv;
+  double dv;
+
+  if (p[0] == NIL_TAG) {
+    return MSGPACK_EOK;
+  }
+
+  switch (f->kind) {
+    case MSGPACK_FIELD_BOOL:
+      if (p[0] != TRUE_TAG && p[0] != FALSE_TAG) {
+        return MSGPACK_EUNEXPECTED;
+      }
+      msgpack_field_store(member, f->size, p[0] == TRUE_TAG);
+      return MSGPACK_EOK;
+    case MSGPACK_FIELD_INT:
+    case MSGPACK_FIELD_UINT:
+      if (!msgpack_integer_at(p, &val, &neg)) {
+        return MSGPACK_EUNEXPECTED;
+      }
+      max = f->size >= 8 ? UINT64_MAX : ((uint64_t)1 << (f->size * 8)) - 1;
+      if (f->kind == MSGPACK_FIELD_INT) {
+        max >>= 1;
+        if (neg ? (int64_t)val < -(int64_t)max - 1 : val > max) {
+          return MSGPACK_EUNEXPECTED;
+        }
+      } else if (neg || val > max) {
+        return MSGPACK_EUNEXPECTED;
+      }
+      msgpack_field_store(member, f->size, val);
+      return MSGPACK_EOK;
+    case MSGPACK_FIELD_FLOAT:
+    case MSGPACK_FIELD_DOUBLE:
+      if (p[0] == FLOAT_TAG) {
+        bits = msgpack_load_be32(p + 1);
+        memcpy(&fv, &bits, sizeof(fv));
+        dv = fv;
+      } else if (p[0] == DOUBLE_TAG) {
+        val = msgpack_load_be64(p + 1);
+        memcpy(&dv, &val, sizeof(dv));
+      } else if (msgpack_integer_at(p, &val, &neg)) {
+        dv = neg ? (double)(int64_t)val : (double)val;
+      } else {
+        return MSGPACK_EUNEXPECTED;
+      }
+      if (f->kind == MSGPACK_FIELD_FLOAT) {
+        fv = (float)dv;
+        memcpy(member, &fv, sizeof(fv));
+      } else {
+        memcpy(member, &dv, sizeof(dv));
+      }
+      return MSGPACK_EOK;
+    default:
+      if (!msgpack_str_at(p, &data, &len)) {
+        return MSGPACK_EUNEXPECTED;
+      }
+      if (len >= f->size) {
+        return MSGPACK_ENOBUF;
+      }
+      if ((flags & MSGPACK_UNPACK_UTF8) && !msgpack_utf8_valid(data, len)) {
+        return MSGPACK_EUTF8;
+      }
+      memcpy(member, data, len);
+      member[len] = 0;
+      return MSGPACK_EOK;
+  }
+}
+
+/**
+ * The field named by the key at p, NULL if none. The key is compared with
+ * the field at hint first, then looked up in ks or compared with every name.
+ */
+static const struct msgpack_field *msgpack_field_find(
+        const struct msgpack_schema *schema, const struct msgpack_keyset *ks,
+        uint32_t hint, const uint8_t *p, size_t size) {
+  const struct msgpack_field *f;
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t i;
+
+  /* Keys written by the smallest encoding are compared as they are. */
+  if (hint < schema->count) {
+    f = &schema->fields[hint];
+    if (f->key_size == size && memcmp(p, f->key, size) == 0) {
+      return f;
+    }
+  }
+
+  if (!msgpack_str_at(p, &data, &len)) {
+    return NULL;
+  }
+  if (ks) {
+    if (!msgpack_keyset_find(ks, data, len, &i) || i >= schema->count) {
+      return NULL;
+    }
+    return &schema->fields[i];
+  }
+  for (i = 0; i < schema->count; ++i) {
+    f = &schema->fields[i];
+    if (f->key_size - 1u == len && memcmp(data, f->key + 1, len) == 0) {
+      return f;
+    }
+  }
+  return NULL;
+}
+
+static bool msgpack_unpack_fields(struct msgpack_unpacker *up,
+        const struct msgpack_schema *schema, const struct msgpack_keyset *ks,
+        void *obj) {
+  const struct msgpack_tag *tag;
+  const struct msgpack_field *f;
+  uint8_t *base = obj;
+  size_t pos;
+  size_t start;
+  uint32_t count;
+  uint32_t hint = 0;
+  uint32_t i;
+  int code;
+
+  if (!up || !schema || !obj) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  pos = up->pos;
+  if (pos >= up->len) {
+    code = MSGPACK_EENDBUF;
+    goto error;
+  }
+  tag = &msgpack_tags[up->buf[pos]];
+  if (tag->type != MSGPACK_TYPE_MAP) {
+    code = MSGPACK_EUNEXPECTED;
+    goto error;
+  }
+  if (tag->len_size > up->len - pos - 1) {
+    code = MSGPACK_EENDBUF;
+    goto error;
+  }
+  count = (uint32_t)(msgpack_item_children(up->buf + pos) / 2);
+  pos += msgpack_item_size(up->buf + pos, up->len - pos);
+
+  for (i = 0; i < count; ++i) {
+    start = pos;
+    code = msgpack_skip_at(up->buf, up->len, &pos);
+    if (code != MSGPACK_EOK) {
+      goto error;
+    }
+    f = msgpack_field_find(schema, ks, hint, up->buf + start, pos - start);
+
+    start = pos;
+    code = msgpack_skip_at(up->buf, up->len, &pos);
+    if (code != MSGPACK_EOK) {
+      goto error;
+    }
+    if (!f) {
+      continue;
+    }
+    code = msgpack_field_read(up->buf + start, f, up->flags,
+            base + f->offset);
+    if (code != MSGPACK_EOK) {
+      goto error;
+    }
+    hint = (uint32_t)(f - schema->fields) + 1;
+  }
+
+  up->pos = pos;
+  set_errno(&up->err, MSGPACK_EOK);
+  return true;
+
+error:
+  set_errno(&up->err, code);
+  return false;
+}
+
+bool msgpack_unpack_struct(struct msgpack_unpacker *up,
+        const struct msgpack_schema *schema, void *obj) {
+  return msgpack_unpack_fields(up, schema, NULL, obj);
+}
+
+bool msgpack_unpack_struct_keys(struct msgpack_unpacker *up,
+        const struct msgpack_schema *schema, const struct msgpack_keyset *ks,
+        void *obj) {
+  if (!ks) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+  return msgpack_unpack_fields(up, schema, ks, obj);
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Keyset
+ * @{
+ */
+
+/**
+ * Mix the hash h of a key with a seed into a slot hash: every seed gives
+ * another function of the key, without hashing the key again.
+ */
+static inline uint32_t msgpack_hash_mix(uint32_t h, uint32_t seed) {
+  h ^= seed * 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/* The payload of key i, which the keyset has encoded already. */
+static const uint8_t *msgpack_keyset_key(const struct msgpack_keyset *ks,
+        uint32_t i, uint32_t *len) {
+  const uint8_t *key;
+
+  if (!msgpack_str_at(ks->data + ks->offs[i], &key, len)) {
+    *len = 0;
+    return ks->data;
+  }
+  return key;
+}
+
+/**
+ * Hash every key once and sort the keys by bucket: the keys of bucket b are
+ * members[starts[b]] to members[starts[b + 1] - 1], in order, without the
+ * repeated keys, which keep the handle of the first. hashes is indexed by
+ * key and starts has a bucket more. Return the size of the largest bucket.
+ */
+static uint32_t msgpack_keyset_group(const struct msgpack_keyset *ks,
+        uint32_t *members, uint32_t *hashes, uint32_t *starts) {
+  const uint8_t *key;
+  const uint8_t *k;
+  uint32_t len;
+  uint32_t k_len;
+  uint32_t begin;
+  uint32_t end;
+  uint32_t max = 0;
+  uint32_t n = 0;
+  uint32_t b;
+  uint32_t i;
+  uint32_t j;
+
+  memset(starts, 0, (ks->disp_mask + 2) * sizeof(*starts));
+  for (i = 0; i < ks->count; ++i) {
+    key = msgpack_keyset_key(ks, i, &len);
+    hashes[i] = msgpack_hash(key, len);
+    starts[(hashes[i] & ks->disp_mask) + 1]++;
+  }
+  for (b = 0; b <= ks->disp_mask; ++b) {
+    starts[b + 1] += starts[b];
+  }
+  /* Each start moves to the end of its bucket, then back by one bucket. */
+  for (i = 0; i < ks->count; ++i) {
+    members[starts[hashes[i] & ks->disp_mask]++] = i;
+  }
+  for (b = ks->disp_mask + 1; b > 0; --b) {
+    starts[b] = starts[b - 1];
+  }
+  starts[0] = 0;
+
+  for (b = 0; b <= ks->disp_mask; ++b) {
+    begin = starts[b];
+    end = starts[b + 1];
+    starts[b] = n;
+    for (; begin < end; ++begin) {
+      i = members[begin];
+      key = msgpack_keyset_key(ks, i, &len);
+      for (j = starts[b]; j < n; ++j) {
+        k = msgpack_keyset_key(ks, members[j], &k_len);
+        if (hashes[members[j]] == hashes[i] && k_len == len &&
+            memcmp(k, key, len) == 0) {
+          break;
+        }
+      }
+      if (j == n) {
+        members[n++] = i;
+      }
+    }
+    if (n - starts[b] > max) {
+      max = n - starts[b];
+    }
+  }
+  starts[b] = n;
+  return max;
+}
+
+/**
+ * Find a displacement for every bucket of keys grouped by
+ * msgpack_keyset_group(), largest buckets first, so that all the keys of
+ * the bucket land in free slots.
+ */
+static bool msgpack_keyset_place(struct msgpack_keyset *ks,
+        const uint32_t *members, const uint32_t *hashes,
+        const uint32_t *starts, uint32_t max) {
+  const uint32_t *bucket;
+  uint32_t size;
+  uint32_t b;
+  uint32_t n;
+  uint32_t d;
+  uint32_t j;
+  uint32_t slot;
+
+  memset(ks->slots, 0, (ks->slot_mask + 1) * sizeof(*ks->slots));
+  memset(ks->disp, 0, (ks->disp_mask + 1) * sizeof(*ks->disp));
+  for (size = max; size > 0; --size) {
+    for (b = 0; b <= ks->disp_mask; ++b) {
+      n = starts[b + 1] - starts[b];
+      if (n != size) {
+        continue;
+      }
+      bucket = members + starts[b];
+
+      for (d = 0; d < 1024; ++d) {
+        for (j = 0; j < n; ++j) {
+          slot = msgpack_hash_mix(hashes[bucket[j]], d) & ks->slot_mask;
+          if (ks->slots[slot]) {
+            break;
+          }
+          ks->slots[slot] = bucket[j] + 1;
+        }
+        if (j == n) {
+          break;
+        }
+        while (j-- > 0) {
+          ks->slots[msgpack_hash_mix(hashes[bucket[j]], d) & ks->slot_mask] = 0;
+        }
+      }
+      if (d == 1024) {
+        return false;
+      }
+      ks->disp[b] = d;
+    }
+  }
+  return true;
+}
+
+bool msgpack_keyset_build(struct msgpack_keyset *ks,
+        struct msgpack_arena *arena, const char *const *keys, uint32_t count) {
+  struct msgpack_buffer mbuf;
+  uint32_t *members;
+  uint32_t *hashes;
+  uint32_t *starts;
+  uint32_t max;
+  size_t size = 0;
+  size_t len;
+  uint32_t slots = 2;
+  uint32_t buckets = 1;
+  uint32_t i;
+  int code;
+
+  if (!ks || !arena || (!keys && count > 0)) {
+    set_errno(ks ? &ks->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  for (i = 0; i < count; ++i) {
+    len = strlen(keys[i]);
+    if (len > UINT32_MAX - 5 || size > UINT32_MAX - 5 - len) {
+      code = MSGPACK_ELIMIT;
+      goto error;
+    }
+    size += 5 + len;
+  }
+  if (count > UINT32_MAX / 8) {
+    code = MSGPACK_ELIMIT;
+    goto error;
+  }
+  while (slots < count * 2) {
+    slots <<= 1;
+  }
+  while (buckets * 2 < count) {
+    buckets <<= 1;
+  }
+
+  ks->data = msgpack_arena_alloc(arena, size ? size : 1);
+  ks->offs = msgpack_arena_alloc(arena, (count + 1) * sizeof(*ks->offs));
+  ks->disp = msgpack_arena_alloc(arena, buckets * sizeof(*ks->disp));
+  ks->slots = msgpack_arena_alloc(arena, 2 * slots * sizeof(*ks->slots));
+  /* The scratch space of the search is freed with the arena. */
+  members = msgpack_arena_alloc(arena,
+          (2 * count + buckets + 1) * sizeof(*members));
+  if (!ks->data || !ks->offs || !ks->disp || !ks->slots || !members) {
+    code = msgpack_arena_errno(arena);
+    goto error;
+  }
+  hashes = members + count;
+  starts = hashes + count;
+  ks->disp_mask = buckets - 1;
+  ks->count = count;
+
+  init_msgpack_buffer(&mbuf, ks->data, size);
+  for (i = 0; i < count; ++i) {
+    len = strlen(keys[i]);
+    ks->offs[i] = (uint32_t)mbuf.len;
+    msgpack_put_len_data(&mbuf, msgpack_str_type(len), keys[i], (uint32_t)len,
+            msgpack_str_lensize(len));
+  }
+  ks->offs[count] = (uint32_t)mbuf.len;
+
+  /* Half full tables nearly always place at once, else use the double. */
+  max = msgpack_keyset_group(ks, members, hashes, starts);
+  ks->slot_mask = slots - 1;
+  if (!msgpack_keyset_place(ks, members, hashes, starts, max)) {
+    ks->slot_mask = 2 * slots - 1;
+    if (!msgpack_keyset_place(ks, members, hashes, starts, max)) {
+      code = MSGPACK_ELIMIT;
+      goto error;
+    }
+  }
+
+  set_errno(&ks->err, MSGPACK_EOK);
+  return true;
+
+error:
+  set_errno(&ks->err, code);
+  return false;
+}
+
+bool msgpack_keyset_build_schema(struct msgpack_keyset *ks,
+        struct msgpack_arena *arena, const struct msgpack_schema *schema) {
+  const char **keys;
+  uint32_t i;
+
+  if (!ks || !arena || !schema) {
+    set_errno(ks ? &ks->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  keys = msgpack_arena_alloc(arena, (schema->count + 1) * sizeof(*keys));
+  if (!keys) {
+    set_errno(&ks->err, msgpack_arena_errno(arena));
+    return false;
+  }
+  /* The name after the fixstr tag is NUL terminated by its array. */
+  for (i = 0; i < schema->count; ++i) {
+    keys[i] = (const char *)schema->fields[i].key + 1;
+  }
+  return msgpack_keyset_build(ks, arena, keys, schema->count);
+}
+
+bool msgpack_write_key(struct msgpack_buffer *mbuf,
+        const struct msgpack_keyset *ks, uint32_t h) {
+  if (!mbuf || !ks || h >= ks->count) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (msgpack_buffer_counting(mbuf)) {
+    return msgpack_buffer_count(mbuf, ks->offs[h + 1] - ks->offs[h]);
+  }
+
+  if (!msgpack_reserve(mbuf, ks->offs[h + 1] - ks->offs[h])) {
+    return false;
+  }
+  msgpack_put_key(mbuf, ks, h);
+  return true;
+}
+
+bool msgpack_keyset_find(const struct msgpack_keyset *ks, const void *key,
+        uint32_t len, uint32_t *h) {
+  const uint8_t *k;
+  uint32_t k_len;
+  uint32_t hash;
+  uint32_t handle;
+
+  if (!ks || !ks->slots || (!key && len > 0) || !h) {
+    return false;
+  }
+
+  hash = msgpack_hash(key, len);
+  hash = msgpack_hash_mix(hash, ks->disp[hash & ks->disp_mask]);
+  handle = ks->slots[hash & ks->slot_mask];
+  if (handle == 0) {
+    return false;
+  }
+  k = msgpack_keyset_key(ks, handle - 1, &k_len);
+  if (k_len != len || (len > 0 && memcmp(k, key, len) != 0)) {
+    return false;
+  }
+  *h = handle - 1;
+  return true;
+}
+
+bool msgpack_unpack_key(struct msgpack_unpacker *up,
+        const struct msgpack_keyset *ks, uint32_t *h) {
+  const uint8_t *key;
+  uint32_t len;
+  uint8_t type = MSGPACK_TYPE_STR;
+
+  if (!up || !ks || !h) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!msgpack_unpack_view(up, &key, &len, &type)) {
+    return false;
+  }
+  if (!msgpack_keyset_find(ks, key, len, h)) {
+    *h = MSGPACK_KEY_NONE;
+  }
+  return true;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Typed arrays
+ * @{
+ */
+
+/**
+ * A tag followed by a big endian value, as one word to store at once. The
+ * bytes after the value are overwritten by the next element.
+ */
+#if MSGPACK_BIG_ENDIAN
+#define msgpack_tag_word16(tag, v) \
+  (((uint32_t)(tag) << 24) | ((uint32_t)(uint16_t)(v) << 8))
+#define msgpack_tag_word32(tag, v) \
+  (((uint64_t)(tag) << 56) | ((uint64_t)(uint32_t)(v) << 24))
+#else
+#define msgpack_tag_word16(tag, v) \
+  ((uint32_t)(tag) | ((uint32_t)msgpack_bswap16((uint16_t)(v)) << 8))
+#define msgpack_tag_word32(tag, v) \
+  ((uint64_t)(tag) | ((uint64_t)msgpack_bswap32((uint32_t)(v)) << 8))
+#endif
+
+/* The tag and size of the elements of a typed array, false for bad types. */
+static bool msgpack_array_elem(uint8_t type, uint8_t *tag, size_t *size) {
+  switch (type) {
+    case MSGPACK_TYPE_U8: *tag = U8_TAG; *size = 1; break;
+    case MSGPACK_TYPE_U16: *tag = U16_TAG; *size = 2; break;
+    case MSGPACK_TYPE_U32: *tag = U32_TAG; *size = 4; break;
+    case MSGPACK_TYPE_U64: *tag = U64_TAG; *size = 8; break;
+    case MSGPACK_TYPE_S8: *tag = S8_TAG; *size = 1; break;
+    case MSGPACK_TYPE_S16: *tag = S16_TAG; *size = 2; break;
+    case MSGPACK_TYPE_S32: *tag = S32_TAG; *size = 4; break;
+    case MSGPACK_TYPE_S64: *tag = S64_TAG; *size = 8; break;
+    case MSGPACK_TYPE_SINGLE: *tag = FLOAT_TAG; *size = 4; break;
+    case MSGPACK_TYPE_DOUBLE: *tag = DOUBLE_TAG; *size = 8; break;
+    default: return false;
+  }
+  return true;
+}
+
+/* Store n elements of size bytes from data, each after tag. */
+static void msgpack_put_fixed_array(struct msgpack_buffer *mbuf, uint8_t tag,
+        const uint8_t *data, size_t n, size_t size) {
+  uint8_t *p = mbuf->buf + mbuf->len;
+  uint64_t w64;
+  uint32_t w32;
+  uint32_t u32;
+  uint16_t u16;
+  size_t i;
+
+  if (n == 0) {
+    return;
+  }
+
+  switch (size) {
+    case 1:
+      for (i = 0; i < n; ++i) {
+        p[0] = tag;
+        p[1] = data[i];
+        p += 2;
+      }
+      break;
+    case 2:
+      for (i = 0; i + 1 < n; ++i) {
+        memcpy(&u16, data + 2 * i, 2);
+        w32 = msgpack_tag_word16(tag, u16);
+        memcpy(p, &w32, 4);
+        p += 3;
+      }
+      memcpy(&u16, data + 2 * i, 2);
+      p[0] = tag;
+      msgpack_store_be16(p + 1, u16);
+      p += 3;
+      break;
+    case 4:
+      for (i = 0; i + 1 < n; ++i) {
+        memcpy(&u32, data + 4 * i, 4);
+        w64 = msgpack_tag_word32(tag, u32);
+        memcpy(p, &w64, 8);
+        p += 5;
+      }
+      memcpy(&u32, data + 4 * i, 4);
+      p[0] = tag;
+      msgpack_store_be32(p + 1, u32);
+      p += 5;
+      break;
+    default:
+      for (i = 0; i < n; ++i) {
+        memcpy(&w64, data + 8 * i, 8);
+        p[0] = tag;
+        msgpack_store_be64(p + 1, w64);
+        p += 9;
+      }
+      break;
+  }
+  mbuf->len = (size_t)(p - mbuf->buf);
+}
+
+#define MSGPACK_FIXINT_BLOCK 16
+
+#if MSGPACK_SCAN_AVX2 || MSGPACK_SCAN_SSE2
+/**
+ * Copy the leading blocks of MSGPACK_FIXINT_BLOCK elements that are all
+ * fixints to out, one byte each. Returns the number of elements copied.
+ */
+static size_t msgpack_fixint_run(uint8_t type, const uint8_t *data, size_t n,
+        uint8_t *out) {
+  const bool is_signed = type == MSGPACK_TYPE_S8 || type == MSGPACK_TYPE_S16 ||
+          type == MSGPACK_TYPE_S32;
+  const __m128i lo8 = _mm_set1_epi8(-33);
+  const __m128i lo16 = _mm_set1_epi16(is_signed ? -33 : -1);
+  const __m128i hi16 = _mm_set1_epi16(128);
+  const __m128i lo32 = _mm_set1_epi32(is_signed ? -33 : -1);
+  const __m128i hi32 = _mm_set1_epi32(128);
+  __m128i a, b, c, d, ok;
+  size_t i = 0;
+
+  for (; i + MSGPACK_FIXINT_BLOCK <= n; i += MSGPACK_FIXINT_BLOCK) {
+    switch (type) {
+      case MSGPACK_TYPE_U8:
+      case MSGPACK_TYPE_S8:
+        a = _mm_loadu_si128((const __m128i *)(data + i));
+        if (is_signed ? _mm_movemask_epi8(_mm_cmpgt_epi8(a, lo8)) != 0xFFFF :
+            _mm_movemask_epi8(a) != 0) {
+          return i;
+        }
+        break;
+      case MSGPACK_TYPE_U16:
+      case MSGPACK_TYPE_S16:
+        a = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        b = _mm_loadu_si128((const __m128i *)(data + 2 * i + 16));
+        ok = _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi16(a, lo16), _mm_cmplt_epi16(a, hi16)),
+                _mm_and_si128(_mm_cmpgt_epi16(b, lo16), _mm_cmplt_epi16(b, hi16)));
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+          return i;
+        }
+        a = _mm_packs_epi16(a, b);
+        break;
+      case MSGPACK_TYPE_U32:
+      case MSGPACK_TYPE_S32:
+        a = _mm_loadu_si128((const __m128i *)(data + 4 * i));
+        b = _mm_loadu_si128((const __m128i *)(data + 4 * i + 16));
+        c = _mm_loadu_si128((const __m128i *)(data + 4 * i + 32));
+        d = _mm_loadu_si128((const __m128i *)(data + 4 * i + 48));
+        ok = _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(a, lo32), _mm_cmplt_epi32(a, hi32)),
+                _mm_and_si128(_mm_cmpgt_epi32(b, lo32), _mm_cmplt_epi32(b, hi32)));
+        ok = _mm_and_si128(ok, _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(c, lo32), _mm_cmplt_epi32(c, hi32)),
+                _mm_and_si128(_mm_cmpgt_epi32(d, lo32), _mm_cmplt_epi32(d, hi32))));
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+          return i;
+        }
+        a = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        break;
+      default:
+        return i;
+    }
+    _mm_storeu_si128((__m128i *)(out + i), a);
+  }
+  return i;
+}
+#else
+static size_t msgpack_fixint_run(uint8_t type, const uint8_t *data, size_t n,
+        uint8_t *out) {
+  (void)type;
+  (void)data;
+  (void)n;
+  (void)out;
+  return 0;
+}
+#endif
+
+/* Store element i of data in its smallest encoding. */
+static void msgpack_put_array_elem(struct msgpack_buffer *mbuf, uint8_t type,
+        const uint8_t *data, size_t i) {
+  int8_t s8;
+  int16_t s16;
+  int32_t s32;
+  int64_t s64;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+
+  switch (type) {
+    case MSGPACK_TYPE_U8:
+      msgpack_put_uinteger(mbuf, data[i]);
+      break;
+    case MSGPACK_TYPE_U16:
+      memcpy(&u16, data + 2 * i, 2);
+      msgpack_put_uinteger(mbuf, u16);
+      break;
+    case MSGPACK_TYPE_U32:
+      memcpy(&u32, data + 4 * i, 4);
+      msgpack_put_uinteger(mbuf, u32);
+      break;
+    case MSGPACK_TYPE_U64:
+      memcpy(&u64, data + 8 * i, 8);
+      msgpack_put_uinteger(mbuf, u64);
+      break;
+    case MSGPACK_TYPE_S8:
+      memcpy(&s8, data + i, 1);
+      msgpack_put_integer(mbuf, s8);
+      break;
+    case MSGPACK_TYPE_S16:
+      memcpy(&s16, data + 2 * i, 2);
+      msgpack_put_integer(mbuf, s16);
+      break;
+    case MSGPACK_TYPE_S32:
+      memcpy(&s32, data + 4 * i, 4);
+      msgpack_put_integer(mbuf, s32);
+      break;
+    default:
+      memcpy(&s64, data + 8 * i, 8);
+      msgpack_put_integer(mbuf, s64);
+      break;
+  }
+}
+
+/* The size of element i of data in its smallest encoding. */
+static size_t msgpack_array_elem_size(uint8_t type, const uint8_t *data,
+        size_t i) {
+  int8_t s8;
+  int16_t s16;
+  int32_t s32;
+  int64_t s64;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+
+  switch (type) {
+    case MSGPACK_TYPE_U8:
+      return msgpack_sizeof_uinteger(data[i]);
+    case MSGPACK_TYPE_U16:
+      memcpy(&u16, data + 2 * i, 2);
+      return msgpack_sizeof_uinteger(u16);
+    case MSGPACK_TYPE_U32:
+      memcpy(&u32, data + 4 * i, 4);
+      return msgpack_sizeof_uinteger(u32);
+    case MSGPACK_TYPE_U64:
+      memcpy(&u64, data + 8 * i, 8);
+      return msgpack_sizeof_uinteger(u64);
+    case MSGPACK_TYPE_S8:
+      memcpy(&s8, data + i, 1);
+      return msgpack_sizeof_integer(s8);
+    case MSGPACK_TYPE_S16:
+      memcpy(&s16, data + 2 * i, 2);
+      return msgpack_sizeof_integer(s16);
+    case MSGPACK_TYPE_S32:
+      memcpy(&s32, data + 4 * i, 4);
+      return msgpack_sizeof_integer(s32);
+    default:
+      memcpy(&s64, data + 8 * i, 8);
+      return msgpack_sizeof_integer(s64);
+  }
+}
+
+bool msgpack_write_typed_array(struct msgpack_buffer *mbuf, uint8_t type,
+        const void *data, uint32_t n, bool compact) {
+  const uint8_t *p = data;
+  uint8_t tag;
+  size_t size;
+  size_t i;
+  size_t end;
+
+  if (!mbuf || (!data && n > 0) || !msgpack_array_elem(type, &tag, &size)) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if ((size_t)n > (SIZE_MAX - 5) / (1 + size)) {
+    set_errno(&mbuf->err, MSGPACK_ENOBUF);
+    return false;
+  }
+  if (msgpack_buffer_counting(mbuf)) {
+    if (!compact || type == MSGPACK_TYPE_SINGLE || type == MSGPACK_TYPE_DOUBLE) {
+      return msgpack_buffer_count(mbuf,
+              msgpack_sizeof_arr(n) + (size_t)n * (1 + size));
+    }
+    size = msgpack_sizeof_arr(n);
+    for (i = 0; i < n; ++i) {
+      size += msgpack_array_elem_size(type, p, i);
+    }
+    return msgpack_buffer_count(mbuf, size);
+  }
+  /* The smallest encoding is never longer than the fixed one. */
+  if (!msgpack_reserve(mbuf, 5 + (size_t)n * (1 + size))) {
+    return false;
+  }
+
+  msgpack_put_len_data(mbuf, msgpack_arr_type(n), NULL, n,
+          msgpack_arr_lensize(n));
+  if (!compact || type == MSGPACK_TYPE_SINGLE || type == MSGPACK_TYPE_DOUBLE) {
+    msgpack_put_fixed_array(mbuf, tag, p, n, size);
+  } else {
+    i = 0;
+    while (i < n) {
+      end = msgpack_fixint_run(type, p + i * size, n - i,
+              mbuf->buf + mbuf->len);
+      mbuf->len += end;
+      i += end;
+      /* A block with a wider value, or the tail, goes one by one. */
+      end = i + MSGPACK_FIXINT_BLOCK < n ? i + MSGPACK_FIXINT_BLOCK : n;
+      for (; i < end; ++i) {
+        msgpack_put_array_elem(mbuf, type, p, i);
+      }
+    }
+  }
+
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  return true;
+}
+
+#if MSGPACK_SCAN_AVX2 || MSGPACK_SCAN_SSE2
+/**
+ * Widen the leading blocks of MSGPACK_FIXINT_BLOCK bytes of p that are all
+ * fixints into out, as int64_t or double. Returns the number of values read.
+ */
+static size_t msgpack_fixint_widen(const uint8_t *p, size_t n, void *out,
+        bool is_double) {
+  const __m128i lo = _mm_set1_epi8(-33);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i x, sign, w16[2], w32[4], s32, w64;
+  size_t i = 0;
+  int j;
+  int k;
+
+  for (; i + MSGPACK_FIXINT_BLOCK <= n; i += MSGPACK_FIXINT_BLOCK) {
+    x = _mm_loadu_si128((const __m128i *)(p + i));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(x, lo)) != 0xFFFF) {
+      break;
+    }
+    sign = _mm_cmpgt_epi8(zero, x);
+    w16[0] = _mm_unpacklo_epi8(x, sign);
+    w16[1] = _mm_unpackhi_epi8(x, sign);
+    for (j = 0; j < 2; ++j) {
+      sign = _mm_cmpgt_epi16(zero, w16[j]);
+      w32[2 * j] = _mm_unpacklo_epi16(w16[j], sign);
+      w32[2 * j + 1] = _mm_unpackhi_epi16(w16[j], sign);
+    }
+    for (j = 0; j < 4; ++j) {
+      if (is_double) {
+        _mm_storeu_pd((double *)out + i + 4 * j, _mm_cvtepi32_pd(w32[j]));
+        _mm_storeu_pd((double *)out + i + 4 * j + 2,
+                _mm_cvtepi32_pd(_mm_unpackhi_epi64(w32[j], w32[j])));
+        continue;
+      }
+      s32 = _mm_cmpgt_epi32(zero, w32[j]);
+      for (k = 0; k < 2; ++k) {
+        w64 = k ? _mm_unpackhi_epi32(w32[j], s32) : _mm_unpacklo_epi32(w32[j], s32);
+        _mm_storeu_si128((__m128i *)((int64_t *)out + i + 4 * j + 2 * k), w64);
+      }
+    }
+  }
+  return i;
+}
+#else
+static size_t msgpack_fixint_widen(const uint8_t *p, size_t n, void *out,
+        bool is_double) {
+  (void)p;
+  (void)n;
+  (void)out;
+  (void)is_double;
+  return 0;
+}
+#endif
+
+/**
+ * Read the array at up->pos into out, as int64_t or double. *len is the
+ * room of out, then the count, or the index of the bad element.
+ */
+static bool msgpack_unpack_numbers(struct msgpack_unpacker *up, void *out,
+        bool is_double, uint32_t *len) {
+  const struct msgpack_tag *tag;
+  const uint8_t *buf;
+  uint64_t word;
+  uint32_t bits;
+  uint32_t count;
+  uint32_t i;
+  uint32_t end;
+  size_t pos;
+  size_t size;
+  size_t run;
+  double dv;
+  float fv;
+  int code;
+
+  if (!up || !len || (!out && *len > 0)) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  buf = up->buf;
+  pos = up->pos;
+  if (pos >= up->len) {
+    code = MSGPACK_EENDBUF;
+    goto error;
+  }
+  tag = &msgpack_tags[buf[pos]];
+  if (tag->type != MSGPACK_TYPE_ARRAY) {
+    code = MSGPACK_EUNEXPECTED;
+    goto error;
+  }
+  if (tag->len_size > up->len - pos - 1) {
+    code = MSGPACK_EENDBUF;
+    goto error;
+  }
+  count = (uint32_t)msgpack_item_children(buf + pos);
+  if (count > *len) {
+    *len = count;
+    code = MSGPACK_ENOBUF;
+    goto error;
+  }
+  pos += 1 + tag->len_size;
+
+  i = 0;
+  end = 0;
+  while (i < count) {
+    if (i == end) {
+      /* Every value takes a byte at least, so the run can not over read. */
+      run = count - i < up->len - pos ? count - i : up->len - pos;
+      run = msgpack_fixint_widen(buf + pos, run, is_double ?
+              (void *)((double *)out + i) : (void *)((int64_t *)out + i),
+              is_double);
+      pos += run;
+      i += (uint32_t)run;
+      /* A block with a wider value, or the tail, goes one by one. */
+      end = count - i > MSGPACK_FIXINT_BLOCK ? i + MSGPACK_FIXINT_BLOCK : count;
+      if (i == count) {
+        break;
+      }
+    }
+
+    if (pos >= up->len) {
+      code = MSGPACK_EENDBUF;
+      goto error;
+    }
+    /* Arrays of doubles are the common case of the double reader. */
+    if (is_double && buf[pos] == DOUBLE_TAG && up->len - pos > 8) {
+      word = msgpack_load_be64(buf + pos + 1);
+      memcpy((double *)out + i, &word, sizeof(word));
+      pos += 9;
+      ++i;
+      continue;
+    }
+    tag = &msgpack_tags[buf[pos]];
+    if ((tag->flags & TAG_INLINE) && tag->type != MSGPACK_TYPE_BOOL) {
+      word = (uint64_t)(int64_t)(int8_t)buf[pos];
+      size = 1;
+    } else if ((tag->flags & TAG_ENDIAN) && (type_mask(tag->type) ==
+            MSGPACK_TYPE_INTEGER || (is_double && type_mask(tag->type) ==
+            MSGPACK_TYPE_FLOAT))) {
+      size = 1 + tag->size;
+      if (size > up->len - pos) {
+        code = MSGPACK_EENDBUF;
+        goto error;
+      }
+      switch (tag->size) {
+        case 1: word = buf[pos + 1]; break;
+        case 2: word = msgpack_load_be16(buf + pos + 1); break;
+        case 4: word = msgpack_load_be32(buf + pos + 1); break;
+        default: word = msgpack_load_be64(buf + pos + 1); break;
+      }
+      switch (tag->type) {
+        case MSGPACK_TYPE_S8: word = (uint64_t)(int64_t)(int8_t)word; break;
+        case MSGPACK_TYPE_S16: word = (uint64_t)(int64_t)(int16_t)word; break;
+        case MSGPACK_TYPE_S32: word = (uint64_t)(int64_t)(int32_t)word; break;
+        default: break;
+      }
+    } else {
+      *len = i;
+      code = MSGPACK_EUNEXPECTED;
+      goto error;
+    }
+
+    if (!is_double) {
+      if (tag->type == MSGPACK_TYPE_U64 && word > INT64_MAX) {
+        *len = i;
+        code = MSGPACK_EUNEXPECTED;
+        goto error;
+      }
+      ((int64_t *)out)[i] = (int64_t)word;
+    } else {
+      switch (tag->type) {
+        case MSGPACK_TYPE_SINGLE:
+          bits = (uint32_t)word;
+          memcpy(&fv, &bits, sizeof(fv));
+          dv = fv;
+          break;
+        case MSGPACK_TYPE_DOUBLE:
+          memcpy(&dv, &word, sizeof(dv));
+          break;
+        case MSGPACK_TYPE_U64:
+          dv = (double)word;
+          break;
+        default:
+          dv = (double)(int64_t)word;
+          break;
+      }
+      ((double *)out)[i] = dv;
+    }
+    pos += size;
+    ++i;
+  }
+
+  *len = count;
+  up->pos = pos;
+  set_errno(&up->err, MSGPACK_EOK);
+  return true;
+
+error:
+  set_errno(&up->err, code);
+  return false;
+}
+
+bool msgpack_unpack_int64_array(struct msgpack_unpacker *up, int64_t *data,
+        uint32_t *len) {
+  return msgpack_unpack_numbers(up, data, false, len);
+}
+
+bool msgpack_unpack_double_array(struct msgpack_unpacker *up, double *data,
+        uint32_t *len) {
+  return msgpack_unpack_numbers(up, data, true, len);
+}
+
+/**
+ * @}
+ */
+
+#if MSGPACK_BUFFER_POOL
+#ifndef MSGPACK_THREAD_LOCAL
+#error "MSGPACK_BUFFER_POOL needs thread local storage"
+#endif
+
+union msgpack_pool_block {
+  struct {
+    union msgpack_pool_block *next; /* on a free list */
+    size_t size; /* the bytes after the header */
+    uint32_t cls; /* MSGPACK_POOL_CLASSES when over the largest class */
+  } h;
+  uint64_t align_u;
+  double align_f;
+};
+
+/* The free lists of a thread, for the one pool it is bound to. */
+struct msgpack_pool_cache {
+  struct msgpack_pool *pool;
+  union msgpack_pool_block *free[MSGPACK_POOL_CLASSES];
+  uint32_t count[MSGPACK_POOL_CLASSES];
+  uint32_t blocks;
+};
+
+static MSGPACK_THREAD_LOCAL struct msgpack_pool_cache g_pool_cache;
+
+#define msgpack_pool_class_size(cls) ((size_t)MSGPACK_BUFFER_MIN_ALLOC << (cls))
+
+static uint32_t msgpack_pool_class(size_t size) {
+  uint32_t cls = 0;
+
+  while (cls < MSGPACK_POOL_CLASSES && msgpack_pool_class_size(cls) < size) {
+    ++cls;
+  }
+  return cls;
+}
+
+/* The cache may hold pool's blocks when it is empty or already bound. */
+static struct msgpack_pool_cache *msgpack_pool_bind(struct msgpack_pool *pool) {
+  struct msgpack_pool_cache *cache = &g_pool_cache;
+
+  if (cache->pool != pool) {
+    if (cache->blocks > 0) {
+      return NULL;
+    }
+    cache->pool = pool;
+  }
+  return cache;
+}
+
+/* Push the chain first ... last on the lock-free stack of cls. */
+static void msgpack_pool_push(struct msgpack_pool *pool, uint32_t cls,
+        union msgpack_pool_block *first, union msgpack_pool_block *last) {
+  union msgpack_pool_block *head;
+
+  head = __atomic_load_n(&pool->returned[cls], __ATOMIC_RELAXED);
+  do {
+    last->h.next = head;
+  } while (!__atomic_compare_exchange_n(&pool->returned[cls], &head, first,
+          true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Account size bytes taken from (or given back to) the allocator. */
+static void msgpack_pool_count(struct msgpack_pool *pool, size_t size,
+        bool taken) {
+  size_t allocated;
+  size_t high;
+
+  if (!taken) {
+    __atomic_fetch_add(&pool->stats.frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool->stats.allocated, size, __ATOMIC_RELAXED);
+    return;
+  }
+
+  __atomic_fetch_add(&pool->stats.allocs, 1, __ATOMIC_RELAXED);
+  allocated = __atomic_add_fetch(&pool->stats.allocated, size, __ATOMIC_RELAXED);
+  high = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+  while (allocated > high && !__atomic_compare_exchange_n(
+          &pool->stats.high_water, &high, allocated, true, __ATOMIC_RELAXED,
+          __ATOMIC_RELAXED)) {
+  }
+}
+
+/**
+ * Keep the chain on the cache up to MSGPACK_POOL_CACHE_BLOCKS, and give the
+ * rest back to the pool.
+ */
+static void msgpack_pool_keep(struct msgpack_pool *pool,
+        struct msgpack_pool_cache *cache, uint32_t cls,
+        union msgpack_pool_block *first) {
+  union msgpack_pool_block *last;
+  union msgpack_pool_block *rest;
+  uint32_t room = 0;
+  uint32_t n = 1;
+
+  if (cache && cache->count[cls] < MSGPACK_POOL_CACHE_BLOCKS) {
+    room = MSGPACK_POOL_CACHE_BLOCKS - cache->count[cls];
+  }
+  if (room > 0) {
+    for (last = first; n < room && last->h.next; last = last->h.next) {
+      ++n;
+    }
+    rest = last->h.next;
+    last->h.next = cache->free[cls];
+    cache->free[cls] = first;
+    cache->count[cls] += n;
+    cache->blocks += n;
+    first = rest;
+  }
+  if (first) {
+    for (last = first; last->h.next; last = last->h.next) {
+    }
+    msgpack_pool_push(pool, cls, first, last);
+  }
+}
+
+/**
+ * A block of at least size bytes: from the thread's free list, else from
+ * the blocks given back to the pool, else from the allocator.
+ */
+static union msgpack_pool_block *msgpack_pool_take(struct msgpack_pool *pool,
+        size_t size) {
+  struct msgpack_pool_cache *cache;
+  union msgpack_pool_block *block = NULL;
+  uint32_t cls = msgpack_pool_class(size);
+
+  if (cls < MSGPACK_POOL_CLASSES) {
+    size = msgpack_pool_class_size(cls);
+    cache = msgpack_pool_bind(pool);
+    if (cache && cache->free[cls]) {
+      block = cache->free[cls];
+      cache->free[cls] = block->h.next;
+      cache->count[cls]--;
+      cache->blocks--;
+    } else if (__atomic_load_n(&pool->returned[cls], __ATOMIC_RELAXED)) {
+      /* Taking the whole stack cannot see a block popped and pushed again. */
+      block = __atomic_exchange_n(&pool->returned[cls], NULL, __ATOMIC_ACQUIRE);
+      if (block && block->h.next) {
+        msgpack_pool_keep(pool, cache, cls, block->h.next);
+      }
+    }
+    if (block) {
+      return block;
+    }
+  }
+
+  if (size > (size_t)-1 - sizeof(*block)) {
+    return NULL;
+  }
+  block = (union msgpack_pool_block *)pool->backing->realloc(pool->backing->ud,
+          NULL, sizeof(*block) + size);
+  if (!block) {
+    return NULL;
+  }
+  block->h.size = size;
+  block->h.cls = cls;
+  msgpack_pool_count(pool, size, true);
+  return block;
+}
+
+static void msgpack_pool_give(struct msgpack_pool *pool,
+        union msgpack_pool_block *block) {
+  struct msgpack_pool_cache *cache;
+  uint32_t cls = block->h.cls;
+
+  if (cls == MSGPACK_POOL_CLASSES) {
+    msgpack_pool_count(pool, block->h.size, false);
+    pool->backing->free(pool->backing->ud, block);
+    return;
+  }
+
+  cache = msgpack_pool_bind(pool);
+  if (cache && cache->count[cls] < MSGPACK_POOL_CACHE_BLOCKS) {
+    block->h.next = cache->free[cls];
+    cache->free[cls] = block;
+    cache->count[cls]++;
+    cache->blocks++;
+  } else {
+    msgpack_pool_push(pool, cls, block, block);
+  }
+}
+
+static void *msgpack_pool_realloc(void *ud, void *ptr, size_t size) {
+  union msgpack_pool_block *block = NULL;
+  union msgpack_pool_block *fresh;
+
+  if (ptr) {
+    block = (union msgpack_pool_block *)ptr - 1;
+    if (size <= block->h.size) {
+      return ptr;
+    }
+  }
+
+  fresh = msgpack_pool_take((struct msgpack_pool *)ud, size);
+  if (!fresh) {
+    return NULL;
+  }
+  if (block) {
+    memcpy(fresh + 1, ptr, block->h.size);
+    msgpack_pool_give((struct msgpack_pool *)ud, block);
+  }
+  return fresh + 1;
+}
+
+static void msgpack_pool_free(void *ud, void *ptr) {
+  if (ptr) {
+    msgpack_pool_give((struct msgpack_pool *)ud,
+            (union msgpack_pool_block *)ptr - 1);
+  }
+}
+
+void msgpack_pool_init(struct msgpack_pool *pool,
+        const struct msgpack_allocator *backing) {
+  if (!pool || !backing || !backing->realloc || !backing->free) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return;
+  }
+
+  memset(pool, 0, sizeof(*pool));
+  pool->allocator.realloc = msgpack_pool_realloc;
+  pool->allocator.free = msgpack_pool_free;
+  pool->allocator.ud = pool;
+  pool->backing = backing;
+  set_errno(NULL, MSGPACK_EOK);
+}
+
+void msgpack_pool_flush(struct msgpack_pool *pool) {
+  struct msgpack_pool_cache *cache = &g_pool_cache;
+  union msgpack_pool_block *last;
+  uint32_t cls;
+
+  if (!pool || cache->pool != pool) {
+    return;
+  }
+
+  for (cls = 0; cls < MSGPACK_POOL_CLASSES; ++cls) {
+    if (cache->free[cls]) {
+      for (last = cache->free[cls]; last->h.next; last = last->h.next) {
+      }
+      msgpack_pool_push(pool, cls, cache->free[cls], last);
+    }
+  }
+  memset(cache, 0, sizeof(*cache));
+}
+
+bool msgpack_pool_destroy(struct msgpack_pool *pool) {
+  union msgpack_pool_block *block;
+  union msgpack_pool_block *next;
+  uint32_t cls;
+
+  if (!pool) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  msgpack_pool_flush(pool);
+  for (cls = 0; cls < MSGPACK_POOL_CLASSES; ++cls) {
+    block = __atomic_exchange_n(&pool->returned[cls], NULL, __ATOMIC_ACQUIRE);
+    for (; block; block = next) {
+      next = block->h.next;
+      msgpack_pool_count(pool, block->h.size, false);
+      pool->backing->free(pool->backing->ud, block);
+    }
+  }
+
+  /* What is left is in buffers or on the lists of threads not flushed. */
+  if (__atomic_load_n(&pool->stats.allocated, __ATOMIC_RELAXED) > 0) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return false;
+  }
+  set_errno(NULL, MSGPACK_EOK);
+  return true;
+}
+
+void msgpack_pool_get_stats(const struct msgpack_pool *pool,
+        struct msgpack_pool_stats *stats) {
+  if (!pool || !stats) {
+    set_errno(NULL, MSGPACK_EINVL);
+    return;
+  }
+
+  stats->allocated = __atomic_load_n(&pool->stats.allocated, __ATOMIC_RELAXED);
+  stats->high_water = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+  stats->allocs = __atomic_load_n(&pool->stats.allocs, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&pool->stats.frees, __ATOMIC_RELAXED);
+  set_errno(NULL, MSGPACK_EOK);
+}
+#endif
+
+static bool msgpack_container_begin(struct msgpack_buffer *mbuf,
+        struct msgpack_container *c, uint8_t tag) {
+  if (!mbuf || !c) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  c->pos = mbuf->len;
+  c->tag = tag;
+  return msgpack_len_data(mbuf, tag, NULL, 0, 4);
+}
+
+bool msgpack_write_arr_begin(struct msgpack_buffer *mbuf,
+        struct msgpack_container *c) {
+  return msgpack_container_begin(mbuf, c, ARRAY32_TAG);
+}
+
+bool msgpack_write_map_begin(struct msgpack_buffer *mbuf,
+        struct msgpack_container *c) {
+  return msgpack_container_begin(mbuf, c, MAP32_TAG);
+}
+
+bool msgpack_write_end(struct msgpack_buffer *mbuf,
+        const struct msgpack_container *c, uint32_t count, bool compact) {
+  size_t len_size;
+  size_t shift;
+  uint8_t tag;
+  uint8_t *p;
+
+  if (!mbuf || !c || (c->tag != ARRAY32_TAG && c->tag != MAP32_TAG) ||
+      c->pos > mbuf->len || mbuf->len - c->pos < 5 ||
+      (mbuf->buf && mbuf->buf[c->pos] != c->tag)) {
+    set_errno(mbuf ? &mbuf->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (c->tag == ARRAY32_TAG) {
+    len_size = msgpack_arr_lensize(count);
+    tag = msgpack_arr_type(count);
+  } else {
+    len_size = msgpack_map_lensize(count);
+    tag = msgpack_map_type(count);
+  }
+  /* Bytes already cut into iov entries can not move. */
+  if (!compact || (mbuf->iov && mbuf->iov->mark > c->pos)) {
+    len_size = 4;
+    tag = c->tag;
+  }
+  shift = 4 - len_size;
+
+  if (msgpack_buffer_counting(mbuf)) {
+    mbuf->len -= shift;
+    set_errno(&mbuf->err, MSGPACK_EOK);
+    return true;
+  }
+
+  p = mbuf->buf + c->pos;
+  if (shift > 0) {
+    memmove(p + 1 + len_size, p + 5, mbuf->len - c->pos - 5);
+    mbuf->len -= shift;
+  }
+  switch (len_size) {
+    case 0: *p = tag | (uint8_t)count; break;
+    case 2: *p = tag; msgpack_store_be16(p + 1, (uint16_t)count); break;
+    default: *p = tag; msgpack_store_be32(p + 1, count); break;
+  }
+  set_errno(&mbuf->err, MSGPACK_EOK);
+  return true;
+}
+
+#if MSGPACK_SCAN_AVX2 || MSGPACK_SCAN_SSE2
+/* The leading blocks of MSGPACK_FIXINT_BLOCK bytes of p that are fixints. */
+static size_t msgpack_fixint_span(const uint8_t *p, size_t n) {
+  const __m128i lo = _mm_set1_epi8(-33);
+  size_t i = 0;
+
+  for (; i + MSGPACK_FIXINT_BLOCK <= n; i += MSGPACK_FIXINT_BLOCK) {
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(
+            _mm_loadu_si128((const __m128i *)(p + i)), lo)) != 0xFFFF) {
+      break;
+    }
+  }
+  return i;
+}
+#else
+static size_t msgpack_fixint_span(const uint8_t *p, size_t n) {
+  (void)p;
+  (void)n;
+  return 0;
+}
+#endif
+
+/**
+ * Like msgpack_skip_at(), one loop over the headers, with the values left
+ * in each open container kept on a stack to know the depth.
+ */
+bool msgpack_validate(struct msgpack_unpacker *up,
+        const struct msgpack_limits *limits) {
+  uint64_t left[MSGPACK_PARSE_MAX_DEPTH + 1];
+  const struct msgpack_tag *tag;
+  const uint8_t *buf;
+  size_t elements = 0;
+  size_t end;
+  size_t p;
+  size_t size;
+  uint64_t count;
+  uint32_t max_depth;
+  uint32_t depth = 0;
+  uint32_t len;
+  int code;
+
+  if (!up || !limits) {
+    set_errno(up ? &up->err : NULL, MSGPACK_EINVL);
+    return false;
+  }
+
+  if (!up->buf) {
+    set_errno(&up->err, MSGPACK_EINIT);
+    return false;
+  }
+
+  buf = up->buf;
+  p = up->pos;
+  end = up->len;
+  if (p < end && limits->max_size < end - p) {
+    end = p + limits->max_size;
+  }
+  max_depth = limits->max_depth < MSGPACK_PARSE_MAX_DEPTH ?
+          limits->max_depth : MSGPACK_PARSE_MAX_DEPTH;
+  left[0] = 1;
+
+  for (;;) {
+    if (p >= end) {
+      goto out_of_bytes;
+    }
+    tag = &msgpack_tags[buf[p]];
+    if (tag->flags & TAG_BAD) {
+      code = MSGPACK_EUNKNOWN;
+      goto error;
+    }
+
+    if (tag->flags & TAG_COUNT) {
+      size = 1 + (size_t)tag->len_size;
+      if (size > end - p) {
+        goto out_of_bytes;
+      }
+      count = msgpack_item_children(buf + p);
+      if (count > limits->max_elements - elements) {
+        code = MSGPACK_ELIMIT;
+        goto error;
+      }
+      left[depth]--;
+      /* An empty container does not nest anything. */
+      if (count > 0) {
+        if (depth == max_depth) {
+          code = MSGPACK_ELIMIT;
+          goto error;
+        }
+        /* Every value takes a byte at least. */
+        if (count > end - p - size) {
+          goto out_of_bytes;
+        }
+        elements += (size_t)count;
+        left[++depth] = count;
+      }
+      p += size;
+    } else {
+      size = 1 + (size_t)tag->len_size + ((tag->flags & TAG_EXT) ? 1 : 0);
+      if (tag->len_size > 0) {
+        if (end - p <= tag->len_size) {
+          goto out_of_bytes;
+        }
+        len = msgpack_tag_len(buf + p + 1, tag->len_size);
+      } else {
+        len = (tag->flags & TAG_INLINE) ? 0 : tag->size;
+      }
+      if (len > limits->max_str && (tag->type == MSGPACK_TYPE_STR ||
+          tag->type == MSGPACK_TYPE_BIN || (tag->flags & TAG_EXT))) {
+        code = MSGPACK_ELIMIT;
+        goto error;
+      }
+      size += len;
+      if (size > end - p) {
+        goto out_of_bytes;
+      }
+      left[depth]--;
+      p += size;
+      /* Arrays of small integers go 16 values at a time. */
+      if ((tag->flags & TAG_INLINE) && left[depth] >= MSGPACK_FIXINT_BLOCK) {
+        size = msgpack_fixint_span(buf + p,
+                left[depth] < end - p ? (size_t)left[depth] : end - p);
+        left[depth] -= size;
+        p += size;
+      }
+    }
+
+    while (left[depth] == 0) {
+      if (depth == 0) {
+        up->pos = p;
+        set_errno(&up->err, MSGPACK_EOK);
+        return true;
+      }
+      --depth;
+    }
+  }
+
+out_of_bytes:
+  code = end < up->len ? MSGPACK_ELIMIT : MSGPACK_EENDBUF;
+error:
+  set_errno(&up->err, code);
+  return false;
+}
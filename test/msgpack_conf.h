@@ -25,4 +25,8 @@
 #define MSGPACK_SIZE_OPT (1)
  #endif
 
+/* Assert the bounds of the unchecked msgpack_put_* writers. */
+#ifndef MSGPACK_DEBUG
+#define MSGPACK_DEBUG (1)
+#endif
 
@@ -0,0 +1,203 @@
+/*
+ *  Copyright (c) 2016 - 2017  seawolflin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string>
+
+#include "msgpack.hpp"
+#include "test.h"
+
+#define TEST_HPP_BYTES(expt, pk) \
+  do { \
+    EXPECT_EQ(sizeof(expt), (pk).size()); \
+    EXPECT_EQ(0, memcmp(expt, (pk).data(), sizeof(expt))); \
+  } while(0)
+
+TEST(msgpack_hpp, pack_integer) {
+  uint8_t buf[64];
+
+  {
+    msgpack::packer pk(buf, sizeof(buf));
+    uint8_t expt[] = {0x7F, 0xCC, 0x80, 0xE0, 0xD0, 0xDF};
+    EXPECT_TRUE(pk.pack(uint8_t(0x7F), uint8_t(0x80), int8_t(-32),
+        int8_t(-33)));
+    TEST_HPP_BYTES(expt, pk);
+  }
+
+  {
+    msgpack::packer pk(buf, sizeof(buf));
+    uint8_t expt[] = {0x01, 0xCD, 0x01, 0x00, 0xCE, 0x00, 0x01, 0x00, 0x00,
+        0xD1, 0xFF, 0x00, 0xD2, 0xFF, 0xFF, 0x00, 0x00};
+    EXPECT_TRUE(pk.pack(uint64_t(1), 256, uint32_t(65536), int16_t(-256),
+        -65536));
+    TEST_HPP_BYTES(expt, pk);
+  }
+
+  {
+    msgpack::packer pk(buf, sizeof(buf));
+    uint8_t expt[] = {0xCF, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0xD3, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    EXPECT_TRUE(pk.pack(uint64_t(1) << 32, INT64_MIN));
+    TEST_HPP_BYTES(expt, pk);
+  }
+
+  {
+    msgpack::packer pk(buf, sizeof(buf));
+    uint8_t expt[] = {0xCD, 0x00, 0x01, 0xD2, 0xFF, 0xFF, 0xFF, 0xFF};
+    EXPECT_TRUE(pk.pack_fixed(uint16_t(1)));
+    EXPECT_TRUE(pk.pack_fixed(int32_t(-1)));
+    TEST_HPP_BYTES(expt, pk);
+  }
+
+  {
+    msgpack::packer pk(buf, 2);
+    EXPECT_TRUE(pk.pack(1, 2));
+    EXPECT_FALSE(pk.pack(3));
+    EXPECT_EQ(MSGPACK_ENOBUF, pk.error());
+  }
+}
+
+TEST(msgpack_hpp, pack_other) {
+  uint8_t buf[64];
+  msgpack::packer pk(buf, sizeof(buf));
+  uint8_t expt[] = {0xC0, 0xC3, 0xC2, 0xCA, 0x3F, 0x80, 0x00, 0x00,
+      0xCB, 0x3F, 0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0xA2, 'h', 'i', 0xA1, 'a', 0xC4, 0x01, 0x07, 0x92, 0x81};
+  const uint8_t blob[] = {0x07};
+
+  EXPECT_TRUE(pk.pack(msgpack::nil, true, false, 1.0f, 1.0,
+      std::string_view("hi"), std::string("a"), msgpack::bin{blob, 1},
+      msgpack::array_header{2}, msgpack::map_header{1}));
+  TEST_HPP_BYTES(expt, pk);
+
+  /* A str longer than its 32 bit length is not cut. */
+  if (sizeof(size_t) > sizeof(uint32_t)) {
+    const size_t len = pk.size();
+    EXPECT_FALSE(pk.pack(std::string_view("x",
+        static_cast<size_t>(UINT32_MAX) + 1)));
+    EXPECT_EQ(MSGPACK_ELIMIT, pk.error());
+    EXPECT_EQ(len, pk.size());
+  }
+}
+
+TEST(msgpack_hpp, pack_growable) {
+  msgpack::packer pk(&msgpack_stdlib_allocator);
+  std::string s(300, 'x');
+  size_t i;
+
+  for (i = 0; i < 100; i++) {
+    EXPECT_TRUE(pk.pack(int(i), s));
+  }
+  EXPECT_EQ(100u * (1 + 3 + 300), pk.size());
+  EXPECT_EQ(0, memcmp(pk.data() + pk.size() - 300, s.data(), 300));
+}
+
+TEST(msgpack_hpp, unpack) {
+  uint8_t buf[128];
+  msgpack::packer pk(buf, sizeof(buf));
+  uint8_t u8 = 0;
+  int16_t s16 = 0;
+  uint32_t u32 = 0;
+  int64_t s64 = 0;
+  bool b = false;
+  float f = 0;
+  double d = 0;
+  std::string_view s;
+  msgpack::bin bin = {NULL, 0};
+  msgpack::array_header arr = {0};
+  msgpack::map_header map = {0};
+  msgpack::nil_t nil;
+  const uint8_t blob[] = {1, 2, 3};
+
+  EXPECT_TRUE(pk.pack(200, -300, 70000, INT64_MIN, true, 1.5f, 2.5, "str",
+      msgpack::bin{blob, 3}, msgpack::array_header{17},
+      msgpack::map_header{0}, msgpack::nil));
+
+  msgpack::unpacker up(pk.data(), pk.size());
+  EXPECT_TRUE(up.unpack(u8, s16, u32, s64, b, f, d, s, bin, arr, map, nil));
+  EXPECT_EQ(200, u8);
+  EXPECT_EQ(-300, s16);
+  EXPECT_EQ(70000u, u32);
+  EXPECT_EQ(INT64_MIN, s64);
+  EXPECT_TRUE(b);
+  EXPECT_EQ(1.5f, f);
+  EXPECT_EQ(2.5, d);
+  EXPECT_TRUE(s == "str");
+  EXPECT_EQ(3u, bin.size);
+  EXPECT_EQ(0, memcmp(blob, bin.data, 3));
+  EXPECT_EQ(17u, arr.size);
+  EXPECT_EQ(0u, map.size);
+  EXPECT_TRUE(up.at_end());
+  EXPECT_FALSE(up.unpack(u8));
+  EXPECT_EQ(MSGPACK_EENDBUF, up.error());
+}
+
+TEST(msgpack_hpp, unpack_range) {
+  uint8_t buf[64];
+  msgpack::packer pk(buf, sizeof(buf));
+  int8_t s8 = 0;
+  uint16_t u16 = 0;
+  double d = 0;
+  std::string_view s;
+
+  EXPECT_TRUE(pk.pack(300, -1, 1.0f, 5));
+
+  msgpack::unpacker up(pk.data(), pk.size());
+  EXPECT_FALSE(up.unpack(s8));
+  EXPECT_EQ(MSGPACK_EUNEXPECTED, up.error());
+  EXPECT_EQ(0u, up.position());
+  EXPECT_TRUE(up.unpack(u16));
+  EXPECT_EQ(300, u16);
+
+  EXPECT_FALSE(up.unpack(u16));
+  EXPECT_EQ(MSGPACK_EUNEXPECTED, up.error());
+  EXPECT_TRUE(up.unpack(s8));
+  EXPECT_EQ(-1, s8);
+
+  EXPECT_TRUE(up.unpack(d));
+  EXPECT_EQ(1.0, d);
+
+  EXPECT_FALSE(up.unpack(s));
+  EXPECT_EQ(MSGPACK_EUNEXPECTED, up.error());
+  EXPECT_TRUE(up.skip());
+  EXPECT_TRUE(up.at_end());
+
+  uint8_t cut[] = {0xCD, 0x01};
+  msgpack::unpacker up2(cut, sizeof(cut));
+  EXPECT_FALSE(up2.unpack(u16));
+  EXPECT_EQ(MSGPACK_EENDBUF, up2.error());
+}
+
+DECLARE_TEST(msgpack_hpp, pack_integer);
+DECLARE_TEST(msgpack_hpp, pack_other);
+DECLARE_TEST(msgpack_hpp, pack_growable);
+DECLARE_TEST(msgpack_hpp, unpack);
+DECLARE_TEST(msgpack_hpp, unpack_range);
+
+int main() {
+  RUN_TEST(msgpack_hpp, pack_integer);
+  RUN_TEST(msgpack_hpp, pack_other);
+  RUN_TEST(msgpack_hpp, pack_growable);
+  RUN_TEST(msgpack_hpp, unpack);
+  RUN_TEST(msgpack_hpp, unpack_range);
+
+  return 0;
+}
@@ -20,6 +20,7 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
 #include <string.h>
 
 #include "msgpack.h"
@@ -499,5 +500,1724 @@ TEST(msgpack, error_call) {
     TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xd9\x02", 2);data_len=5;type=MSGPACK_TYPE_INTEGER);
     TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xd9\x02", 2);data_len=5;type=MSGPACK_TYPE_FLOAT);
     TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xcc\x02", 2);data_len=5;type=MSGPACK_TYPE_STR);
-    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNKNOWN, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xd4", 1);data_len=5;type=MSGPACK_TYPE_ANY);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNKNOWN, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xc1", 1);data_len=5;type=MSGPACK_TYPE_ANY);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, buf, 1024, 0, msgpack_unpack(&unpacker, data, &data_len, &type), memcpy(buf, "\xd4\x01\x00", 3);data_len=5;type=MSGPACK_TYPE_ANY);
+}
+
+static int test_realloc_count;
+
+static void *test_realloc(void *ud, void *ptr, size_t size) {
+    (void)ud;
+    test_realloc_count++;
+    return realloc(ptr, size);
+}
+
+static void test_free(void *ud, void *ptr) {
+    (void)ud;
+    free(ptr);
+}
+
+static const msgpack_allocator_t test_allocator = {test_realloc, test_free, NULL};
+
+TEST(msgpack, write_growable) {
+    msgpack_buffer_t mbuf;
+    char str[300];
+    int i;
+
+    memset(str, 'x', sizeof(str));
+    test_realloc_count = 0;
+    init_msgpack_growable_buffer(&mbuf, &test_allocator);
+    EXPECT_TRUE(msgpack_write_nil(&mbuf));
+    EXPECT_EQ(1, test_realloc_count);
+    EXPECT_EQ(MSGPACK_BUFFER_MIN_ALLOC, mbuf.alloc);
+    for (i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(msgpack_write_u32(&mbuf, i));
+    }
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, sizeof(str)));
+    EXPECT_EQ(1 + 1000 * 5 + 3 + sizeof(str), mbuf.len);
+    EXPECT_LE(mbuf.len, mbuf.alloc);
+    EXPECT_LT(test_realloc_count, 16);
+    TEST_CHECK_EQUAL("\xc0\xce\x00\x00\x00\x00", mbuf.buf, 6);
+    TEST_CHECK_EQUAL("\xce\x00\x00\x03\xe7\xda\x01\x2c", mbuf.buf + 1 + 999 * 5, 8);
+    EXPECT_EQ(MSGPACK_EOK, msgpack_errno());
+
+    msgpack_buffer_release(&mbuf);
+    EXPECT_TRUE(mbuf.buf == NULL);
+    EXPECT_EQ(0, mbuf.len);
+    EXPECT_EQ(0, mbuf.alloc);
+
+    init_msgpack_growable_buffer(&mbuf, &msgpack_stdlib_allocator);
+    EXPECT_TRUE(msgpack_write_bin(&mbuf, str, sizeof(str)));
+    EXPECT_EQ(3 + sizeof(str), mbuf.len);
+    msgpack_buffer_release(&mbuf);
+}
+
+TEST(msgpack, context_errno) {
+    uint8_t buf[4];
+    msgpack_buffer_t full;
+    msgpack_buffer_t ok;
+    msgpack_unpacker_t unpacker;
+    uint8_t type;
+    uint32_t data_len;
+
+    init_msgpack_buffer(&full, buf, 0);
+    init_msgpack_buffer(&ok, buf, sizeof(buf));
+    EXPECT_FALSE(msgpack_write_nil(&full));
+    EXPECT_TRUE(msgpack_write_nil(&ok));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_buffer_errno(&full));
+    EXPECT_EQ(MSGPACK_EOK, msgpack_buffer_errno(&ok));
+    EXPECT_EQ(MSGPACK_EOK, msgpack_errno());
+
+    init_msgpack_unpacker(&unpacker, buf, 1, 0);
+    type = MSGPACK_TYPE_BOOL;
+    data_len = 1;
+    EXPECT_FALSE(msgpack_unpack(&unpacker, &type, &data_len, &type));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_errno());
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_buffer_errno(&full));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_unpack(&unpacker, NULL, &data_len, &type));
+    EXPECT_EQ(MSGPACK_EOK, msgpack_unpacker_errno(&unpacker));
+}
+
+TEST(msgpack, endian) {
+    uint8_t buf[9] = {0};
+
+    msgpack_store_be16(buf + 1, 0xa55a);
+    TEST_CHECK_EQUAL("\x00\xa5\x5a", buf, 3);
+    EXPECT_EQ(0xa55a, msgpack_load_be16(buf + 1));
+    msgpack_store_be32(buf + 1, 0xa55a55aa);
+    TEST_CHECK_EQUAL("\x00\xa5\x5a\x55\xaa", buf, 5);
+    EXPECT_EQ(0xa55a55aa, msgpack_load_be32(buf + 1));
+    msgpack_store_be64(buf + 1, 0xa55a55aabbccddeeull);
+    TEST_CHECK_EQUAL("\x00\xa5\x5a\x55\xaa\xbb\xcc\xdd\xee", buf, 9);
+    EXPECT_EQ(0xa55a55aabbccddeeull, msgpack_load_be64(buf + 1));
+}
+
+#define TEST_MSGPACK_PUT_CHECK(expt, expt_len, op) \
+    do { \
+        TEST_INIT_MBUF(&test_mbuf, test_buf, 1024); \
+        EXPECT_TRUE(msgpack_reserve(&test_mbuf, (expt_len))); \
+        op; \
+        TEST_CHECK_EQUAL((expt), test_buf, (expt_len)); \
+        EXPECT_EQ((expt_len), test_mbuf.len); \
+    } while(0)
+
+TEST(msgpack, put) {
+    char str[] = "test";
+    msgpack_buffer_t mbuf;
+    uint8_t buf[8];
+
+    TEST_MSGPACK_PUT_CHECK("\xc0", 1, msgpack_put_nil(&test_mbuf));
+    TEST_MSGPACK_PUT_CHECK("\xc3", 1, msgpack_put_bool(&test_mbuf, true));
+    TEST_MSGPACK_PUT_CHECK("\xc2", 1, msgpack_put_false(&test_mbuf));
+    TEST_MSGPACK_PUT_CHECK("\xe0", 1, msgpack_put_smallint(&test_mbuf, -32));
+    TEST_MSGPACK_PUT_CHECK("\xcc\x80", 2, msgpack_put_u8(&test_mbuf, 0x80));
+    TEST_MSGPACK_PUT_CHECK("\xcd\xa5\x5a", 3, msgpack_put_u16(&test_mbuf, 0xa55a));
+    TEST_MSGPACK_PUT_CHECK("\xce\xa5\x5a\x55\xaa", 5, msgpack_put_u32(&test_mbuf, 0xa55a55aa));
+    TEST_MSGPACK_PUT_CHECK("\xcf\xa5\x5a\x55\xaa\xbb\xcc\xdd\xee", 9, msgpack_put_u64(&test_mbuf, 0xa55a55aabbccddee));
+    TEST_MSGPACK_PUT_CHECK("\xd0\xa6", 2, msgpack_put_s8(&test_mbuf, -0x5a));
+    TEST_MSGPACK_PUT_CHECK("\xd1\xff\x5b", 3, msgpack_put_s16(&test_mbuf, -0xa5));
+    TEST_MSGPACK_PUT_CHECK("\xd2\xaa\xa5\xaa\x56", 5, msgpack_put_s32(&test_mbuf, -0x555a55aa));
+    TEST_MSGPACK_PUT_CHECK("\xd3\xaa\xa5\xaa\x55\x44\x33\x22\x12", 9, msgpack_put_s64(&test_mbuf, -0x555a55aabbccddee));
+    TEST_MSGPACK_PUT_CHECK("\xe0", 1, msgpack_put_integer(&test_mbuf, -32));
+    TEST_MSGPACK_PUT_CHECK("\x7f", 1, msgpack_put_integer(&test_mbuf, 127));
+    TEST_MSGPACK_PUT_CHECK("\xcc\x80", 2, msgpack_put_integer(&test_mbuf, 0x80));
+    TEST_MSGPACK_PUT_CHECK("\xcd\xa5\x5a", 3, msgpack_put_integer(&test_mbuf, 0xa55a));
+    TEST_MSGPACK_PUT_CHECK("\xce\xa5\x5a\x55\xaa", 5, msgpack_put_integer(&test_mbuf, 0xa55a55aa));
+    TEST_MSGPACK_PUT_CHECK("\xd0\x80", 2, msgpack_put_integer(&test_mbuf, -128));
+    TEST_MSGPACK_PUT_CHECK("\xd1\xaa\xa6", 3, msgpack_put_integer(&test_mbuf, -0x555a));
+    TEST_MSGPACK_PUT_CHECK("\xd2\xaa\xa5\xaa\x56", 5, msgpack_put_integer(&test_mbuf, -0x555a55aa));
+    TEST_MSGPACK_PUT_CHECK("\xd3\xaa\xa5\xaa\x55\x44\x33\x22\x12", 9, msgpack_put_integer(&test_mbuf, -0x555a55aabbccddee));
+    TEST_MSGPACK_PUT_CHECK("\xcf\xa5\x5a\x55\xaa\xbb\xcc\xdd\xee", 9, msgpack_put_uinteger(&test_mbuf, 0xa55a55aabbccddee));
+    TEST_MSGPACK_PUT_CHECK("\xca\x40\x2d\xf3\xb6", 5, msgpack_put_float(&test_mbuf, 2.718f));
+    TEST_MSGPACK_PUT_CHECK("\xcb\xc0\x09\x21\xfb\x53\xc8\xd4\xf1", 9, msgpack_put_double(&test_mbuf, -3.14159265));
+    TEST_MSGPACK_PUT_CHECK("\xa4test", 5, msgpack_put_str(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\xd9\x04test", 6, msgpack_put_str8(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\xda\x00\x04test", 7, msgpack_put_str16(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\xdb\x00\x00\x00\x04test", 9, msgpack_put_str32(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\xc4\x04test", 6, msgpack_put_bin(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\xc6\x00\x00\x00\x04test", 9, msgpack_put_bin32(&test_mbuf, str, 4));
+    TEST_MSGPACK_PUT_CHECK("\x9f", 1, msgpack_put_arr(&test_mbuf, 15));
+    TEST_MSGPACK_PUT_CHECK("\xdc\x55\xaa", 3, msgpack_put_arr(&test_mbuf, 0x55aa));
+    TEST_MSGPACK_PUT_CHECK("\xdd\x55\x44\xaa\xbb", 5, msgpack_put_arr(&test_mbuf, 0x5544aabb));
+    TEST_MSGPACK_PUT_CHECK("\x8f", 1, msgpack_put_map(&test_mbuf, 15));
+    TEST_MSGPACK_PUT_CHECK("\xde\x55\xaa", 3, msgpack_put_map16(&test_mbuf, 0x55aa));
+    TEST_MSGPACK_PUT_CHECK("\xdf\x55\x44\xaa\xbb", 5, msgpack_put_map(&test_mbuf, 0x5544aabb));
+
+    init_msgpack_buffer(&mbuf, buf, sizeof(buf));
+    EXPECT_FALSE(msgpack_reserve(&mbuf, sizeof(buf) + 1));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_errno());
+    EXPECT_FALSE(msgpack_reserve(NULL, 1));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_errno());
+    init_msgpack_growable_buffer(&mbuf, &test_allocator);
+    EXPECT_TRUE(msgpack_reserve(&mbuf, 1000));
+    EXPECT_GE(mbuf.alloc, 1000);
+    msgpack_put_nil(&mbuf);
+    msgpack_buffer_release(&mbuf);
+}
+
+#define TEST_MSGPACK_VIEW_CHECK(in, in_len, type, expt_type, expt_data_len, expt_off) \
+    do { \
+        const uint8_t *view = NULL; \
+        memcpy(test_buf, in, in_len); \
+        TEST_INIT_UPR(&test_unpacker, test_buf, in_len, 0); \
+        test_type = type; \
+        EXPECT_TRUE(msgpack_unpack_view(&test_unpacker, &view, &test_data_len, &test_type)); \
+        EXPECT_EQ(expt_type, test_type); \
+        EXPECT_EQ(expt_data_len, test_data_len); \
+        EXPECT_TRUE(view == test_buf + (expt_off)); \
+        EXPECT_EQ((expt_off) + (expt_data_len), test_unpacker.pos); \
+        EXPECT_EQ(MSGPACK_EOK, msgpack_errno()); \
+    } while (0)
+
+TEST(msgpack, read_view) {
+    const uint8_t *view;
+    msgpack_unpacker_t unpacker;
+    uint8_t type;
+    uint32_t data_len;
+
+    TEST_MSGPACK_VIEW_CHECK("\xa0", 1, MSGPACK_TYPE_ANY, MSGPACK_TYPE_STR, 0, 1);
+    TEST_MSGPACK_VIEW_CHECK("\xa4test", 5, MSGPACK_TYPE_ANY, MSGPACK_TYPE_STR, 4, 1);
+    TEST_MSGPACK_VIEW_CHECK("\xd9\x04test", 6, MSGPACK_TYPE_STR, MSGPACK_TYPE_STR, 4, 2);
+    TEST_MSGPACK_VIEW_CHECK("\xda\x00\x04test", 7, MSGPACK_TYPE_ANY, MSGPACK_TYPE_STR, 4, 3);
+    TEST_MSGPACK_VIEW_CHECK("\xdb\x00\x00\x00\x04test", 9, MSGPACK_TYPE_ANY, MSGPACK_TYPE_STR, 4, 5);
+    TEST_MSGPACK_VIEW_CHECK("\xc4\x04test", 6, MSGPACK_TYPE_BIN, MSGPACK_TYPE_BIN, 4, 2);
+    TEST_MSGPACK_VIEW_CHECK("\xc5\x00\x04test", 7, MSGPACK_TYPE_ANY, MSGPACK_TYPE_BIN, 4, 3);
+    TEST_MSGPACK_VIEW_CHECK("\xc6\x00\x00\x00\x04test", 9, MSGPACK_TYPE_ANY, MSGPACK_TYPE_BIN, 4, 5);
+
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, test_buf, 5, 0, msgpack_unpack_view(&unpacker, &view, &data_len, &type), memcpy(test_buf, "\xa4test", 5);type=MSGPACK_TYPE_BIN);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, test_buf, 2, 0, msgpack_unpack_view(&unpacker, &view, &data_len, &type), memcpy(test_buf, "\xcc\x01", 2);type=MSGPACK_TYPE_ANY);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, test_buf, 4, 0, msgpack_unpack_view(&unpacker, &view, &data_len, &type), memcpy(test_buf, "\xa4test", 5);type=MSGPACK_TYPE_ANY);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, test_buf, 2, 0, msgpack_unpack_view(&unpacker, &view, &data_len, &type), memcpy(test_buf, "\xda\x00\x04", 3);type=MSGPACK_TYPE_ANY);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EINVL, &unpacker, test_buf, 5, 0, msgpack_unpack_view(&unpacker, NULL, &data_len, &type), type=MSGPACK_TYPE_ANY);
+}
+
+TEST(msgpack, read_stream) {
+    uint8_t msg[128];
+    uint8_t stage[40];
+    msgpack_buffer_t mbuf;
+    msgpack_stream_t st;
+    const uint8_t *view;
+    uint8_t type;
+    uint32_t len;
+    int64_t val;
+    char str[32];
+    size_t chunk;
+    size_t fed;
+    size_t n;
+    int items;
+
+    init_msgpack_buffer(&mbuf, msg, sizeof(msg));
+    msgpack_write_arr(&mbuf, 4);
+    msgpack_write_integer(&mbuf, 0x55aa55aa);
+    msgpack_write_str(&mbuf, "streaming unpacker", 18);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_bin(&mbuf, "0123456789abcdef0123456789abcdef", 32);
+    msgpack_write_integer(&mbuf, -0x5a);
+
+    for (chunk = 1; chunk <= mbuf.len; ++chunk) {
+        init_msgpack_stream(&st, stage, sizeof(stage));
+        fed = 0;
+        items = 0;
+        while (items < 6) {
+            len = sizeof(str);
+            type = MSGPACK_TYPE_ANY;
+            val = 0;
+            if (items == 4) {
+                if (!msgpack_stream_unpack_view(&st, &view, &len, &type)) {
+                    goto feed;
+                }
+                EXPECT_EQ(MSGPACK_TYPE_BIN, type);
+                EXPECT_EQ(32, len);
+                EXPECT_EQ(0, memcmp(view, "0123456789abcdef0123456789abcdef", 32));
+            } else if (!msgpack_stream_unpack(&st, items == 2 ? (void *)str : (void *)&val, &len, &type)) {
+                goto feed;
+            } else if (items == 0) {
+                EXPECT_EQ(MSGPACK_TYPE_ARRAY, type);
+                EXPECT_EQ(4, len);
+            } else if (items == 1) {
+                EXPECT_EQ(MSGPACK_TYPE_U32, type);
+                EXPECT_EQ(0x55aa55aa, val);
+            } else if (items == 2) {
+                EXPECT_EQ(MSGPACK_TYPE_STR, type);
+                EXPECT_EQ(18, len);
+                EXPECT_EQ(0, memcmp(str, "streaming unpacker", 18));
+            } else if (items == 3) {
+                EXPECT_EQ(MSGPACK_TYPE_NIL, type);
+            } else {
+                EXPECT_EQ(MSGPACK_TYPE_S8, type);
+                EXPECT_EQ(-0x5a, (int8_t)val);
+            }
+            items++;
+            continue;
+feed:
+            EXPECT_EQ(MSGPACK_EENDBUF, msgpack_stream_errno(&st));
+            ASSERT_TRUE(fed < mbuf.len);
+            n = mbuf.len - fed < chunk ? mbuf.len - fed : chunk;
+            EXPECT_TRUE(msgpack_stream_feed(&st, msg + fed, n));
+            fed += n;
+        }
+        EXPECT_EQ(mbuf.len, fed);
+        EXPECT_FALSE(msgpack_stream_unpack(&st, &val, &len, &type));
+        EXPECT_EQ(MSGPACK_EENDBUF, msgpack_errno());
+    }
+
+    init_msgpack_stream(&st, stage, 4);
+    EXPECT_TRUE(msgpack_stream_feed(&st, msg + 6, 8));
+    EXPECT_FALSE(msgpack_stream_unpack(&st, str, &len, &type));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_stream_errno(&st));
+
+    /* Feed again with several items left unread, all of them are staged. */
+    init_msgpack_buffer(&mbuf, msg, sizeof(msg));
+    msgpack_write_integer(&mbuf, 1);
+    msgpack_write_str(&mbuf, "two", 3);
+    msgpack_write_integer(&mbuf, 3);
+    msgpack_write_integer(&mbuf, 4);
+    init_msgpack_stream(&st, stage, sizeof(stage));
+    EXPECT_TRUE(msgpack_stream_feed(&st, msg, mbuf.len - 1));
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(val);
+    val = 0;
+    EXPECT_TRUE(msgpack_stream_unpack(&st, &val, &len, &type));
+    EXPECT_EQ(1, val);
+    EXPECT_TRUE(msgpack_stream_feed(&st, msg + mbuf.len - 1, 1));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_stream_unpack_view(&st, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_TYPE_STR, type);
+    EXPECT_EQ(3, len);
+    EXPECT_EQ(0, memcmp(view, "two", 3));
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(val);
+    val = 0;
+    EXPECT_TRUE(msgpack_stream_unpack(&st, &val, &len, &type));
+    EXPECT_EQ(3, val);
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(val);
+    val = 0;
+    EXPECT_TRUE(msgpack_stream_unpack(&st, &val, &len, &type));
+    EXPECT_EQ(4, val);
+    EXPECT_FALSE(msgpack_stream_unpack(&st, &val, &len, &type));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_stream_errno(&st));
+}
+
+TEST(msgpack, write_iovec) {
+    char blob[300];
+    uint8_t flat[512];
+    uint8_t joined[512];
+    msgpack_buffer_t expt;
+    msgpack_buffer_t mbuf;
+    msgpack_iovec_list_t list;
+    msgpack_iovec_t iov[8];
+    size_t off = 0;
+    size_t i;
+
+    memset(blob, 'b', sizeof(blob));
+    init_msgpack_buffer(&expt, flat, sizeof(flat));
+    msgpack_write_map(&expt, 2);
+    msgpack_write_str(&expt, "blob", 4);
+    msgpack_write_bin(&expt, blob, sizeof(blob));
+    msgpack_write_str(&expt, "text", 4);
+    msgpack_write_str(&expt, blob, 100);
+
+    init_msgpack_growable_buffer(&mbuf, &test_allocator);
+    init_msgpack_iovec_list(&list, iov, 8, 64);
+    mbuf.iov = &list;
+    EXPECT_TRUE(msgpack_write_map(&mbuf, 2));
+    EXPECT_TRUE(msgpack_write_str(&mbuf, "blob", 4));
+    EXPECT_TRUE(msgpack_write_bin(&mbuf, blob, sizeof(blob)));
+    EXPECT_TRUE(msgpack_write_str(&mbuf, "text", 4));
+    EXPECT_TRUE(msgpack_write_str(&mbuf, blob, 100));
+    EXPECT_TRUE(msgpack_iovec_finish(&mbuf));
+    EXPECT_EQ(expt.len - sizeof(blob) - 100, mbuf.len);
+    EXPECT_EQ(4, list.cnt);
+    EXPECT_TRUE(iov[1].iov_base == blob);
+    EXPECT_TRUE(iov[3].iov_base == blob);
+    EXPECT_TRUE(iov[0].iov_base == mbuf.buf);
+    for (i = 0; i < list.cnt; ++i) {
+        memcpy(joined + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    EXPECT_EQ(expt.len, off);
+    EXPECT_EQ(0, memcmp(flat, joined, off));
+    msgpack_buffer_release(&mbuf);
+
+    /* A full list falls back to copying. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    init_msgpack_iovec_list(&list, iov, 2, 64);
+    mbuf.iov = &list;
+    EXPECT_TRUE(msgpack_write_bin(&mbuf, blob, sizeof(blob)));
+    EXPECT_TRUE(msgpack_iovec_finish(&mbuf));
+    EXPECT_EQ(1, list.cnt);
+    EXPECT_EQ(3 + sizeof(blob), iov[0].iov_len);
+}
+
+TEST(msgpack, skip) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    uint8_t type;
+    uint32_t data_len;
+    int64_t val = 0;
+    int i;
+
+    /* {"a": [1, {"b": [nil, 2.0]}, "str"], "c": bin} 300 */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 2);
+    msgpack_write_str(&mbuf, "a", 1);
+    msgpack_write_arr16(&mbuf, 3);
+    msgpack_write_integer(&mbuf, 1);
+    msgpack_write_map32(&mbuf, 1);
+    msgpack_write_str(&mbuf, "b", 1);
+    msgpack_write_arr(&mbuf, 2);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_double(&mbuf, 2.0);
+    msgpack_write_str8(&mbuf, "str", 3);
+    msgpack_write_str(&mbuf, "c", 1);
+    msgpack_write_bin(&mbuf, "bin", 3);
+    msgpack_write_integer(&mbuf, 300);
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_skip(&unpacker));
+    EXPECT_EQ(mbuf.len - 3, unpacker.pos);
+    type = MSGPACK_TYPE_ANY;
+    data_len = sizeof(val);
+    EXPECT_TRUE(msgpack_unpack(&unpacker, &val, &data_len, &type));
+    EXPECT_EQ(300, val);
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 1);
+    for (i = 0; i < 4; ++i) {
+        EXPECT_TRUE(msgpack_skip(&unpacker));
+    }
+    EXPECT_EQ(mbuf.len - 3, unpacker.pos);
+
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, mbuf.buf, mbuf.len - 4, 0, msgpack_skip(&unpacker), (void)0);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, test_data, 5, 0, msgpack_skip(&unpacker), memcpy(test_data, "\xdd\xff\xff\xff\xff", 5));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNKNOWN, &unpacker, test_data, 2, 0, msgpack_skip(&unpacker), memcpy(test_data, "\x91\xc1", 2));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EINVL, &unpacker, test_data, 2, 0, msgpack_skip(NULL), (void)0);
+}
+
+#define TEST_MSGPACK_TIMESTAMP_CHECK(expt, expt_len, s, ns) \
+    do { \
+        msgpack_timestamp_t ts = {(s), (ns)}; \
+        msgpack_timestamp_t out = {0, 0}; \
+        TEST_MSGPACK_WRITE_CHECK(expt, expt_len, msgpack_write_timestamp(&test_mbuf, &ts)); \
+        init_msgpack_unpacker(&test_unpacker, test_buf, test_mbuf.len, 0); \
+        EXPECT_TRUE(msgpack_unpack_timestamp(&test_unpacker, &out)); \
+        EXPECT_EQ(ts.sec, out.sec); \
+        EXPECT_EQ(ts.nsec, out.nsec); \
+        EXPECT_EQ(test_mbuf.len, test_unpacker.pos); \
+    } while (0)
+
+TEST(msgpack, ext) {
+    uint8_t blob[300];
+    const uint8_t *view;
+    uint32_t view_len;
+    int8_t ext_type;
+    msgpack_timestamp_t ts;
+    uint8_t type;
+    uint32_t data_len;
+
+    memset(blob, 0x5a, sizeof(blob));
+    TEST_MSGPACK_WRITE_CHECK("\xd4\x01\x5a", 3, msgpack_write_ext(&test_mbuf, 1, blob, 1));
+    TEST_MSGPACK_WRITE_CHECK("\xd5\x7f\x5a\x5a", 4, msgpack_write_ext(&test_mbuf, 127, blob, 2));
+    TEST_MSGPACK_WSTR_CHECK("\xd8\x80\x5a", 3, 18, msgpack_write_ext(&test_mbuf, -128, blob, 16));
+    TEST_MSGPACK_WRITE_CHECK("\xc7\x00\x02", 3, msgpack_write_ext(&test_mbuf, 2, NULL, 0));
+    TEST_MSGPACK_WSTR_CHECK("\xc7\x03\x02\x5a", 4, 6, msgpack_write_ext(&test_mbuf, 2, blob, 3));
+    TEST_MSGPACK_WSTR_CHECK("\xc8\x01\x2c\x02\x5a", 5, 304, msgpack_write_ext(&test_mbuf, 2, blob, 300));
+
+    init_msgpack_unpacker(&test_unpacker, test_buf, test_mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_ext(&test_unpacker, &ext_type, &view, &view_len));
+    EXPECT_EQ(2, ext_type);
+    EXPECT_EQ(300, view_len);
+    EXPECT_TRUE(view == test_buf + 4);
+    EXPECT_EQ(304, test_unpacker.pos);
+
+    /* The generic reader would lose the type id, skip moves over the value. */
+    init_msgpack_unpacker(&test_unpacker, test_buf, test_mbuf.len, 0);
+    type = MSGPACK_TYPE_ANY;
+    data_len = sizeof(test_data);
+    EXPECT_FALSE(msgpack_unpack(&test_unpacker, test_data, &data_len, &type));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&test_unpacker));
+    EXPECT_EQ(0, test_unpacker.pos);
+    EXPECT_FALSE(msgpack_unpack(&test_unpacker, NULL, &data_len, &type));
+    EXPECT_EQ(0, test_unpacker.pos);
+    init_msgpack_unpacker(&test_unpacker, test_buf, test_mbuf.len, 0);
+    EXPECT_TRUE(msgpack_skip(&test_unpacker));
+    EXPECT_EQ(304, test_unpacker.pos);
+
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xd6\xff\x00\x00\x00\x00", 6, 0, 0);
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xd6\xff\xff\xff\xff\xff", 6, 0xffffffffll, 0);
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xd7\xff\x00\x00\x00\x04\x00\x00\x00\x00", 10, 0, 1);
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xd7\xff\xee\x6b\x27\xfd\x00\x00\x00\x01", 10, 0x100000001ll, 999999999);
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xc7\x0c\xff\x00\x00\x00\x00\x00\x00\x00\x04\x00\x00\x00\x00", 15, 0x400000000ll, 0);
+    TEST_MSGPACK_TIMESTAMP_CHECK("\xc7\x0c\xff\x00\x00\x00\x01\xff\xff\xff\xff\xff\xff\xff\xff", 15, -1, 1);
+
+    ts.sec = 0;
+    ts.nsec = 1000000000;
+    TEST_MSGPACK_WRITE_CHECK_ERROR(MSGPACK_EINVL, &test_mbuf, test_buf, 1024, msgpack_write_timestamp(&test_mbuf, &ts));
+    TEST_MSGPACK_WRITE_CHECK_ERROR(MSGPACK_EINVL, &test_mbuf, test_buf, 1024, msgpack_write_ext(&test_mbuf, 1, NULL, 1));
+    TEST_MSGPACK_WRITE_CHECK_ERROR(MSGPACK_ENOBUF, &test_mbuf, test_buf, 17, msgpack_write_ext(&test_mbuf, 1, blob, 16));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &test_unpacker, test_buf, 3, 0, msgpack_unpack_ext(&test_unpacker, &ext_type, &view, &view_len), memcpy(test_buf, "\xc4\x01\x00", 3));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &test_unpacker, test_buf, 3, 0, msgpack_unpack_ext(&test_unpacker, &ext_type, &view, &view_len), memcpy(test_buf, "\xd5\x01\x00", 3));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &test_unpacker, test_buf, 2, 0, msgpack_unpack_ext(&test_unpacker, &ext_type, &view, &view_len), memcpy(test_buf, "\xc7\x00", 2));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &test_unpacker, test_buf, 6, 0, msgpack_unpack_timestamp(&test_unpacker, &ts), memcpy(test_buf, "\xd6\x01\x00\x00\x00\x00", 6));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &test_unpacker, test_buf, 4, 0, msgpack_unpack_timestamp(&test_unpacker, &ts), memcpy(test_buf, "\xd5\xff\x00\x00", 4));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &test_unpacker, test_buf, 10, 0, msgpack_unpack_timestamp(&test_unpacker, &ts), memcpy(test_buf, "\xd7\xff\xff\xff\xff\xfc\x00\x00\x00\x00", 10));
+}
+
+TEST(msgpack, parse) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_arena_t arena;
+    msgpack_node_t *root;
+    const msgpack_node_t *node;
+    uint64_t arena_buf[32];
+    uint8_t deep[MSGPACK_PARSE_MAX_DEPTH + 2];
+    int i;
+
+    /* {"id": -200, "tags": ["a", true, nil], "score": 1.5, "big": 2^40} 7 */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 4);
+    msgpack_write_str(&mbuf, "id", 2);
+    msgpack_write_integer(&mbuf, -200);
+    msgpack_write_str(&mbuf, "tags", 4);
+    msgpack_write_arr(&mbuf, 3);
+    msgpack_write_str(&mbuf, "a", 1);
+    msgpack_write_true(&mbuf);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_str(&mbuf, "score", 5);
+    msgpack_write_float(&mbuf, 1.5f);
+    msgpack_write_str(&mbuf, "big", 3);
+    msgpack_write_u64(&mbuf, 1ull << 40);
+    msgpack_write_integer(&mbuf, 7);
+
+    init_msgpack_arena(&arena, (uint8_t *)arena_buf, sizeof(arena_buf));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_parse(&unpacker, &arena, &root));
+    EXPECT_EQ(mbuf.len - 1, unpacker.pos);
+    EXPECT_EQ(MSGPACK_TYPE_MAP, root->type);
+    EXPECT_EQ(4, root->len);
+    EXPECT_EQ(12 * sizeof(msgpack_node_t), arena.len);
+
+    node = msgpack_node_find(root, "id", 2);
+    EXPECT_TRUE(node != NULL);
+    EXPECT_EQ(MSGPACK_TYPE_S16, node->type);
+    EXPECT_EQ(-200, node->v.i);
+    node = msgpack_node_find(root, "tags", 4);
+    EXPECT_TRUE(node != NULL);
+    EXPECT_EQ(MSGPACK_TYPE_ARRAY, node->type);
+    EXPECT_EQ(3, node->len);
+    EXPECT_EQ(MSGPACK_TYPE_STR, msgpack_node_at(node, 0)->type);
+    EXPECT_EQ(1, msgpack_node_at(node, 0)->len);
+    EXPECT_EQ('a', msgpack_node_at(node, 0)->v.data[0]);
+    EXPECT_TRUE(msgpack_node_at(node, 1)->v.b);
+    EXPECT_EQ(MSGPACK_TYPE_NIL, msgpack_node_at(node, 2)->type);
+    node = msgpack_node_find(root, "score", 5);
+    EXPECT_TRUE(node != NULL && node->v.f == 1.5);
+    node = msgpack_node_find(root, "big", 3);
+    EXPECT_TRUE(node != NULL && node->v.u == 1ull << 40);
+    EXPECT_TRUE(msgpack_node_find(root, "none", 4) == NULL);
+
+    EXPECT_TRUE(msgpack_parse(&unpacker, &arena, &root));
+    EXPECT_EQ(MSGPACK_TYPE_U8, root->type);
+    EXPECT_EQ(7, root->v.u);
+
+    /* A full fixed arena, then blocks from the allocator. */
+    init_msgpack_arena(&arena, (uint8_t *)arena_buf, 4 * sizeof(msgpack_node_t));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_ENOBUF, &unpacker, mbuf.buf, mbuf.len, 0, msgpack_parse(&unpacker, &arena, &root), (void)0);
+    test_realloc_count = 0;
+    init_msgpack_growable_arena(&arena, (uint8_t *)arena_buf, 4 * sizeof(msgpack_node_t), &test_allocator);
+    for (i = 0; i < 3; ++i) {
+        init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+        EXPECT_TRUE(msgpack_parse(&unpacker, &arena, &root));
+        EXPECT_EQ(-200, msgpack_node_value(root, 0)->v.i);
+        msgpack_arena_release(&arena);
+    }
+    EXPECT_EQ(3, test_realloc_count);
+    EXPECT_TRUE(arena.buf == (uint8_t *)arena_buf);
+
+    /* Limits */
+    memset(deep, 0x91, sizeof(deep));
+    init_msgpack_growable_arena(&arena, NULL, 0, &test_allocator);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, deep, MSGPACK_PARSE_MAX_DEPTH, 0, msgpack_parse(&unpacker, &arena, &root), (void)0);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_ELIMIT, &unpacker, deep, sizeof(deep), 0, msgpack_parse(&unpacker, &arena, &root), (void)0);
+    deep[MSGPACK_PARSE_MAX_DEPTH] = 0x01;
+    init_msgpack_unpacker(&unpacker, deep, MSGPACK_PARSE_MAX_DEPTH + 1, 0);
+    EXPECT_TRUE(msgpack_parse(&unpacker, &arena, &root));
+    EXPECT_EQ(1, msgpack_node_at(root, 0)->len);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, test_buf, 6, 0, msgpack_parse(&unpacker, &arena, &root), memcpy(test_buf, "\xdd\xff\xff\xff\xff\x01", 6));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNKNOWN, &unpacker, test_buf, 2, 0, msgpack_parse(&unpacker, &arena, &root), memcpy(test_buf, "\x91\xc1", 2));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EINVL, &unpacker, test_buf, 2, 0, msgpack_parse(&unpacker, NULL, &root), (void)0);
+    msgpack_arena_release(&arena);
+}
+
+TEST(msgpack, index) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_unpacker_t cur;
+    msgpack_arena_t arena;
+    msgpack_index_t *idx;
+    msgpack_index_t *child;
+    msgpack_index_t *again;
+    uint64_t arena_buf[128];
+    char key[8];
+    uint32_t i;
+    uint32_t pair;
+    uint8_t type;
+    uint32_t data_len;
+    int64_t val;
+    size_t used;
+
+    /* {"k0": 0, ..., "k19": 19, "list": [[1, 2], {"x": 3}]} nil */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 21);
+    for (i = 0; i < 20; ++i) {
+        msgpack_write_str(&mbuf, key, (uint32_t)sprintf(key, "k%u", i));
+        msgpack_write_integer(&mbuf, i);
+    }
+    msgpack_write_str(&mbuf, "list", 4);
+    msgpack_write_arr(&mbuf, 2);
+    msgpack_write_arr(&mbuf, 2);
+    msgpack_write_integer(&mbuf, 1);
+    msgpack_write_integer(&mbuf, 2);
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "x", 1);
+    msgpack_write_integer(&mbuf, 3);
+    msgpack_write_nil(&mbuf);
+
+    init_msgpack_arena(&arena, (uint8_t *)arena_buf, sizeof(arena_buf));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_index_open(&unpacker, &arena, &idx));
+    EXPECT_EQ(mbuf.len - 1, unpacker.pos);
+    EXPECT_EQ(MSGPACK_TYPE_MAP, idx->type);
+    EXPECT_EQ(21, idx->count);
+
+    for (i = 0; i < 20; ++i) {
+        EXPECT_TRUE(msgpack_index_find(idx, key, (uint32_t)sprintf(key, "k%u", i), &pair));
+        EXPECT_EQ(i, pair);
+        EXPECT_TRUE(msgpack_index_at(idx, pair, &cur));
+        type = MSGPACK_TYPE_ANY;
+        data_len = sizeof(val);
+        val = 0;
+        EXPECT_TRUE(msgpack_unpack(&cur, &val, &data_len, &type));
+        EXPECT_EQ(i, (uint32_t)val);
+    }
+    EXPECT_FALSE(msgpack_index_find(idx, "k20", 3, &pair));
+    EXPECT_TRUE(msgpack_index_key(idx, 20, &cur));
+    EXPECT_EQ(0xa4, cur.buf[cur.pos]);
+
+    /* Nested containers are indexed once. */
+    EXPECT_TRUE(msgpack_index_find(idx, "list", 4, &pair));
+    EXPECT_TRUE(msgpack_index_child(idx, pair, &arena, &child));
+    EXPECT_EQ(MSGPACK_TYPE_ARRAY, child->type);
+    EXPECT_EQ(2, child->count);
+    used = arena.len;
+    EXPECT_TRUE(msgpack_index_child(idx, pair, &arena, &again));
+    EXPECT_TRUE(child == again);
+    EXPECT_EQ(used, arena.len);
+    EXPECT_TRUE(msgpack_index_child(child, 1, &arena, &again));
+    EXPECT_TRUE(msgpack_index_find(again, "x", 1, &pair));
+    EXPECT_TRUE(msgpack_index_at(again, pair, &cur));
+    EXPECT_EQ(3, cur.buf[cur.pos]);
+
+    EXPECT_FALSE(msgpack_index_child(idx, 0, &arena, &again));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_index_errno(idx));
+    EXPECT_FALSE(msgpack_index_at(idx, 21, &cur));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_index_errno(idx));
+    EXPECT_FALSE(msgpack_index_key(child, 0, &cur));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EUNEXPECTED, &unpacker, mbuf.buf, mbuf.len, mbuf.len - 1, msgpack_index_open(&unpacker, &arena, &idx), (void)0);
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, mbuf.buf, mbuf.len - 2, 0, msgpack_index_open(&unpacker, &arena, &idx), init_msgpack_arena(&arena, (uint8_t *)arena_buf, sizeof(arena_buf)));
+    TEST_MSGPACK_READ_CHECK_ERROR(MSGPACK_EENDBUF, &unpacker, test_data, 5, 0, msgpack_index_open(&unpacker, &arena, &idx), memcpy(test_data, "\xdd\xff\xff\xff\xff", 5));
+}
+
+TEST(msgpack, scan) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_scan_t sc;
+    size_t values[128];
+    size_t containers[16];
+    size_t expt[128];
+    size_t expt_cnt = 0;
+    size_t end;
+    int i;
+
+    /* 40 fixints, [70 one byte values, "s", {"k": [nil]}], 1.0, 40 bools */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    for (i = 0; i < 40; ++i) {
+        msgpack_write_integer(&mbuf, (int64_t)(i % 2 ? i : -i));
+    }
+    msgpack_write_arr(&mbuf, 72);
+    for (i = 0; i < 70; ++i) {
+        switch (i % 5) {
+            case 0: msgpack_write_nil(&mbuf); break;
+            case 1: msgpack_write_true(&mbuf); break;
+            case 2: msgpack_write_str(&mbuf, "", 0); break;
+            case 3: msgpack_write_integer(&mbuf, -32); break;
+            default: msgpack_write_integer(&mbuf, 127); break;
+        }
+    }
+    msgpack_write_str(&mbuf, "s", 1);
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "k", 1);
+    msgpack_write_arr(&mbuf, 1);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_double(&mbuf, 1.0);
+    for (i = 0; i < 40; ++i) {
+        msgpack_write_bool(&mbuf, i % 3 == 0);
+    }
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    while (unpacker.pos < mbuf.len) {
+        expt[expt_cnt++] = unpacker.pos;
+        EXPECT_TRUE(msgpack_skip(&unpacker));
+    }
+    EXPECT_EQ(82, expt_cnt);
+
+    init_msgpack_scan(&sc, values, 128, containers, 16);
+    EXPECT_TRUE(msgpack_scan(&sc, mbuf.buf, mbuf.len));
+    EXPECT_EQ(expt_cnt, sc.value_cnt);
+    EXPECT_EQ(0, memcmp(expt, values, expt_cnt * sizeof(size_t)));
+    EXPECT_EQ(mbuf.len, sc.pos);
+    EXPECT_EQ(3, sc.container_cnt);
+    EXPECT_EQ(expt[40], containers[0]);
+    EXPECT_EQ(0x81, mbuf.buf[containers[1]]);
+    EXPECT_EQ(0x91, mbuf.buf[containers[2]]);
+
+    /* Full lists and cut values are resumed. */
+    init_msgpack_scan(&sc, values, 30, NULL, 0);
+    EXPECT_FALSE(msgpack_scan(&sc, mbuf.buf, mbuf.len));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_scan_errno(&sc));
+    EXPECT_EQ(30, sc.value_cnt);
+    EXPECT_EQ(expt[30], sc.pos);
+    sc.value_cnt = 0;
+    end = expt[40] + 3;
+    EXPECT_FALSE(msgpack_scan(&sc, mbuf.buf, end));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_scan_errno(&sc));
+    EXPECT_EQ(10, sc.value_cnt);
+    EXPECT_EQ(expt[40], sc.pos);
+    sc.value_cnt = 0;
+    sc.value_alloc = 128;
+    EXPECT_TRUE(msgpack_scan(&sc, mbuf.buf, mbuf.len));
+    EXPECT_EQ(expt_cnt - 40, sc.value_cnt);
+    EXPECT_EQ(expt[40], values[0]);
+
+    init_msgpack_scan(&sc, values, 128, containers, 2);
+    EXPECT_FALSE(msgpack_scan(&sc, mbuf.buf, mbuf.len));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_scan_errno(&sc));
+    EXPECT_EQ(40, sc.value_cnt);
+    EXPECT_EQ(0, sc.container_cnt);
+
+    memcpy(test_data, "\x01\x92\x02\xc1", 4);
+    init_msgpack_scan(&sc, values, 128, NULL, 0);
+    EXPECT_FALSE(msgpack_scan(&sc, (const uint8_t *)test_data, 4));
+    EXPECT_EQ(MSGPACK_EUNKNOWN, msgpack_scan_errno(&sc));
+    EXPECT_EQ(1, sc.pos);
+    EXPECT_FALSE(msgpack_scan(NULL, mbuf.buf, mbuf.len));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_errno());
+}
+
+struct test_record {
+    char name[8];
+    int16_t delta;
+    uint32_t count;
+    bool ok;
+    double ratio;
+    float scale;
+};
+
+#define TEST_RECORD_FIELDS(X, S) \
+    X(S, STR, name) \
+    X(S, INT, delta) \
+    X(S, UINT, count) \
+    X(S, BOOL, ok) \
+    X(S, DOUBLE, ratio) \
+    X(S, FLOAT, scale)
+
+MSGPACK_SCHEMA(test_record_schema, struct test_record, TEST_RECORD_FIELDS);
+
+TEST(msgpack, schema) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    struct test_record in = {"joan", -300, 70000, true, 0.5, 2.0f};
+    struct test_record out;
+    uint8_t expt[] = {0x86, 0xa4, 'n', 'a', 'm', 'e', 0xa4, 'j', 'o', 'a', 'n',
+        0xa5, 'd', 'e', 'l', 't', 'a', 0xd1, 0xfe, 0xd4,
+        0xa5, 'c', 'o', 'u', 'n', 't', 0xce, 0x00, 0x01, 0x11, 0x70,
+        0xa2, 'o', 'k', 0xc3,
+        0xa5, 'r', 'a', 't', 'i', 'o', 0xcb, 0x3f, 0xe0, 0, 0, 0, 0, 0, 0,
+        0xa5, 's', 'c', 'a', 'l', 'e', 0xca, 0x40, 0x00, 0x00, 0x00};
+
+    EXPECT_EQ(6, test_record_schema.count);
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_TRUE(msgpack_write_struct(&mbuf, &test_record_schema, &in));
+    EXPECT_EQ(sizeof(expt), mbuf.len);
+    EXPECT_EQ(0, memcmp(expt, mbuf.buf, sizeof(expt)));
+
+    memset(&out, 0, sizeof(out));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(mbuf.len, unpacker.pos);
+    EXPECT_EQ(0, strcmp("joan", out.name));
+    EXPECT_EQ(-300, out.delta);
+    EXPECT_EQ(70000, out.count);
+    EXPECT_TRUE(out.ok);
+    EXPECT_EQ(0.5, out.ratio);
+    EXPECT_EQ(2.0f, out.scale);
+
+    /* A full name is written without its last byte, to read it back. */
+    memcpy(in.name, "joanna_x", sizeof(in.name));
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_TRUE(msgpack_write_struct(&mbuf, &test_record_schema, &in));
+    EXPECT_EQ(sizeof(expt) + 3, mbuf.len);
+    memset(&out, 0, sizeof(out));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(0, strcmp("joanna_", out.name));
+
+    /* Any order, str8 keys, unknown keys, nil and integers for floats. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 5);
+    msgpack_write_str(&mbuf, "scale", 5);
+    msgpack_write_integer(&mbuf, (int64_t)3);
+    msgpack_write_str8(&mbuf, "count", 5);
+    msgpack_write_integer(&mbuf, (int64_t)7);
+    msgpack_write_str(&mbuf, "extra", 5);
+    msgpack_write_arr(&mbuf, 1);
+    msgpack_write_str(&mbuf, "x", 1);
+    msgpack_write_str(&mbuf, "name", 4);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_integer(&mbuf, (int64_t)1);
+    msgpack_write_integer(&mbuf, (int64_t)2);
+    memset(&out, 0, sizeof(out));
+    strcpy(out.name, "keep");
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(3.0f, out.scale);
+    EXPECT_EQ(7, out.count);
+    EXPECT_EQ(0, strcmp("keep", out.name));
+    EXPECT_EQ(mbuf.len, unpacker.pos);
+
+    /* Out of range, too long and cut values leave the position. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "delta", 5);
+    msgpack_write_integer(&mbuf, (int64_t)40000);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "count", 5);
+    msgpack_write_integer(&mbuf, (int64_t)-1);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&unpacker));
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "name", 4);
+    msgpack_write_str(&mbuf, "too long", 8);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_unpacker_errno(&unpacker));
+
+    init_msgpack_unpacker(&unpacker, (uint8_t *)expt, sizeof(expt) - 1, 0);
+    EXPECT_FALSE(msgpack_unpack_struct(&unpacker, &test_record_schema, &out));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+
+    /* The whole map is reserved before anything is written. */
+    init_msgpack_buffer(&mbuf, test_buf, 20);
+    EXPECT_FALSE(msgpack_write_struct(&mbuf, &test_record_schema, &in));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_buffer_errno(&mbuf));
+    EXPECT_EQ(0, mbuf.len);
+}
+
+TEST(msgpack, keyset) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_arena_t arena;
+    msgpack_keyset_t ks;
+    uint8_t arena_buf[512];
+    char long_key[40];
+    const char *keys[] = {"name", "age", "gender", "", long_key, "age"};
+    uint8_t expt[] = {0xa3, 'a', 'g', 'e', 0xa4, 'n', 'a', 'm', 'e', 0xa0};
+    uint32_t h;
+
+    memset(long_key, 'k', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = 0;
+    init_msgpack_arena(&arena, arena_buf, sizeof(arena_buf));
+    EXPECT_TRUE(msgpack_keyset_build(&ks, &arena, keys, 6));
+    EXPECT_EQ(6, ks.count);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_TRUE(msgpack_write_key(&mbuf, &ks, 1));
+    EXPECT_TRUE(msgpack_write_key(&mbuf, &ks, 0));
+    EXPECT_TRUE(msgpack_write_key(&mbuf, &ks, 3));
+    EXPECT_EQ(sizeof(expt), mbuf.len);
+    EXPECT_EQ(0, memcmp(expt, mbuf.buf, sizeof(expt)));
+    EXPECT_TRUE(msgpack_write_key(&mbuf, &ks, 4));
+    EXPECT_EQ(0xd9, mbuf.buf[sizeof(expt)]);
+    EXPECT_EQ(39, mbuf.buf[sizeof(expt) + 1]);
+    EXPECT_FALSE(msgpack_write_key(&mbuf, &ks, 6));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_buffer_errno(&mbuf));
+    msgpack_write_str(&mbuf, "gender", 6);
+    msgpack_write_str(&mbuf, "other", 5);
+    msgpack_write_integer(&mbuf, (int64_t)1);
+
+    /* Keys are found without a copy, a repeated key by its first handle. */
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(1, h);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(0, h);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(3, h);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(4, h);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(2, h);
+    EXPECT_TRUE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(MSGPACK_KEY_NONE, h);
+    EXPECT_FALSE(msgpack_unpack_key(&unpacker, &ks, &h));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&unpacker));
+    EXPECT_TRUE(msgpack_keyset_find(&ks, "age", 3, &h));
+    EXPECT_EQ(1, h);
+    EXPECT_FALSE(msgpack_keyset_find(&ks, "ag", 2, &h));
+
+    init_msgpack_arena(&arena, arena_buf, 16);
+    EXPECT_FALSE(msgpack_keyset_build(&ks, &arena, keys, 6));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_keyset_errno(&ks));
+}
+
+TEST(msgpack, keyset_perfect) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_arena_t arena;
+    msgpack_keyset_t ks;
+    struct test_record out;
+    static char names[300][12];
+    const char *keys[300];
+    uint32_t slot_used[1024] = {0};
+    uint32_t h;
+    uint32_t i;
+    char miss[12];
+
+    for (i = 0; i < 300; ++i) {
+        sprintf(names[i], "field_%u", i);
+        keys[i] = names[i];
+    }
+    init_msgpack_growable_arena(&arena, NULL, 0, &msgpack_stdlib_allocator);
+    EXPECT_TRUE(msgpack_keyset_build(&ks, &arena, keys, 300));
+
+    /* Every key has a slot of its own, found in one probe. */
+    for (i = 0; i <= ks.slot_mask; ++i) {
+        if (ks.slots[i]) {
+            slot_used[ks.slots[i] - 1]++;
+        }
+    }
+    for (i = 0; i < 300; ++i) {
+        EXPECT_EQ(1, slot_used[i]);
+        EXPECT_TRUE(msgpack_keyset_find(&ks, names[i], (uint32_t)strlen(names[i]), &h));
+        EXPECT_EQ(i, h);
+        sprintf(miss, "field_%u", i + 300);
+        EXPECT_FALSE(msgpack_keyset_find(&ks, miss, (uint32_t)strlen(miss), &h));
+    }
+
+    /* Struct fields dispatched through the keyset of the schema. */
+    EXPECT_TRUE(msgpack_keyset_build_schema(&ks, &arena, &test_record_schema));
+    EXPECT_EQ(6, ks.count);
+    EXPECT_TRUE(msgpack_keyset_find(&ks, "ratio", 5, &h));
+    EXPECT_EQ(4, h);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 3);
+    msgpack_write_str(&mbuf, "ok", 2);
+    msgpack_write_true(&mbuf);
+    msgpack_write_str(&mbuf, "unknown", 7);
+    msgpack_write_integer(&mbuf, (int64_t)1);
+    msgpack_write_str16(&mbuf, "delta", 5);
+    msgpack_write_integer(&mbuf, (int64_t)-5);
+    memset(&out, 0, sizeof(out));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_struct_keys(&unpacker, &test_record_schema, &ks, &out));
+    EXPECT_TRUE(out.ok);
+    EXPECT_EQ(-5, out.delta);
+    EXPECT_EQ(mbuf.len, unpacker.pos);
+    EXPECT_FALSE(msgpack_unpack_struct_keys(&unpacker, &test_record_schema, NULL, &out));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_unpacker_errno(&unpacker));
+
+    msgpack_arena_release(&arena);
+}
+
+TEST(msgpack, write_typed_array) {
+    msgpack_buffer_t mbuf;
+    msgpack_buffer_t expt;
+    static uint8_t expt_buf[2048];
+    static uint8_t out_buf[2048];
+    uint8_t u8[70];
+    int16_t s16[70];
+    uint32_t u32[70];
+    int32_t s32[70];
+    int64_t s64[70];
+    float f[70];
+    double d[70];
+    int i;
+
+    /* Fixint runs, then blocks broken by one wide value, then a tail. */
+    for (i = 0; i < 70; ++i) {
+        int64_t v = i < 32 ? (i % 2 ? i : -i / 2) : (i == 40 ? -1000 : i * 3);
+        u8[i] = (uint8_t)(i == 40 ? 200 : i * 3);
+        s16[i] = (int16_t)v;
+        u32[i] = i == 40 ? 70000u : (uint32_t)(i * 3);
+        s32[i] = (int32_t)(i == 50 ? -70000 : v);
+        s64[i] = i == 60 ? INT64_MIN + 1 : v;
+        f[i] = (float)i / 4;
+        d[i] = -i * 0.5;
+    }
+
+    init_msgpack_buffer(&mbuf, out_buf, sizeof(out_buf));
+    init_msgpack_buffer(&expt, expt_buf, sizeof(expt_buf));
+    EXPECT_TRUE(msgpack_write_u8_array(&mbuf, u8, 70));
+    EXPECT_TRUE(msgpack_write_s16_array(&mbuf, s16, 70));
+    EXPECT_TRUE(msgpack_write_u32_array(&mbuf, u32, 70));
+    EXPECT_TRUE(msgpack_write_s64_array(&mbuf, s64, 70));
+    EXPECT_TRUE(msgpack_write_float_array(&mbuf, f, 70));
+    EXPECT_TRUE(msgpack_write_double_array(&mbuf, d, 3));
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_u8(&expt, u8[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_s16(&expt, s16[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_u32(&expt, u32[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_s64(&expt, s64[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_float(&expt, f[i]);
+    }
+    msgpack_write_arr(&expt, 3);
+    for (i = 0; i < 3; ++i) {
+        msgpack_write_double(&expt, d[i]);
+    }
+    EXPECT_EQ(expt.len, mbuf.len);
+    EXPECT_EQ(0, memcmp(expt.buf, mbuf.buf, expt.len));
+
+    init_msgpack_buffer(&mbuf, out_buf, sizeof(out_buf));
+    init_msgpack_buffer(&expt, expt_buf, sizeof(expt_buf));
+    EXPECT_TRUE(msgpack_write_u8_array_compact(&mbuf, u8, 70));
+    EXPECT_TRUE(msgpack_write_s16_array_compact(&mbuf, s16, 70));
+    EXPECT_TRUE(msgpack_write_u32_array_compact(&mbuf, u32, 70));
+    EXPECT_TRUE(msgpack_write_s32_array_compact(&mbuf, s32, 70));
+    EXPECT_TRUE(msgpack_write_s64_array_compact(&mbuf, s64, 70));
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_integer(&expt, (int64_t)u8[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_integer(&expt, (int64_t)s16[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_integer(&expt, (int64_t)u32[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_integer(&expt, (int64_t)s32[i]);
+    }
+    msgpack_write_arr(&expt, 70);
+    for (i = 0; i < 70; ++i) {
+        msgpack_write_integer(&expt, s64[i]);
+    }
+    EXPECT_EQ(expt.len, mbuf.len);
+    EXPECT_EQ(0, memcmp(expt.buf, mbuf.buf, expt.len));
+
+    /* One check for the whole array: nothing is written when it fails. */
+    init_msgpack_buffer(&mbuf, out_buf, 100);
+    EXPECT_FALSE(msgpack_write_u32_array(&mbuf, u32, 70));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_buffer_errno(&mbuf));
+    EXPECT_EQ(0, mbuf.len);
+    EXPECT_TRUE(msgpack_write_u32_array(&mbuf, u32, 0));
+    EXPECT_EQ(1, mbuf.len);
+    EXPECT_EQ(0x90, out_buf[0]);
+    EXPECT_FALSE(msgpack_write_typed_array(&mbuf, MSGPACK_TYPE_STR, u32, 1, false));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_buffer_errno(&mbuf));
+}
+
+TEST(msgpack, unpack_typed_array) {
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    int64_t ints[80];
+    int64_t expt[80];
+    double dbls[80];
+    uint32_t len;
+    int i;
+
+    /* 20 fixints, then every integer encoding, then 40 fixints. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_arr(&mbuf, 70);
+    for (i = 0; i < 70; ++i) {
+        expt[i] = i < 20 || i >= 30 ? (i % 3 ? i : -(i % 33)) : (int64_t)1 << (i - 20) * 6;
+        if (i == 25) {
+            expt[i] = INT64_MIN + 1;
+        } else if (i == 26) {
+            expt[i] = -129;
+        }
+    }
+    for (i = 0; i < 70; ++i) {
+        if (i == 21) {
+            msgpack_write_u64(&mbuf, (uint64_t)expt[i]);
+        } else {
+            msgpack_write_integer(&mbuf, expt[i]);
+        }
+    }
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    len = 80;
+    EXPECT_TRUE(msgpack_unpack_int64_array(&unpacker, ints, &len));
+    EXPECT_EQ(70, len);
+    EXPECT_EQ(0, memcmp(expt, ints, 70 * sizeof(int64_t)));
+    EXPECT_EQ(mbuf.len, unpacker.pos);
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    len = 80;
+    EXPECT_TRUE(msgpack_unpack_double_array(&unpacker, dbls, &len));
+    EXPECT_EQ(70, len);
+    for (i = 0; i < 70; ++i) {
+        EXPECT_EQ((double)expt[i], dbls[i]);
+    }
+
+    /* Too small, then a bad element: its index and no move. */
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    len = 69;
+    EXPECT_FALSE(msgpack_unpack_int64_array(&unpacker, ints, &len));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(70, len);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_arr(&mbuf, 40);
+    for (i = 0; i < 40; ++i) {
+        if (i == 33) {
+            msgpack_write_double(&mbuf, 1.5);
+        } else if (i == 37) {
+            msgpack_write_true(&mbuf);
+        } else {
+            msgpack_write_integer(&mbuf, (int64_t)i);
+        }
+    }
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_int64_array(&unpacker, ints, &len));
+    EXPECT_EQ(MSGPACK_EUNEXPECTED, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(33, len);
+    EXPECT_EQ(0, unpacker.pos);
+    EXPECT_EQ(32, ints[32]);
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_double_array(&unpacker, dbls, &len));
+    EXPECT_EQ(37, len);
+    EXPECT_EQ(1.5, dbls[33]);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_arr(&mbuf, 2);
+    msgpack_write_u64(&mbuf, (uint64_t)INT64_MAX + 1);
+    msgpack_write_float(&mbuf, 0.25f);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_int64_array(&unpacker, ints, &len));
+    EXPECT_EQ(0, len);
+    len = 80;
+    EXPECT_TRUE(msgpack_unpack_double_array(&unpacker, dbls, &len));
+    EXPECT_EQ(9223372036854775808.0, dbls[0]);
+    EXPECT_EQ(0.25, dbls[1]);
+
+    /* Cut arrays, whose last value or count is missing. */
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len - 1, 0);
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_double_array(&unpacker, dbls, &len));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+    memcpy(test_data, "\x93\x01\x02", 3);
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data, 3, 0);
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_int64_array(&unpacker, ints, &len));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+    len = 80;
+    EXPECT_FALSE(msgpack_unpack_int64_array(&unpacker, NULL, &len));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_unpacker_errno(&unpacker));
+}
+
+static void test_write_mixed(msgpack_buffer_t *mbuf, const struct test_record *rec)
+{
+    static const int64_t ints[] = {
+        0, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL,
+        -1, -32, -33, -128, -129, -32768, -32769, INT32_MIN, INT32_MIN - 1LL,
+        INT64_MIN
+    };
+    static const int32_t s32[20] = {1, 2, -3, 300, -70000};
+    static const double dbls[3] = {1.5, -2.0, 0.25};
+    msgpack_timestamp_t ts = {1700000000, 5};
+    size_t i;
+
+    msgpack_write_map(mbuf, 3);
+    msgpack_write_str(mbuf, "ints", 4);
+    msgpack_write_arr(mbuf, sizeof(ints) / sizeof(ints[0]));
+    for (i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i) {
+        msgpack_write_integer(mbuf, ints[i]);
+    }
+    msgpack_write_str(mbuf, "misc", 4);
+    msgpack_write_arr(mbuf, 7);
+    msgpack_write_nil(mbuf);
+    msgpack_write_true(mbuf);
+    msgpack_write_float(mbuf, 0.5f);
+    msgpack_write_double(mbuf, 0.5);
+    msgpack_write_bin(mbuf, test_data, 300);
+    msgpack_write_ext(mbuf, 7, test_data, 3);
+    msgpack_write_timestamp(mbuf, &ts);
+    msgpack_write_str(mbuf, "arrays", 6);
+    msgpack_write_arr(mbuf, 4);
+    msgpack_write_s32_array(mbuf, s32, 20);
+    msgpack_write_s32_array_compact(mbuf, s32, 20);
+    msgpack_write_double_array(mbuf, dbls, 3);
+    msgpack_write_struct(mbuf, &test_record_schema, rec);
+}
+
+TEST(msgpack, counter)
+{
+    struct test_record rec = {"joan", -200, 70000, true, 0.5, 2.0f};
+    msgpack_timestamp_t ts = {-1, 0};
+    msgpack_buffer_t counter;
+    msgpack_buffer_t mbuf;
+
+    memset(test_data, 'x', 300);
+    init_msgpack_counter(&counter);
+    EXPECT_TRUE(msgpack_buffer_counting(&counter));
+    test_write_mixed(&counter, &rec);
+    EXPECT_EQ(MSGPACK_EOK, msgpack_buffer_errno(&counter));
+    EXPECT_TRUE(msgpack_reserve(&counter, 1 << 20));
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_FALSE(msgpack_buffer_counting(&mbuf));
+    test_write_mixed(&mbuf, &rec);
+    EXPECT_EQ(MSGPACK_EOK, msgpack_buffer_errno(&mbuf));
+    EXPECT_EQ(mbuf.len, counter.len);
+
+    /* The exact size is enough for a fixed buffer. */
+    init_msgpack_buffer(&mbuf, test_buf, counter.len);
+    test_write_mixed(&mbuf, &rec);
+    EXPECT_EQ(MSGPACK_EOK, msgpack_buffer_errno(&mbuf));
+    EXPECT_EQ(counter.len, mbuf.len);
+
+    EXPECT_EQ(1, msgpack_sizeof_integer(-32));
+    EXPECT_EQ(2, msgpack_sizeof_integer(-128));
+    EXPECT_EQ(3, msgpack_sizeof_integer(-129));
+    EXPECT_EQ(3, msgpack_sizeof_integer(INT16_MIN));
+    EXPECT_EQ(5, msgpack_sizeof_integer(INT32_MIN));
+    EXPECT_EQ(9, msgpack_sizeof_integer(INT64_MIN));
+    EXPECT_EQ(1, msgpack_sizeof_integer(127));
+    EXPECT_EQ(2, msgpack_sizeof_uinteger(255));
+    EXPECT_EQ(9, msgpack_sizeof_uinteger(UINT64_MAX));
+    EXPECT_EQ(1, msgpack_sizeof_nil());
+    EXPECT_EQ(5, msgpack_sizeof_float(0.5f));
+    EXPECT_EQ(32, msgpack_sizeof_str(31));
+    EXPECT_EQ(34, msgpack_sizeof_str(32));
+    EXPECT_EQ(257, msgpack_sizeof_bin(255));
+    EXPECT_EQ(3, msgpack_sizeof_arr(16));
+    EXPECT_EQ(5, msgpack_sizeof_map(65536));
+    EXPECT_EQ(18, msgpack_sizeof_ext(16));
+    EXPECT_EQ(20, msgpack_sizeof_ext(17));
+    EXPECT_EQ(15, msgpack_sizeof_timestamp(&ts));
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_TRUE(msgpack_write_integer(&mbuf, -128));
+    EXPECT_EQ(0, memcmp("\xd0\x80", test_buf, 2));
+    EXPECT_TRUE(msgpack_write_integer(&mbuf, INT64_MIN));
+    EXPECT_EQ(11, mbuf.len);
+}
+
+#if MSGPACK_BUFFER_POOL
+TEST(msgpack, pool)
+{
+    msgpack_pool_t pool;
+    msgpack_pool_t other;
+    msgpack_pool_stats_t stats;
+    msgpack_buffer_t mbuf;
+    void *blocks[2 * MSGPACK_POOL_CACHE_BLOCKS + 2];
+    char str[100];
+    uint8_t *first;
+    int i;
+
+    memset(str, 'x', sizeof(str));
+    test_realloc_count = 0;
+    msgpack_pool_init(&pool, &test_allocator);
+    init_msgpack_pool_buffer(&mbuf, &pool);
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, sizeof(str)));
+    first = mbuf.buf;
+    msgpack_buffer_release(&mbuf);
+    EXPECT_EQ(1, test_realloc_count);
+
+    /* The block of the same class is reused without the allocator. */
+    init_msgpack_pool_buffer(&mbuf, &pool);
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, 90));
+    EXPECT_TRUE(first == mbuf.buf);
+    EXPECT_EQ(1, test_realloc_count);
+    msgpack_pool_get_stats(&pool, &stats);
+    EXPECT_EQ(2 * MSGPACK_BUFFER_MIN_ALLOC, stats.allocated);
+    EXPECT_EQ(2 * MSGPACK_BUFFER_MIN_ALLOC, stats.high_water);
+    EXPECT_EQ(1, stats.allocs);
+    EXPECT_EQ(0, stats.frees);
+
+    /* Growing moves to larger classes and keeps the content. */
+    for (i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(msgpack_write_u32(&mbuf, i));
+    }
+    TEST_CHECK_EQUAL("\xd9\x5axxx", mbuf.buf, 5);
+    TEST_CHECK_EQUAL("\xce\x00\x00\x03\xe7", mbuf.buf + 92 + 999 * 5, 5);
+    msgpack_buffer_release(&mbuf);
+    msgpack_pool_get_stats(&pool, &stats);
+    EXPECT_EQ(7, stats.allocs);
+    EXPECT_EQ((2 + 4 + 8 + 16 + 32 + 64 + 128) * MSGPACK_BUFFER_MIN_ALLOC, stats.allocated);
+
+    /* Past the largest class the block goes straight to the allocator. */
+    init_msgpack_pool_buffer(&mbuf, &pool);
+    EXPECT_TRUE(msgpack_reserve(&mbuf, (size_t)MSGPACK_BUFFER_MIN_ALLOC << MSGPACK_POOL_CLASSES));
+    msgpack_buffer_release(&mbuf);
+    msgpack_pool_get_stats(&pool, &stats);
+    EXPECT_EQ(8, stats.allocs);
+    EXPECT_EQ(1, stats.frees);
+    EXPECT_EQ(254 * MSGPACK_BUFFER_MIN_ALLOC, stats.allocated);
+    EXPECT_EQ(254 * MSGPACK_BUFFER_MIN_ALLOC + ((size_t)MSGPACK_BUFFER_MIN_ALLOC << MSGPACK_POOL_CLASSES), stats.high_water);
+
+    /* The thread keeps blocks of pool, so those of other go back to it. */
+    msgpack_pool_init(&other, &test_allocator);
+    init_msgpack_pool_buffer(&mbuf, &other);
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, sizeof(str)));
+    first = mbuf.buf;
+    msgpack_buffer_release(&mbuf);
+    EXPECT_TRUE(other.returned[1] != NULL);
+    init_msgpack_pool_buffer(&mbuf, &other);
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, sizeof(str)));
+    EXPECT_TRUE(first == mbuf.buf);
+    EXPECT_TRUE(other.returned[1] == NULL);
+    msgpack_buffer_release(&mbuf);
+    EXPECT_TRUE(msgpack_pool_destroy(&other));
+
+    EXPECT_TRUE(pool.returned[1] == NULL);
+    msgpack_pool_flush(&pool);
+    EXPECT_TRUE(pool.returned[1] != NULL);
+    EXPECT_TRUE(msgpack_pool_destroy(&pool));
+    EXPECT_TRUE(pool.returned[1] == NULL);
+    msgpack_pool_get_stats(&pool, &stats);
+    EXPECT_EQ(0, stats.allocated);
+    EXPECT_EQ(stats.allocs, stats.frees);
+
+    /* Taking the blocks given back keeps no more than the cache holds. */
+    msgpack_pool_init(&other, &test_allocator);
+    for (i = 0; i < 2 * MSGPACK_POOL_CACHE_BLOCKS + 2; ++i) {
+        blocks[i] = other.allocator.realloc(other.allocator.ud, NULL, 1);
+    }
+    for (i = 0; i < 2 * MSGPACK_POOL_CACHE_BLOCKS + 2; ++i) {
+        other.allocator.free(other.allocator.ud, blocks[i]);
+    }
+    EXPECT_TRUE(other.returned[0] != NULL);
+    for (i = 0; i < MSGPACK_POOL_CACHE_BLOCKS + 1; ++i) {
+        blocks[i] = other.allocator.realloc(other.allocator.ud, NULL, 1);
+    }
+    EXPECT_TRUE(other.returned[0] != NULL);
+    for (i = 0; i < MSGPACK_POOL_CACHE_BLOCKS + 1; ++i) {
+        other.allocator.free(other.allocator.ud, blocks[i]);
+    }
+    /* Destroying flushes the calling thread first. */
+    EXPECT_TRUE(msgpack_pool_destroy(&other));
+    EXPECT_TRUE(other.returned[0] == NULL);
+    msgpack_pool_get_stats(&other, &stats);
+    EXPECT_EQ(0, stats.allocated);
+    EXPECT_EQ(2 * MSGPACK_POOL_CACHE_BLOCKS + 2, stats.frees);
+
+    /* A buffer not released keeps its block out of the pool. */
+    msgpack_pool_init(&other, &test_allocator);
+    init_msgpack_pool_buffer(&mbuf, &other);
+    EXPECT_TRUE(msgpack_write_str(&mbuf, str, sizeof(str)));
+    EXPECT_FALSE(msgpack_pool_destroy(&other));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_errno());
+    msgpack_buffer_release(&mbuf);
+    EXPECT_TRUE(msgpack_pool_destroy(&other));
+    msgpack_pool_get_stats(&other, &stats);
+    EXPECT_EQ(0, stats.allocated);
+}
+#endif
+
+static void test_write_rows(msgpack_buffer_t *mbuf, bool compact)
+{
+    msgpack_container_t map;
+    msgpack_container_t arr;
+    uint32_t i;
+
+    msgpack_write_map_begin(mbuf, &map);
+    msgpack_write_str(mbuf, "rows", 4);
+    msgpack_write_arr_begin(mbuf, &arr);
+    for (i = 0; i < 20; ++i) {
+        msgpack_write_integer(mbuf, (int64_t)i);
+    }
+    msgpack_write_end(mbuf, &arr, 20, compact);
+    msgpack_write_str(mbuf, "none", 4);
+    msgpack_write_arr_begin(mbuf, &arr);
+    msgpack_write_end(mbuf, &arr, 0, compact);
+    msgpack_write_end(mbuf, &map, 2, compact);
+}
+
+TEST(msgpack, write_deferred)
+{
+    uint8_t flat[128];
+    char blob[100];
+    msgpack_buffer_t expt;
+    msgpack_buffer_t mbuf;
+    msgpack_buffer_t counter;
+    msgpack_container_t arr;
+    msgpack_iovec_list_t list;
+    msgpack_iovec_t iov[4];
+    uint32_t i;
+
+    init_msgpack_buffer(&expt, flat, sizeof(flat));
+    msgpack_write_map(&expt, 2);
+    msgpack_write_str(&expt, "rows", 4);
+    msgpack_write_arr(&expt, 20);
+    for (i = 0; i < 20; ++i) {
+        msgpack_write_integer(&expt, (int64_t)i);
+    }
+    msgpack_write_str(&expt, "none", 4);
+    msgpack_write_arr(&expt, 0);
+
+    /* Compacted, the output is the same as with the counts known. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    test_write_rows(&mbuf, true);
+    EXPECT_EQ(MSGPACK_EOK, msgpack_buffer_errno(&mbuf));
+    EXPECT_EQ(expt.len, mbuf.len);
+    EXPECT_EQ(0, memcmp(flat, test_buf, expt.len));
+    init_msgpack_counter(&counter);
+    test_write_rows(&counter, true);
+    EXPECT_EQ(expt.len, counter.len);
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    test_write_rows(&mbuf, false);
+    EXPECT_EQ(expt.len + 3 * 4 - 2, mbuf.len);
+    TEST_CHECK_EQUAL("\xdf\x00\x00\x00\x02\xa4rows\xdd\x00\x00\x00\x14\x00\x01", test_buf, 17);
+    TEST_CHECK_EQUAL("\xa4none\xdd\x00\x00\x00\x00", test_buf + mbuf.len - 10, 10);
+    init_msgpack_counter(&counter);
+    test_write_rows(&counter, false);
+    EXPECT_EQ(mbuf.len, counter.len);
+
+    /* A header before referenced bytes keeps its size. */
+    memset(blob, 'b', sizeof(blob));
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    init_msgpack_iovec_list(&list, iov, 4, 64);
+    mbuf.iov = &list;
+    EXPECT_TRUE(msgpack_write_arr_begin(&mbuf, &arr));
+    EXPECT_TRUE(msgpack_write_bin(&mbuf, blob, sizeof(blob)));
+    EXPECT_TRUE(msgpack_write_end(&mbuf, &arr, 1, true));
+    EXPECT_TRUE(msgpack_iovec_finish(&mbuf));
+    EXPECT_EQ(2, list.cnt);
+    TEST_CHECK_EQUAL("\xdd\x00\x00\x00\x01\xc4\x64", test_buf, 7);
+    EXPECT_EQ(7, iov[0].iov_len);
+
+    arr.pos = mbuf.len;
+    EXPECT_FALSE(msgpack_write_end(&mbuf, &arr, 1, true));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_buffer_errno(&mbuf));
+    init_msgpack_buffer(&mbuf, test_buf, 3);
+    EXPECT_FALSE(msgpack_write_map_begin(&mbuf, &arr));
+    EXPECT_EQ(MSGPACK_ENOBUF, msgpack_buffer_errno(&mbuf));
+    EXPECT_FALSE(msgpack_write_end(&mbuf, &arr, 0, true));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_buffer_errno(&mbuf));
+}
+
+TEST(msgpack, validate)
+{
+    msgpack_limits_t limits;
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    char str[40];
+    uint32_t i;
+
+    memset(str, 's', sizeof(str));
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 3);
+    msgpack_write_str(&mbuf, "ints", 4);
+    msgpack_write_arr(&mbuf, 100);
+    for (i = 0; i < 100; ++i) {
+        if (i == 50) {
+            msgpack_write_u16(&mbuf, 1000);
+        } else {
+            msgpack_write_integer(&mbuf, (int64_t)i - 20);
+        }
+    }
+    msgpack_write_str(&mbuf, "text", 4);
+    msgpack_write_str(&mbuf, str, sizeof(str));
+    msgpack_write_str(&mbuf, "nested", 6);
+    msgpack_write_arr(&mbuf, 2);
+    msgpack_write_arr(&mbuf, 1);
+    msgpack_write_nil(&mbuf);
+    msgpack_write_ext(&mbuf, 3, str, 4);
+    msgpack_write_true(&mbuf);
+
+    init_msgpack_limits(&limits);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(mbuf.len - 1, unpacker.pos);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(mbuf.len, unpacker.pos);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+
+    /* Each limit just at and just below the value. */
+    limits.max_depth = 3;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    limits.max_depth = 2;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+
+    init_msgpack_limits(&limits);
+    limits.max_elements = 6 + 100 + 3;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    limits.max_elements--;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+
+    init_msgpack_limits(&limits);
+    limits.max_str = sizeof(str);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    limits.max_str--;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+    limits.max_str = 3;
+    init_msgpack_unpacker(&unpacker, mbuf.buf + 1, 5, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+
+    init_msgpack_limits(&limits);
+    limits.max_size = mbuf.len - 1;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    limits.max_size--;
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+
+    /* Every cut of the value is short of bytes. */
+    init_msgpack_limits(&limits);
+    for (i = 0; i < mbuf.len - 1; ++i) {
+        init_msgpack_unpacker(&unpacker, mbuf.buf, i, 0);
+        EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+        EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+    }
+
+    /* A count over the bytes left fails before reading the values. */
+    memcpy(test_data, "\xdd\xff\xff\xff\xff\x01\x02", 7);
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data, 7, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_unpacker_errno(&unpacker));
+    memcpy(test_data, "\x92\x01\xc1", 3);
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data, 3, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_EUNKNOWN, msgpack_unpacker_errno(&unpacker));
+    /* [[[]]] nests two containers, the empty one adds no depth. */
+    memcpy(test_data, "\x91\x91\x90", 3);
+    limits.max_depth = 2;
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data, 3, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(3, unpacker.pos);
+    limits.max_depth = 1;
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data, 3, 0);
+    EXPECT_FALSE(msgpack_validate(&unpacker, &limits));
+    EXPECT_EQ(MSGPACK_ELIMIT, msgpack_unpacker_errno(&unpacker));
+    limits.max_depth = 0;
+    init_msgpack_unpacker(&unpacker, (uint8_t *)test_data + 2, 1, 0);
+    EXPECT_TRUE(msgpack_validate(&unpacker, &limits));
+    EXPECT_FALSE(msgpack_validate(NULL, &limits));
+    EXPECT_EQ(MSGPACK_EINVL, msgpack_errno());
+}
+
+TEST(msgpack, utf8)
+{
+    static const char *good[] = {
+        "", "ascii", "\xC2\xA9", "\xE2\x82\xAC", "\xED\x9F\xBF", "\xEF\xBF\xBF",
+        "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF",
+    };
+    static const char *bad[] = {
+        "\x80", "\xC0\xAF", "\xC1\xBF", "\xE0\x9F\xBF", "\xED\xA0\x80",
+        "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF",
+        "\xC2", "\xE2\x82", "\xF0\x90\x80", "\xE2\x28\xA1",
+    };
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_stream_t st;
+    uint8_t stage[128];
+    const uint8_t *view;
+    char str[80];
+    char out[80];
+    uint32_t len;
+    uint8_t type;
+    size_t i;
+
+    for (i = 0; i < sizeof(good) / sizeof(good[0]); ++i) {
+        EXPECT_TRUE(msgpack_utf8_valid(good[i], strlen(good[i])));
+    }
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        EXPECT_FALSE(msgpack_utf8_valid(bad[i], strlen(bad[i])));
+    }
+
+    /* Long ASCII runs around the multibyte sequences. */
+    memset(str, 'a', sizeof(str));
+    memcpy(str + 33, "\xE2\x82\xAC", 3);
+    EXPECT_TRUE(msgpack_utf8_valid(str, sizeof(str)));
+    str[35] = 'a';
+    EXPECT_FALSE(msgpack_utf8_valid(str, sizeof(str)));
+    str[35] = (char)0xAC;
+    str[sizeof(str) - 1] = (char)0xC2;
+    EXPECT_FALSE(msgpack_utf8_valid(str, sizeof(str)));
+    str[sizeof(str) - 1] = 'a';
+
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_str(&mbuf, str, sizeof(str));
+    msgpack_write_str(&mbuf, "\xED\xA0\x80", 3);
+    msgpack_write_bin(&mbuf, "\xED\xA0\x80", 3);
+
+    /* Not checked without the flag. */
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_EQ(0, unpacker.flags);
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(out);
+    EXPECT_TRUE(msgpack_unpack(&unpacker, out, &len, &type));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_unpack_view(&unpacker, &view, &len, &type));
+
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    unpacker.flags |= MSGPACK_UNPACK_UTF8;
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(out);
+    EXPECT_TRUE(msgpack_unpack(&unpacker, out, &len, &type));
+    EXPECT_EQ(sizeof(str), len);
+    i = unpacker.pos;
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(out);
+    EXPECT_FALSE(msgpack_unpack(&unpacker, out, &len, &type));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(i, unpacker.pos);
+    /* The length query does not read the value. */
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_unpack(&unpacker, NULL, &len, &type));
+    EXPECT_EQ(3, len);
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_FALSE(msgpack_unpack_view(&unpacker, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(i, unpacker.pos);
+    EXPECT_TRUE(msgpack_skip(&unpacker));
+    /* bin is not text. */
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_unpack_view(&unpacker, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_TYPE_BIN, type);
+
+    /* The flag of a stream holds across chunks and the stage. */
+    init_msgpack_stream(&st, stage, sizeof(stage));
+    st.up.flags |= MSGPACK_UNPACK_UTF8;
+    EXPECT_TRUE(msgpack_stream_feed(&st, mbuf.buf, 10));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_FALSE(msgpack_stream_unpack_view(&st, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_EENDBUF, msgpack_stream_errno(&st));
+    EXPECT_TRUE(msgpack_stream_feed(&st, mbuf.buf + 10, mbuf.len - 10));
+    EXPECT_EQ(MSGPACK_UNPACK_UTF8, st.up.flags);
+    type = MSGPACK_TYPE_ANY;
+    len = sizeof(out);
+    EXPECT_TRUE(msgpack_stream_unpack(&st, out, &len, &type));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_FALSE(msgpack_stream_unpack_view(&st, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_stream_errno(&st));
+}
+
+TEST(msgpack, utf8_readers)
+{
+    struct test_record rec = {"\xED\xA0\x80", 1, 2, true, 0.5, 2.0f};
+    msgpack_buffer_t mbuf;
+    msgpack_unpacker_t unpacker;
+    msgpack_unpacker_t cur;
+    msgpack_arena_t arena;
+    msgpack_node_t *root;
+    msgpack_index_t *idx;
+    msgpack_index_t *child;
+    uint64_t arena_buf[64];
+    const uint8_t *view;
+    uint32_t len;
+    uint8_t type;
+
+    /* A str field of a struct. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    EXPECT_TRUE(msgpack_write_struct(&mbuf, &test_record_schema, &rec));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_unpack_struct(&unpacker, &test_record_schema, &rec));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    unpacker.flags |= MSGPACK_UNPACK_UTF8;
+    EXPECT_FALSE(msgpack_unpack_struct(&unpacker, &test_record_schema, &rec));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+
+    /* {"ok": "fine", "list": ["\xED\xA0\x80"]} */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 2);
+    msgpack_write_str(&mbuf, "ok", 2);
+    msgpack_write_str(&mbuf, "fine", 4);
+    msgpack_write_str(&mbuf, "list", 4);
+    msgpack_write_arr(&mbuf, 1);
+    msgpack_write_str(&mbuf, "\xED\xA0\x80", 3);
+
+    init_msgpack_arena(&arena, (uint8_t *)arena_buf, sizeof(arena_buf));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_parse(&unpacker, &arena, &root));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    unpacker.flags |= MSGPACK_UNPACK_UTF8;
+    EXPECT_FALSE(msgpack_parse(&unpacker, &arena, &root));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+
+    /* An index checks the values as they are read through it. */
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    unpacker.flags |= MSGPACK_UNPACK_UTF8;
+    EXPECT_TRUE(msgpack_index_open(&unpacker, &arena, &idx));
+    EXPECT_TRUE(msgpack_index_at(idx, 0, &cur));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_TRUE(msgpack_unpack_view(&cur, &view, &len, &type));
+    EXPECT_TRUE(msgpack_index_child(idx, 1, &arena, &child));
+    EXPECT_TRUE(msgpack_index_at(child, 0, &cur));
+    type = MSGPACK_TYPE_ANY;
+    EXPECT_FALSE(msgpack_unpack_view(&cur, &view, &len, &type));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&cur));
+
+    /* ... and the keys of a map when it is built. */
+    init_msgpack_buffer(&mbuf, test_buf, sizeof(test_buf));
+    msgpack_write_map(&mbuf, 1);
+    msgpack_write_str(&mbuf, "\xC0\xAF", 2);
+    msgpack_write_nil(&mbuf);
+    msgpack_arena_release(&arena);
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    EXPECT_TRUE(msgpack_index_open(&unpacker, &arena, &idx));
+    init_msgpack_unpacker(&unpacker, mbuf.buf, mbuf.len, 0);
+    unpacker.flags |= MSGPACK_UNPACK_UTF8;
+    EXPECT_FALSE(msgpack_index_open(&unpacker, &arena, &idx));
+    EXPECT_EQ(MSGPACK_EUTF8, msgpack_unpacker_errno(&unpacker));
+    EXPECT_EQ(0, unpacker.pos);
+    msgpack_arena_release(&arena);
 }
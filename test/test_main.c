@@ -29,6 +29,31 @@ DECLARE_TEST(msgpack, read_simple);
 DECLARE_TEST(msgpack, read_string);
 DECLARE_TEST(msgpack, read_len);
 DECLARE_TEST(msgpack, error_call);
+DECLARE_TEST(msgpack, write_growable);
+DECLARE_TEST(msgpack, context_errno);
+DECLARE_TEST(msgpack, endian);
+DECLARE_TEST(msgpack, put);
+DECLARE_TEST(msgpack, read_view);
+DECLARE_TEST(msgpack, read_stream);
+DECLARE_TEST(msgpack, write_iovec);
+DECLARE_TEST(msgpack, skip);
+DECLARE_TEST(msgpack, ext);
+DECLARE_TEST(msgpack, parse);
+DECLARE_TEST(msgpack, index);
+DECLARE_TEST(msgpack, scan);
+DECLARE_TEST(msgpack, schema);
+DECLARE_TEST(msgpack, keyset);
+DECLARE_TEST(msgpack, keyset_perfect);
+DECLARE_TEST(msgpack, write_typed_array);
+DECLARE_TEST(msgpack, unpack_typed_array);
+DECLARE_TEST(msgpack, counter);
+DECLARE_TEST(msgpack, write_deferred);
+DECLARE_TEST(msgpack, validate);
+DECLARE_TEST(msgpack, utf8);
+DECLARE_TEST(msgpack, utf8_readers);
+#if MSGPACK_BUFFER_POOL
+DECLARE_TEST(msgpack, pool);
+#endif
 
 int main(void) {
   RUN_TEST(msgpack, write_simple);
@@ -37,5 +62,30 @@ int main(void) {
   RUN_TEST(msgpack, read_string);
   RUN_TEST(msgpack, read_len);
   RUN_TEST(msgpack, error_call);
+  RUN_TEST(msgpack, write_growable);
+  RUN_TEST(msgpack, context_errno);
+  RUN_TEST(msgpack, endian);
+  RUN_TEST(msgpack, put);
+  RUN_TEST(msgpack, read_view);
+  RUN_TEST(msgpack, read_stream);
+  RUN_TEST(msgpack, write_iovec);
+  RUN_TEST(msgpack, skip);
+  RUN_TEST(msgpack, ext);
+  RUN_TEST(msgpack, parse);
+  RUN_TEST(msgpack, index);
+  RUN_TEST(msgpack, scan);
+  RUN_TEST(msgpack, schema);
+  RUN_TEST(msgpack, keyset);
+  RUN_TEST(msgpack, keyset_perfect);
+  RUN_TEST(msgpack, write_typed_array);
+  RUN_TEST(msgpack, unpack_typed_array);
+  RUN_TEST(msgpack, counter);
+  RUN_TEST(msgpack, write_deferred);
+  RUN_TEST(msgpack, validate);
+  RUN_TEST(msgpack, utf8);
+  RUN_TEST(msgpack, utf8_readers);
+#if MSGPACK_BUFFER_POOL
+  RUN_TEST(msgpack, pool);
+#endif
   return 0;
 }